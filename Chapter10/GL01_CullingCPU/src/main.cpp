@@ -1,15 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <chrono>
 #include <vector>
 
 #include "shared/glFramework/GLFWApp.h"
 #include "shared/glFramework/GLShader.h"
+#include "shared/glFramework/GLUploadRing.h"
 #include "shared/glFramework/GLSceneData.h"
 #include "shared/glFramework/GLFramebuffer.h"
 #include "shared/glFramework/LineCanvasGL.h"
 #include "shared/glFramework/UtilsGLImGui.h"
 #include "shared/UtilsMath.h"
+#include "shared/UtilsCulling.h"
+#include "shared/OcclusionBuffer.h"
 #include "shared/Camera.h"
+#include "shared/scene/BVH.h"
 #include "shared/scene/VtxData.h"
 #include "Chapter9/GLMesh9.h"
 #include "Chapter10/GLSkyboxRenderer.h"
@@ -37,6 +42,18 @@ bool g_DrawMeshes = true;
 bool g_DrawBoxes = true;
 bool g_DrawGrid = true;
 
+enum CullingMode
+{
+	CullingMode_Parallel = 0,
+	CullingMode_BVH = 1,
+	CullingMode_TemporalCache = 2,
+	CullingMode_Spheres = 3,
+	CullingMode_OrientedBoxes = 4,
+};
+
+int g_CullingMode = CullingMode_BVH;
+bool g_OcclusionCulling = true;
+
 int main(void)
 {
 	GLApp app;
@@ -50,8 +67,8 @@ int main(void)
 
 	const GLsizeiptr kUniformBufferSize = sizeof(PerFrameData);
 
-	GLBuffer perFrameDataBuffer(kUniformBufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, kBufferIndex_PerFrameUniforms, perFrameDataBuffer.getHandle(), 0, kUniformBufferSize);
+	GLint uniformBufferAlignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBufferAlignment);
 
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -121,6 +138,9 @@ int main(void)
 	ImGuiGLRenderer rendererUI;
 	CanvasGL canvas;
 
+	// the object-space boxes for the bounding volumes which are built directly from the node transforms
+	const std::vector<BoundingBox> localBoxes = sceneData.meshData_.boxes_;
+
 	// pretransform bounding boxes to world space
 	for (const auto& c : sceneData.shapes_)
 	{
@@ -130,6 +150,55 @@ int main(void)
 
 	const BoundingBox fullScene = combineBoxes(sceneData.meshData_.boxes_);
 
+	// world-space boxes of all the shapes in the SoA layout for the batch culling
+	std::vector<BoundingBox> worldBoxes;
+	worldBoxes.reserve(sceneData.shapes_.size());
+	for (const auto& c : sceneData.shapes_)
+		worldBoxes.push_back(sceneData.meshData_.boxes_[c.meshIndex]);
+
+	BoundingBoxSoA shapeBoxes;
+	shapeBoxes.assign(worldBoxes);
+
+	// the shapes are static in this demo, so the hierarchy is never refitted
+	BVH bvh;
+	bvh.build(worldBoxes);
+
+	// only the boxes near the frustum planes are retested while the camera moves smoothly
+	FrustumCullingCache cullingCache;
+	cullingCache.setBoxes(worldBoxes);
+
+	// the world-space AABBs above are inflated for the rotated meshes, these volumes are not
+	std::vector<BoundingSphere> shapeSpheres;
+	std::vector<OrientedBoundingBox> shapeOBBs;
+	shapeSpheres.reserve(sceneData.shapes_.size());
+	shapeOBBs.reserve(sceneData.shapes_.size());
+	for (const auto& c : sceneData.shapes_)
+	{
+		const mat4& model = sceneData.scene_.globalTransform_[c.transformIndex];
+		shapeSpheres.emplace_back(localBoxes[c.meshIndex], model);
+		shapeOBBs.emplace_back(localBoxes[c.meshIndex], model);
+	}
+
+	// the occlusion buffer and the frustum culling run one after another, so they share one pool of worker threads
+	tf::Executor executor;
+
+	// the lowest LODs of the biggest shapes (walls, buildings) hide most of the interiors
+	const float kMinOccluderSize = 10.0f;
+	OcclusionBuffer occlusionBuffer(executor);
+	const uint32_t numOccluders = addSceneOccluders(occlusionBuffer, sceneData.meshData_, sceneData.shapes_, sceneData.scene_.globalTransform_, worldBoxes, kMinOccluderSize);
+
+	std::vector<uint64_t> visibility;
+
+	ParallelFrustumCuller culler(executor);
+
+	// the per-frame data and the visible draw commands (written right away by the culling threads) go to the region
+	// of the current frame, while the GPU may still read the regions of the previous frames
+	const uint32_t kNumFramesInFlight = 3;
+	const size_t numShapes = sceneData.shapes_.size();
+	const size_t uploadFrameSize = kUniformBufferSize + sizeof(DrawElementsIndirectCommand) * numShapes + 2 * UploadRing::kMaxAlignment;
+	GLUploadRingBackend uploadBackend(kNumFramesInFlight);
+	UploadRing uploadRing(uploadBackend, uploadFrameSize, kNumFramesInFlight);
+
 	while (!glfwWindowShouldClose(app.getWindow()))
 	{
 		positioner.update(app.getDeltaSeconds(), mouseState.pos, mouseState.pressedLeft);
@@ -145,8 +214,12 @@ int main(void)
 		const mat4 proj = glm::perspective(45.0f, ratio, 0.1f, 1000.0f);
 		const mat4 view = camera.getViewMatrix();
 
+		// wait until the GPU has finished the frame which used this region a few frames ago
+		uploadRing.beginFrame();
+
 		const PerFrameData perFrameData = { .view = view, .proj = proj, .light = mat4(0.0f), .cameraPos = glm::vec4(camera.getPosition(), 1.0f) };
-		glNamedBufferSubData(perFrameDataBuffer.getHandle(), 0, kUniformBufferSize, &perFrameData);
+		const UploadAllocation perFrameUniforms = uploadRing.upload(&perFrameData, kUniformBufferSize, uniformBufferAlignment);
+		glBindBufferRange(GL_UNIFORM_BUFFER, kBufferIndex_PerFrameUniforms, uploadBackend.getHandle(), perFrameUniforms.offset_, kUniformBufferSize);
 
 		if (!g_FreezeCullingView)
 			g_CullingView = camera.getViewMatrix();
@@ -157,22 +230,59 @@ int main(void)
 		getFrustumCorners(proj * g_CullingView, frustumCorners);
 
 		// cull
+		const UploadAllocation culled = uploadRing.allocate(sizeof(DrawElementsIndirectCommand) * numShapes, alignof(DrawElementsIndirectCommand));
+		DrawElementsIndirectCommand* culledCommands = (DrawElementsIndirectCommand*)culled.ptr_;
 		int numVisibleMeshes = 0;
+		double cullingMs = 0.0;
 		{
-			DrawElementsIndirectCommand* cmd = mesh.bufferIndirect_.drawCommands_.data();
-			for (const auto& c : sceneData.shapes_)
+			const auto cullingStart = std::chrono::steady_clock::now();
+
+			if (g_CullingMode == CullingMode_BVH)
+			{
+				numVisibleMeshes = (int)bvh.cullFrustum(frustumPlanes, frustumCorners, visibility);
+			}
+			else if (g_CullingMode == CullingMode_TemporalCache)
+			{
+				numVisibleMeshes = (int)cullingCache.cull(frustumPlanes, frustumCorners, visibility);
+			}
+			else if (g_CullingMode == CullingMode_Spheres)
+			{
+				numVisibleMeshes = (int)cullSpheresInFrustum(frustumPlanes, frustumCorners, shapeSpheres, visibility);
+			}
+			else if (g_CullingMode == CullingMode_OrientedBoxes)
+			{
+				numVisibleMeshes = (int)cullOrientedBoxesInFrustum(frustumPlanes, frustumCorners, shapeOBBs, visibility);
+			}
+			else
 			{
-				cmd->instanceCount_ = isBoxInFrustum(frustumPlanes, frustumCorners, sceneData.meshData_.boxes_[c.meshIndex]) ? 1 : 0;
-				numVisibleMeshes += (cmd++)->instanceCount_;
+				// the commands are written right away, unless the occlusion culling has to remove some of them first
+				numVisibleMeshes = (int)culler.cull(frustumPlanes, frustumCorners, shapeBoxes, mesh.bufferIndirect_.drawCommands_, g_OcclusionCulling ? nullptr : culledCommands);
+				visibility = culler.getVisibility();
 			}
-			mesh.bufferIndirect_.uploadIndirectBuffer();
+
+			if (g_OcclusionCulling)
+			{
+				occlusionBuffer.render(proj * g_CullingView);
+				numVisibleMeshes = (int)occlusionBuffer.testBoxes(worldBoxes, visibility);
+			}
+
+			if (g_CullingMode != CullingMode_Parallel || g_OcclusionCulling)
+				compactVisibleCommands(visibility.data(), 0, numShapes, mesh.bufferIndirect_.drawCommands_.data(), sizeof(DrawElementsIndirectCommand), culledCommands);
+
+			cullingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullingStart).count();
 		}
 
 		if (g_DrawBoxes)
 		{
-			DrawElementsIndirectCommand* cmd = mesh.bufferIndirect_.drawCommands_.data();
-			for (const auto& c : sceneData.shapes_)
-				drawBox3dGL(canvas, mat4(1.0f), sceneData.meshData_.boxes_[c.meshIndex], (cmd++)->instanceCount_ ? vec4(0, 1, 0, 1) : vec4(1, 0, 0, 1));
+			for (size_t i = 0; i != numShapes; i++)
+			{
+				const vec4 color = isVisible(visibility, i) ? vec4(0, 1, 0, 1) : vec4(1, 0, 0, 1);
+				const DrawData& shape = sceneData.shapes_[i];
+				if (g_CullingMode == CullingMode_OrientedBoxes)
+					drawBox3dGL(canvas, sceneData.scene_.globalTransform_[shape.transformIndex], localBoxes[shape.meshIndex], color);
+				else
+					drawBox3dGL(canvas, mat4(1.0f), sceneData.meshData_.boxes_[shape.meshIndex], color);
+			}
 			drawBox3dGL(canvas, mat4(1.0f), fullScene, vec4(1, 0, 0, 1));
 		}
 
@@ -184,7 +294,7 @@ int main(void)
 		if (g_DrawMeshes)
 		{
 			program.useProgram();
-			mesh.draw(sceneData.shapes_.size());
+			mesh.draw(numVisibleMeshes, uploadBackend.getHandle(), culled.offset_);
 		}
 
 		// 1.2 Grid
@@ -210,12 +320,22 @@ int main(void)
 		ImGui::Checkbox("Grid",  &g_DrawGrid);
 		ImGui::Separator();
 		ImGui::Checkbox("Freeze culling frustum (P)", &g_FreezeCullingView);
+		ImGui::Combo("Frustum culling", &g_CullingMode, "Parallel SIMD\0Hierarchical (BVH)\0Temporal cache\0Spheres\0Oriented boxes\0");
+		if (g_CullingMode == CullingMode_TemporalCache)
+			ImGui::Text("Cached: %u, retested: %u", cullingCache.getStats().reused_, cullingCache.getStats().retested_);
+		ImGui::Checkbox("Occlusion culling", &g_OcclusionCulling);
+		ImGui::Text("Occluders: %u shapes, %u triangles", numOccluders, (uint32_t)occlusionBuffer.getNumOccluderTriangles());
 		ImGui::Separator();
 		ImGui::Text("Visible meshes: %i", numVisibleMeshes);
+		ImGui::Text("Culling time: %.3f ms", cullingMs);
+		ImGui::Text("Uploaded: %u of %u bytes", (uint32_t)uploadRing.getFrameUsage(), (uint32_t)uploadRing.getFrameSize());
 		ImGui::End();
 		ImGui::Render();
 		rendererUI.render(width, height, ImGui::GetDrawData());
 
+		// everything using the uploads of this frame has been submitted
+		uploadRing.endFrame();
+
 		app.swapBuffers();
 	}
 
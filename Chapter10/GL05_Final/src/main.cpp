@@ -9,6 +9,8 @@
 #include "shared/glFramework/LineCanvasGL.h"
 #include "shared/glFramework/UtilsGLImGui.h"
 #include "shared/UtilsMath.h"
+#include "shared/UtilsCulling.h"
+#include "shared/ShadowCascades.h"
 #include "shared/UtilsFPS.h"
 #include "shared/Camera.h"
 #include "shared/scene/VtxData.h"
@@ -71,6 +73,11 @@ bool g_EnableHDR = true;
 bool g_DrawBoxes = false;
 bool g_EnableShadows = true;
 bool g_ShowLightFrustum = false;
+bool g_CullShadowCasters = true;
+bool g_FitShadowToView = true;
+bool g_StableShadows = true;
+float g_ShadowDistance = 200.0f;
+bool g_SortDrawCommands = true;
 float g_LightTheta = 0.0f;
 float g_LightPhi = 0.0f;
 
@@ -288,6 +295,14 @@ int main(void)
 		bigBox.combinePoint(b.max_);
 	}
 
+	// shadow casters which cannot cast a shadow into the view are not rendered into the shadow map
+	BoundingBoxSoA shapeBoxes;
+	shapeBoxes.assign(reorderedBoxes);
+	std::vector<uint64_t> casterVisibility;
+	GLIndirectBuffer shadowCasters(sceneData.shapes_.size());
+	// long enough for the shadow of any caster to cross the whole scene
+	const float shadowSweepLength = glm::length(bigBox.getSize());
+
 	FramesPerSecondCounter fpsCounter(0.5f);
 
 	auto imGuiPushFlagsAndStyles = [](bool value)
@@ -301,7 +316,8 @@ int main(void)
 		ImGui::PopStyleVar();
 	};
 
-	GLFramebuffer shadowMap(8192, 8192, GL_R8, GL_DEPTH_COMPONENT24);
+	const int kShadowMapSize = 8192;
+	GLFramebuffer shadowMap(kShadowMapSize, kShadowMapSize, GL_R8, GL_DEPTH_COMPONENT24);
 	const GLint swizzleMask[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
 	glTextureParameteriv(shadowMap.getTextureColor().getHandle(), GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
 	glTextureParameteriv(shadowMap.getTextureDepth().getHandle(), GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
@@ -335,9 +351,23 @@ int main(void)
 		const glm::mat4 rot1 = glm::rotate(mat4(1.f), glm::radians(g_LightTheta), glm::vec3(0, 0, 1));
 		const glm::mat4 rot2 = glm::rotate(rot1, glm::radians(g_LightPhi), glm::vec3(1, 0, 0));
 		const vec3 lightDir = glm::normalize(vec3(rot2 * vec4(0.0f, -1.0f, 0.0f, 1.0f)));
-		const mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDir, vec3(0, 0, 1));
+		mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDir, vec3(0, 0, 1));
 		const BoundingBox box = bigBox.getTransformed(lightView);
-		const mat4 lightProj = glm::ortho(box.min_.x, box.max_.x, box.min_.y, box.max_.y, -box.max_.z, -box.min_.z);
+		mat4 lightProj = glm::ortho(box.min_.x, box.max_.x, box.min_.y, box.max_.y, -box.max_.z, -box.min_.z);
+
+		if (g_FitShadowToView)
+		{
+			// a single cascade which covers only the visible part of the scene instead of all of it
+			const ShadowCascadeParams cascadeParams = {
+				.numCascades_ = 1,
+				.shadowMapSize_ = kShadowMapSize,
+				.maxShadowDistance_ = g_ShadowDistance,
+				.stabilize_ = g_StableShadows
+			};
+			const ShadowCascade cascade = fitShadowCascades(proj, view, lightDir, bigBox, cascadeParams).front();
+			lightView = cascade.view_;
+			lightProj = cascade.proj_;
+		}
 
 		PerFrameData perFrameData = {
 			.view = view,
@@ -351,6 +381,21 @@ int main(void)
 
 		clearTransparencyBuffers();
 
+		// sort the opaque meshes front-to-back for early-z rejection. The transparent meshes are not sorted: the OIT
+		// composite pass sorts the fragments of every pixel, so their draw order does not matter
+		if (g_SortDrawCommands)
+		{
+			const vec3 cameraPos = camera.getPosition();
+			const vec3 viewDir = -vec3(view[0][2], view[1][2], view[2][2]);
+			auto getViewDepth = [&](const DrawElementsIndirectCommand& c)
+			{
+				return glm::dot(reorderedBoxes[c.baseInstance_ >> 16].getCenter() - cameraPos, viewDir);
+			};
+			mesh.bufferIndirect_.selectSortedTo(meshesOpaque,
+				[&isTransparent](const DrawElementsIndirectCommand& c) { return !isTransparent(c); },
+				[&getViewDepth](const DrawElementsIndirectCommand& c) { return makeFrontToBackSortKey(getViewDepth(c), c.baseInstance_ & 0xffff); });
+		}
+
 		// cull
 		{
 			*numVisibleMeshesPtr = 0;
@@ -387,7 +432,20 @@ int main(void)
 			glClearNamedFramebufferfi(shadowMap.getHandle(), GL_DEPTH_STENCIL, 0, 1.0f, 0);
 			shadowMap.bind();
 			progShadowMap.useProgram();
-			mesh.draw(mesh.bufferIndirect_.drawCommands_.size());
+			if (g_CullShadowCasters)
+			{
+				vec4 lightFrustumPlanes[6];
+				getFrustumPlanes(lightProj * lightView, lightFrustumPlanes);
+				const uint32_t numCasters = cullShadowCasters(lightFrustumPlanes, lightDir, shadowSweepLength, perFrameData.frustumPlanes, nullptr, shapeBoxes, casterVisibility);
+				shadowCasters.drawCommands_.resize(numCasters);
+				compactVisibleCommands(casterVisibility.data(), 0, shapeBoxes.size(), mesh.bufferIndirect_.drawCommands_.data(), sizeof(DrawElementsIndirectCommand), shadowCasters.drawCommands_.data());
+				shadowCasters.uploadIndirectBuffer();
+				mesh.draw(numCasters, &shadowCasters);
+			}
+			else
+			{
+				mesh.draw(mesh.bufferIndirect_.drawCommands_.size());
+			}
 			shadowMap.unbind();
 			perFrameData.light = lightProj * lightView;
 			glBindTextureUnit(4, shadowMap.getTextureDepth().getHandle());
@@ -571,6 +629,7 @@ int main(void)
 		ImGui::Indent(indentSize);
 		ImGui::Checkbox("Opaque meshes", &g_DrawOpaque);
 		ImGui::Checkbox("Transparent meshes", &g_DrawTransparent);
+		ImGui::Checkbox("Sort by depth", &g_SortDrawCommands);
 		ImGui::Unindent(indentSize);
 		ImGui::Separator();
 		ImGui::Text("GPU culling:");
@@ -613,6 +672,15 @@ int main(void)
 		ImGui::Checkbox("Show light's frustum (red) and scene AABB (white)", &g_ShowLightFrustum);
 		ImGui::SliderFloat("Light Theta", &g_LightTheta, -85.0f, +85.0f);
 		ImGui::SliderFloat("Light Phi", &g_LightPhi, -85.0f, +85.0f);
+		ImGui::Checkbox("Cull shadow casters", &g_CullShadowCasters);
+		ImGui::Checkbox("Fit shadow map to view", &g_FitShadowToView);
+		if (g_FitShadowToView)
+		{
+			ImGui::Checkbox("Stable shadows", &g_StableShadows);
+			ImGui::SliderFloat("Shadow distance", &g_ShadowDistance, 10.0f, 1000.0f);
+		}
+		if (g_CullShadowCasters)
+			ImGui::Text("Shadow casters: %i", (int)shadowCasters.drawCommands_.size());
 		imGuiPopFlagsAndStyles();
 		ImGui::Unindent(indentSize);
 		ImGui::Separator();
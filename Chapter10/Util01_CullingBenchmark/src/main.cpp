@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "shared/UtilsMath.h"
+#include "shared/UtilsCulling.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+/*
+	Frustum culling of 100k random boxes with the scalar and SIMD paths of UtilsCulling.h:
+	 - isBoxInFrustum() for every box (the original per-box test from UtilsMath.h),
+	 - cullBoxesInFrustumScalar() over the SoA boxes,
+	 - cullBoxesInFrustum() over the same boxes with SSE2 or AVX.
+	All of them should give the same visibility for every box.
+
+	The indirect draw commands of the visible boxes are compacted with compactVisibleCommands() and with the
+	multithreaded ParallelFrustumCuller::cull(), both should give the same commands and draw count as
+	compactVisibleCommandsReference().
+*/
+
+const size_t kNumBoxes = 100000;
+const int kNumFrusta = 50;
+const int kNumRepeats = 5;
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+// the same layout as DrawElementsIndirectCommand of GLMesh9.h
+struct DrawCommand
+{
+	uint32_t count_;
+	uint32_t instanceCount_;
+	uint32_t firstIndex_;
+	uint32_t baseVertex_;
+	uint32_t baseInstance_;
+};
+
+double getMilliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+	srand(36);
+
+	// a scene of 1 km with objects from 10 cm to 8 m
+	std::vector<BoundingBox> boxes(kNumBoxes);
+	for (auto& b : boxes)
+	{
+		const vec3 center = randomVec(vec3(-500.0f), vec3(500.0f));
+		const vec3 halfSize = randomVec(vec3(0.05f), vec3(4.0f));
+		b = BoundingBox(center - halfSize, center + halfSize);
+	}
+
+	BoundingBoxSoA boxesSoA;
+	boxesSoA.assign(boxes);
+
+	std::vector<DrawCommand> commands(kNumBoxes);
+	for (size_t i = 0; i != kNumBoxes; i++)
+		commands[i] = { .count_ = 3 * (uint32_t)(i % 1000 + 1), .instanceCount_ = 1, .firstIndex_ = (uint32_t)(3 * i), .baseVertex_ = 0, .baseInstance_ = (uint32_t)i };
+
+	std::vector<DrawCommand> commandsReference;
+	std::vector<DrawCommand> commandsCompacted(kNumBoxes);
+	std::vector<DrawCommand> commandsParallel(kNumBoxes);
+
+	tf::Executor executor;
+	ParallelFrustumCuller culler(executor);
+
+	std::vector<uint64_t> visibilityScalar;
+	std::vector<uint64_t> visibilitySIMD;
+
+	double timePerBox = 0.0;
+	double timeScalar = 0.0;
+	double timeSIMD = 0.0;
+	double timeParallel = 0.0;
+	uint64_t numVisible = 0;
+	size_t numMismatches = 0;
+	int numCompactionMismatches = 0;
+
+	for (int f = 0; f != kNumFrusta; f++)
+	{
+		const vec3 eye = randomVec(vec3(-400.0f), vec3(400.0f));
+		const vec3 target = eye + randomVec(vec3(-1.0f), vec3(1.0f));
+		const mat4 proj = glm::perspective(glm::radians(randomFloat(45.0f, 90.0f)), 16.0f / 9.0f, 0.1f, randomFloat(100.0f, 1000.0f));
+		const mat4 view = glm::lookAt(eye, target, vec3(0.0f, 1.0f, 0.0f));
+
+		vec4 frustumPlanes[6];
+		vec4 frustumCorners[8];
+		getFrustumPlanes(proj * view, frustumPlanes);
+		getFrustumCorners(proj * view, frustumCorners);
+
+		std::vector<bool> visibilityPerBox(kNumBoxes);
+
+		for (int r = 0; r != kNumRepeats; r++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i != kNumBoxes; i++)
+				visibilityPerBox[i] = isBoxInFrustum(frustumPlanes, frustumCorners, boxes[i]);
+			timePerBox += getMilliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			cullBoxesInFrustumScalar(frustumPlanes, frustumCorners, boxesSoA, visibilityScalar);
+			timeScalar += getMilliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			numVisible += cullBoxesInFrustum(frustumPlanes, frustumCorners, boxesSoA, visibilitySIMD);
+			timeSIMD += getMilliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			culler.cull(frustumPlanes, frustumCorners, boxesSoA, commands, commandsParallel.data());
+			timeParallel += getMilliseconds(start);
+		}
+
+		for (size_t i = 0; i != kNumBoxes; i++)
+		{
+			if (isVisible(visibilityScalar, i) != visibilityPerBox[i] || isVisible(visibilitySIMD, i) != visibilityPerBox[i])
+				numMismatches++;
+		}
+
+		const uint32_t countReference = compactVisibleCommandsReference(visibilitySIMD, commands, commandsReference);
+		const uint32_t countCompacted = compactVisibleCommands(visibilitySIMD.data(), 0, kNumBoxes, commands.data(), sizeof(DrawCommand), commandsCompacted.data());
+		const uint32_t countParallel = culler.cull(frustumPlanes, frustumCorners, boxesSoA, commands, commandsParallel.data());
+
+		if (countCompacted != countReference || memcmp(commandsCompacted.data(), commandsReference.data(), countReference * sizeof(DrawCommand)) ||
+			countParallel != countReference || memcmp(commandsParallel.data(), commandsReference.data(), countReference * sizeof(DrawCommand)) ||
+			culler.getVisibility() != visibilitySIMD)
+		{
+			printf("Frustum %d: %u reference commands, %u compacted, %u from ParallelFrustumCuller\n", f, countReference, countCompacted, countParallel);
+			numCompactionMismatches++;
+		}
+	}
+
+	const int numRuns = kNumFrusta * kNumRepeats;
+
+	printf("%zu boxes, %d frusta, %.0f visible boxes per frustum\n", kNumBoxes, kNumFrusta, (double)numVisible / numRuns);
+	printf("isBoxInFrustum()            %7.3f ms\n", timePerBox / numRuns);
+	printf("cullBoxesInFrustumScalar()  %7.3f ms\n", timeScalar / numRuns);
+	printf("cullBoxesInFrustum()        %7.3f ms (%.1fx faster than isBoxInFrustum())\n", timeSIMD / numRuns, timePerBox / timeSIMD);
+	printf("ParallelFrustumCuller::cull()%6.3f ms (%zu worker threads, with compaction)\n", timeParallel / numRuns, executor.num_workers());
+	printf("Boxes with a different result: %zu\n", numMismatches);
+	printf("Frusta with different compacted commands: %d\n", numCompactionMismatches);
+
+	return (numMismatches || numCompactionMismatches) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "shared/UtilsMath.h"
+#include "shared/UtilsCulling.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+/*
+	Frustum culling of 100k randomly rotated and scaled shapes with the bounding volumes of UtilsCulling.h:
+	world-space axis-aligned boxes, spheres and oriented boxes.
+
+	For every volume it prints the culling time per shape, the time to rebuild the volume after the shape has moved, and
+	the number of false positives: the shapes which pass the test while their box does not intersect the frustum. The
+	exact intersection is found by clipping the faces of the box by the frustum planes. A shape which intersects the
+	frustum but is culled is a bug, so such shapes are counted as well.
+*/
+
+const size_t kNumShapes = 100000;
+const int kNumFrusta = 50;
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+double getMilliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool isInside(const vec4& plane, const vec3& p)
+{
+	return glm::dot(plane, vec4(p, 1.0f)) >= 0.0f;
+}
+
+/* Clip a convex polygon by all the planes, returns true if anything is left */
+bool clipPolygon(std::vector<vec3> polygon, const vec4* frustumPlanes)
+{
+	std::vector<vec3> clipped;
+
+	for (int i = 0; i != 6 && !polygon.empty(); i++)
+	{
+		clipped.clear();
+
+		for (size_t j = 0; j != polygon.size(); j++)
+		{
+			const vec3& a = polygon[j];
+			const vec3& b = polygon[(j + 1) % polygon.size()];
+			const float da = glm::dot(frustumPlanes[i], vec4(a, 1.0f));
+			const float db = glm::dot(frustumPlanes[i], vec4(b, 1.0f));
+
+			if (da >= 0.0f)
+				clipped.push_back(a);
+			if ((da >= 0.0f) != (db >= 0.0f))
+				clipped.push_back(a + (b - a) * (da / (da - db)));
+		}
+
+		std::swap(polygon, clipped);
+	}
+
+	return !polygon.empty();
+}
+
+/*
+	A box intersects the frustum if one of its faces does, or if the whole frustum is inside the box.
+	The box is 'localBox' transformed by 'model'.
+*/
+bool intersectsFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBox& localBox, const mat4& model)
+{
+	vec3 corners[8];
+	for (int i = 0; i != 8; i++)
+	{
+		const vec3 p((i & 1) ? localBox.max_.x : localBox.min_.x, (i & 2) ? localBox.max_.y : localBox.min_.y, (i & 4) ? localBox.max_.z : localBox.min_.z);
+		corners[i] = vec3(model * vec4(p, 1.0f));
+	}
+
+	for (int i = 0; i != 6; i++)
+	{
+		int numOutside = 0;
+		for (int j = 0; j != 8; j++)
+			numOutside += isInside(frustumPlanes[i], corners[j]) ? 0 : 1;
+		if (numOutside == 8)
+			return false;
+	}
+
+	const int faces[6][4] = { { 0, 2, 6, 4 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 5, 7, 6 } };
+
+	for (const auto& f : faces)
+	{
+		if (clipPolygon({ corners[f[0]], corners[f[1]], corners[f[2]], corners[f[3]] }, frustumPlanes))
+			return true;
+	}
+
+	const vec3 p = vec3(glm::inverse(model) * frustumCorners[0]);
+
+	return
+		p.x >= localBox.min_.x && p.y >= localBox.min_.y && p.z >= localBox.min_.z &&
+		p.x <= localBox.max_.x && p.y <= localBox.max_.y && p.z <= localBox.max_.z;
+}
+
+struct VolumeStats
+{
+	const char* name_;
+	double cullTime_ = 0.0;
+	double updateTime_ = 0.0;
+	uint64_t numVisible_ = 0;
+	uint64_t numFalsePositives_ = 0;
+	uint64_t numMissed_ = 0;
+
+	void add(const std::vector<uint64_t>& visibility, const std::vector<bool>& exactVisibility)
+	{
+		for (size_t i = 0; i != exactVisibility.size(); i++)
+		{
+			const bool visible = isVisible(visibility, i);
+			numVisible_ += visible ? 1 : 0;
+			numFalsePositives_ += (visible && !exactVisibility[i]) ? 1 : 0;
+			numMissed_ += (!visible && exactVisibility[i]) ? 1 : 0;
+		}
+	}
+
+	void print(uint64_t numExactVisible) const
+	{
+		const double nsPerShape = 1e6 / (double)(kNumShapes * kNumFrusta);
+
+		printf("%-16s %6.2f ns %6.2f ns %9.0f %9.0f (%5.1f%%) %6llu\n", name_, cullTime_ * nsPerShape, updateTime_ * nsPerShape,
+			(double)numVisible_ / kNumFrusta, (double)numFalsePositives_ / kNumFrusta, 100.0 * (double)numFalsePositives_ / (double)numExactVisible,
+			(unsigned long long)numMissed_);
+	}
+};
+
+int main()
+{
+	srand(41);
+
+	// boards, beams and crates of a 1 km scene, rotated and slightly non-uniformly scaled
+	std::vector<BoundingBox> localBoxes(kNumShapes);
+	std::vector<mat4> models(kNumShapes);
+
+	for (size_t i = 0; i != kNumShapes; i++)
+	{
+		vec3 halfSize = randomVec(vec3(0.1f), vec3(4.0f));
+		halfSize.y *= 0.2f;
+		const vec3 offset = randomVec(vec3(-1.0f), vec3(1.0f));
+		localBoxes[i] = BoundingBox(offset - halfSize, offset + halfSize);
+
+		const vec3 axis = glm::normalize(randomVec(vec3(-1.0f), vec3(1.0f)));
+		const float scale = randomFloat(0.5f, 2.0f);
+		models[i] =
+			glm::translate(mat4(1.0f), randomVec(vec3(-500.0f), vec3(500.0f))) *
+			glm::rotate(mat4(1.0f), randomFloat(0.0f, 6.283f), axis) *
+			glm::scale(mat4(1.0f), vec3(scale, scale * randomFloat(0.8f, 1.2f), scale));
+	}
+
+	std::vector<BoundingBox> worldBoxes(kNumShapes);
+	std::vector<BoundingSphere> spheres(kNumShapes);
+	std::vector<OrientedBoundingBox> orientedBoxes(kNumShapes);
+	BoundingBoxSoA boxesSoA;
+	boxesSoA.resize(kNumShapes);
+
+	VolumeStats boxStatsScalar = { .name_ = "AABB (scalar)" };
+	VolumeStats boxStats = { .name_ = "AABB (SIMD)" };
+	VolumeStats sphereStats = { .name_ = "Sphere" };
+	VolumeStats orientedBoxStats = { .name_ = "Oriented box" };
+
+	uint64_t numExactVisible = 0;
+
+	std::vector<uint64_t> visibility;
+	std::vector<bool> exactVisibility(kNumShapes);
+
+	for (int f = 0; f != kNumFrusta; f++)
+	{
+		// the same transforms every time, but all the volumes are rebuilt as if every shape has moved
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i != kNumShapes; i++)
+		{
+			worldBoxes[i] = localBoxes[i].getTransformed(models[i]);
+			boxesSoA.set(i, worldBoxes[i]);
+		}
+		const double boxUpdateTime = getMilliseconds(start);
+		boxStatsScalar.updateTime_ += boxUpdateTime;
+		boxStats.updateTime_ += boxUpdateTime;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i != kNumShapes; i++)
+			spheres[i] = BoundingSphere(localBoxes[i], models[i]);
+		sphereStats.updateTime_ += getMilliseconds(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i != kNumShapes; i++)
+			orientedBoxes[i] = OrientedBoundingBox(localBoxes[i], models[i]);
+		orientedBoxStats.updateTime_ += getMilliseconds(start);
+
+		const vec3 eye = randomVec(vec3(-400.0f), vec3(400.0f));
+		const vec3 target = eye + randomVec(vec3(-1.0f), vec3(1.0f));
+		const mat4 proj = glm::perspective(glm::radians(randomFloat(45.0f, 90.0f)), 16.0f / 9.0f, 0.1f, randomFloat(100.0f, 1000.0f));
+		const mat4 view = glm::lookAt(eye, target, vec3(0.0f, 1.0f, 0.0f));
+
+		vec4 frustumPlanes[6];
+		vec4 frustumCorners[8];
+		getFrustumPlanes(proj * view, frustumPlanes);
+		getFrustumCorners(proj * view, frustumCorners);
+
+		for (size_t i = 0; i != kNumShapes; i++)
+		{
+			exactVisibility[i] = intersectsFrustum(frustumPlanes, frustumCorners, localBoxes[i], models[i]);
+			numExactVisible += exactVisibility[i] ? 1 : 0;
+		}
+
+		start = std::chrono::steady_clock::now();
+		cullBoxesInFrustumScalar(frustumPlanes, frustumCorners, boxesSoA, visibility);
+		boxStatsScalar.cullTime_ += getMilliseconds(start);
+		boxStatsScalar.add(visibility, exactVisibility);
+
+		start = std::chrono::steady_clock::now();
+		cullBoxesInFrustum(frustumPlanes, frustumCorners, boxesSoA, visibility);
+		boxStats.cullTime_ += getMilliseconds(start);
+		boxStats.add(visibility, exactVisibility);
+
+		start = std::chrono::steady_clock::now();
+		cullSpheresInFrustum(frustumPlanes, frustumCorners, spheres, visibility);
+		sphereStats.cullTime_ += getMilliseconds(start);
+		sphereStats.add(visibility, exactVisibility);
+
+		start = std::chrono::steady_clock::now();
+		cullOrientedBoxesInFrustum(frustumPlanes, frustumCorners, orientedBoxes, visibility);
+		orientedBoxStats.cullTime_ += getMilliseconds(start);
+		orientedBoxStats.add(visibility, exactVisibility);
+	}
+
+	printf("%zu shapes, %d frusta, %.0f shapes intersect the frustum\n\n", kNumShapes, kNumFrusta, (double)numExactVisible / kNumFrusta);
+	printf("%-16s %9s %9s %9s %19s %6s\n", "", "cull", "update", "visible", "false positives", "missed");
+
+	for (const VolumeStats* s : { &boxStatsScalar, &boxStats, &sphereStats, &orientedBoxStats })
+		s->print(numExactVisible);
+
+	const bool missed = boxStatsScalar.numMissed_ || boxStats.numMissed_ || sphereStats.numMissed_ || orientedBoxStats.numMissed_;
+
+	return missed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "shared/OcclusionBuffer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <gli/gli.hpp>
+#include <gli/texture2d.hpp>
+#include <gli/load_ktx.hpp>
+#include <gli/save_ktx.hpp>
+
+/*
+	Headless test of the software occlusion buffer.
+
+	A fixed set of occluders (a tiled ground, walls and crates, one of them rotated by its model matrix) is rasterized
+	into a 320x192 OcclusionBuffer and its depth is compared with the reference image data/occlusionBufferReference.ktx.
+	The reference is the exact depth at the pixel centers, i.e. what a depth pre-pass on the GPU would give, and its mip
+	levels are the farthest depth of every 2x2 block like the hierarchical-Z pyramid. For the depth buffer (level 0) and
+	for the pyramid levels 1 and 2:
+	 - the software depth must never be nearer than the reference (the rasterization is conservative),
+	 - only a small part of the texels may be farther than the reference by more than a few percent of the view distance.
+	   These are the pixels which are not completely covered by a single triangle (the silhouettes and the inner edges
+	   of the meshes) and the pixels where the depth changes fast, as the software depth is the farthest one in the pixel.
+
+	Run it from the root folder of the repository. '--write-reference' writes the reference image again after the
+	occluders or the camera have been changed.
+*/
+
+const char* kReferenceFileName = "data/occlusionBufferReference.ktx";
+
+const int kWidth = 320;
+const int kHeight = 192;
+const float kNear = 0.5f;
+const float kFar = 200.0f;
+const uint32_t kNumReferenceLevels = 3;
+
+// the software depth may be nearer than the reference only by rounding errors
+const float kConservativeEpsilon = 1e-5f;
+
+// texels farther than the reference by more than this part of the view distance are counted as lost occlusion
+const float kDistanceTolerance = 0.05f;
+
+// the largest allowed fraction of such texels in level 0, level 1 and level 2
+const float kMaxFarTexels[kNumReferenceLevels] = { 0.08f, 0.12f, 0.18f };
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+struct Occluder
+{
+	std::vector<float> vertices_;
+	std::vector<uint32_t> indices_;
+	mat4 model_;
+};
+
+/* 12 triangles of a box, all the vertices are shared */
+Occluder createBox(const vec3& min, const vec3& max, const mat4& model = mat4(1.0f))
+{
+	Occluder box = { .model_ = model };
+
+	for (int i = 0; i != 8; i++)
+	{
+		box.vertices_.push_back((i & 1) ? max.x : min.x);
+		box.vertices_.push_back((i & 2) ? max.y : min.y);
+		box.vertices_.push_back((i & 4) ? max.z : min.z);
+	}
+
+	box.indices_ = {
+		0, 2, 6, 0, 6, 4,  1, 5, 7, 1, 7, 3,
+		0, 4, 5, 0, 5, 1,  2, 3, 7, 2, 7, 6,
+		0, 1, 3, 0, 3, 2,  4, 6, 7, 4, 7, 5 };
+
+	return box;
+}
+
+/* The ground is split into quads, so the inner edges of a mesh are tested as well */
+Occluder createGround(float minX, float maxX, float minZ, float maxZ, float quadSize)
+{
+	Occluder ground = { .model_ = mat4(1.0f) };
+
+	const int numX = (int)((maxX - minX) / quadSize);
+	const int numZ = (int)((maxZ - minZ) / quadSize);
+
+	for (int z = 0; z <= numZ; z++)
+	{
+		for (int x = 0; x <= numX; x++)
+		{
+			ground.vertices_.push_back(minX + x * quadSize);
+			ground.vertices_.push_back(0.0f);
+			ground.vertices_.push_back(minZ + z * quadSize);
+		}
+	}
+
+	for (int z = 0; z != numZ; z++)
+	{
+		for (int x = 0; x != numX; x++)
+		{
+			const uint32_t i = z * (numX + 1) + x;
+			const uint32_t quad[6] = { i, i + 1, i + numX + 2, i, i + numX + 2, i + numX + 1 };
+			ground.indices_.insert(ground.indices_.end(), quad, quad + 6);
+		}
+	}
+
+	return ground;
+}
+
+std::vector<Occluder> createOccluders()
+{
+	return {
+		createGround(-40.0f, 40.0f, -100.0f, -4.0f, 8.0f),
+		// walls
+		createBox(vec3(-12.0f, 0.0f, -16.0f), vec3(-3.0f, 4.0f, -15.0f)),
+		createBox(vec3(5.0f, 0.0f, -40.0f), vec3(30.0f, 9.0f, -38.0f)),
+		createBox(vec3(-30.0f, 0.0f, -70.0f), vec3(0.0f, 14.0f, -68.0f)),
+		// crates, the last one is rotated by its model matrix
+		createBox(vec3(1.0f, 0.0f, -10.0f), vec3(2.5f, 1.5f, -8.5f)),
+		createBox(vec3(-6.0f, 0.0f, -30.0f), vec3(-2.0f, 3.0f, -26.0f)),
+		createBox(vec3(-2.0f, 0.0f, -2.0f), vec3(2.0f, 2.5f, 2.0f),
+			glm::translate(mat4(1.0f), vec3(8.0f, 0.0f, -22.0f)) * glm::rotate(mat4(1.0f), glm::radians(35.0f), vec3(0.0f, 1.0f, 0.0f))),
+	};
+}
+
+/*
+	The depth of the nearest triangle at every pixel center, the first row is the top of the screen as in
+	OcclusionBuffer::getDepthBitmap(). All the occluders are in front of the near plane.
+*/
+std::vector<float> renderReferenceDepth(const std::vector<Occluder>& occluders, const mat4& viewProj, int width, int height)
+{
+	std::vector<float> depth((size_t)width * height, 1.0f);
+
+	for (const Occluder& o : occluders)
+	{
+		for (size_t i = 0; i + 2 < o.indices_.size(); i += 3)
+		{
+			// screen-space x and y, and the depth which is linear in screen space
+			glm::dvec3 s[3];
+			for (int k = 0; k != 3; k++)
+			{
+				const float* v = &o.vertices_[3 * o.indices_[i + k]];
+				const vec4 c = viewProj * o.model_ * vec4(v[0], v[1], v[2], 1.0f);
+				s[k] = glm::dvec3(
+					(c.x / c.w * 0.5 + 0.5) * width,
+					(c.y / c.w * 0.5 + 0.5) * height,
+					c.z / c.w * 0.5 + 0.5);
+			}
+
+			auto edge = [](const glm::dvec3& a, const glm::dvec3& b, double x, double y)
+			{
+				return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+			};
+
+			const double area = edge(s[0], s[1], s[2].x, s[2].y);
+
+			if (area == 0.0)
+				continue;
+
+			const int x0 = std::max(0, (int)std::floor(std::min({ s[0].x, s[1].x, s[2].x })));
+			const int x1 = std::min(width - 1, (int)std::ceil(std::max({ s[0].x, s[1].x, s[2].x })));
+			const int y0 = std::max(0, (int)std::floor(std::min({ s[0].y, s[1].y, s[2].y })));
+			const int y1 = std::min(height - 1, (int)std::ceil(std::max({ s[0].y, s[1].y, s[2].y })));
+
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					const double px = x + 0.5;
+					const double py = y + 0.5;
+
+					// barycentric coordinates, all of them are non-negative inside the triangle for either winding
+					const double b0 = edge(s[1], s[2], px, py) / area;
+					const double b1 = edge(s[2], s[0], px, py) / area;
+					const double b2 = edge(s[0], s[1], px, py) / area;
+
+					if (b0 < 0.0 || b1 < 0.0 || b2 < 0.0)
+						continue;
+
+					float& d = depth[(size_t)(height - 1 - y) * width + x];
+					d = std::min(d, (float)(b0 * s[0].z + b1 * s[1].z + b2 * s[2].z));
+				}
+			}
+		}
+	}
+
+	return depth;
+}
+
+/* The next hierarchical-Z level: the farthest depth of every 2x2 block */
+std::vector<float> downsampleDepth(const std::vector<float>& depth, int width, int height)
+{
+	std::vector<float> result((size_t)(width / 2) * (height / 2));
+
+	for (int y = 0; y != height / 2; y++)
+	{
+		for (int x = 0; x != width / 2; x++)
+		{
+			const float* row0 = &depth[(size_t)(2 * y) * width + 2 * x];
+			const float* row1 = row0 + width;
+			result[(size_t)y * (width / 2) + x] = std::max(std::max(row0[0], row0[1]), std::max(row1[0], row1[1]));
+		}
+	}
+
+	return result;
+}
+
+/* Depth in [0..1] back to the distance from the camera plane */
+float getViewDistance(float depth)
+{
+	return 2.0f * kNear * kFar / (kFar + kNear - (2.0f * depth - 1.0f) * (kFar - kNear));
+}
+
+bool compareDepth(uint32_t level, const Bitmap& depth, const float* reference)
+{
+	const float* d = (const float*)depth.data_.data();
+	const size_t numTexels = (size_t)depth.w_ * depth.h_;
+
+	size_t numNearer = 0;
+	size_t numFarther = 0;
+	float maxNearer = 0.0f;
+
+	for (size_t i = 0; i != numTexels; i++)
+	{
+		if (d[i] < reference[i] - kConservativeEpsilon)
+		{
+			numNearer++;
+			maxNearer = std::max(maxNearer, reference[i] - d[i]);
+		}
+		else if (getViewDistance(d[i]) > getViewDistance(reference[i]) * (1.0f + kDistanceTolerance))
+		{
+			numFarther++;
+		}
+	}
+
+	const float fractionFarther = (float)numFarther / (float)numTexels;
+
+	printf("Level %u (%dx%d): %zu texels nearer than the reference (max %g), %zu texels (%.1f%%) farther\n",
+		level, depth.w_, depth.h_, numNearer, maxNearer, numFarther, 100.0f * fractionFarther);
+
+	return !numNearer && fractionFarther <= kMaxFarTexels[level];
+}
+
+int main(int argc, char** argv)
+{
+	const bool writeReference = argc > 1 && !strcmp(argv[1], "--write-reference");
+
+	const std::vector<Occluder> occluders = createOccluders();
+
+	const mat4 proj = glm::perspective(glm::radians(60.0f), (float)kWidth / (float)kHeight, kNear, kFar);
+	const mat4 view = glm::lookAt(vec3(0.0f, 1.7f, 0.0f), vec3(0.0f, 1.2f, -10.0f), vec3(0.0f, 1.0f, 0.0f));
+	const mat4 viewProj = proj * view;
+
+	if (writeReference)
+	{
+		gli::texture2d reference(gli::FORMAT_R32_SFLOAT_PACK32, gli::extent2d(kWidth, kHeight), kNumReferenceLevels);
+
+		std::vector<float> depth = renderReferenceDepth(occluders, viewProj, kWidth, kHeight);
+
+		for (uint32_t l = 0; l != kNumReferenceLevels; l++)
+		{
+			memcpy(reference.data<float>(0, 0, l), depth.data(), depth.size() * sizeof(float));
+			depth = downsampleDepth(depth, kWidth >> l, kHeight >> l);
+		}
+
+		if (!gli::save_ktx(reference, kReferenceFileName))
+		{
+			printf("Cannot write %s\n", kReferenceFileName);
+			return EXIT_FAILURE;
+		}
+
+		printf("Reference depth written to %s\n", kReferenceFileName);
+		return EXIT_SUCCESS;
+	}
+
+	const gli::texture2d reference(gli::load_ktx(kReferenceFileName));
+
+	if (reference.empty() || reference.format() != gli::FORMAT_R32_SFLOAT_PACK32 || reference.levels() < kNumReferenceLevels ||
+		reference.extent(0).x != kWidth || reference.extent(0).y != kHeight)
+	{
+		printf("Cannot load the %dx%d reference depth from %s\n", kWidth, kHeight, kReferenceFileName);
+		return EXIT_FAILURE;
+	}
+
+	tf::Executor executor;
+	OcclusionBuffer buffer(executor, kWidth, kHeight);
+
+	for (const Occluder& o : occluders)
+		buffer.addOccluder(o.vertices_.data(), 3, o.indices_.data(), o.indices_.size(), o.model_);
+
+	buffer.render(viewProj);
+
+	printf("%zu occluder triangles, %dx%d depth buffer, %u levels\n", buffer.getNumOccluderTriangles(), buffer.getWidth(), buffer.getHeight(), buffer.getNumLevels());
+
+	bool ok = true;
+
+	for (uint32_t l = 0; l != kNumReferenceLevels; l++)
+		ok = compareDepth(l, buffer.getDepthBitmap(l), reference.data<float>(0, 0, l)) && ok;
+
+	printf("%s\n", ok ? "OK" : "The depth does not match the reference");
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include "shared/UploadRing.h"
+
+/*
+	Headless test of UploadRing with a fake backend instead of the OpenGL one (GLUploadRing.h).
+
+	The fake backend plays the GPU: signalFrame() takes a snapshot of the region of the frame as the GPU would read it,
+	and waitForFrame() retires the frame and checks that its region has not been changed in the meantime. The test checks:
+	 - the alignment and placement of the allocations: aligned offsets and pointers inside the region of the frame,
+	 - the wrap-around over the regions,
+	 - the order of waitForFrame() and signalFrame(): a region is waited for before it is written again, the frames are
+	   retired in the order they were submitted, and the other frames stay in flight,
+	 - the failed allocations when the region of the frame is full.
+*/
+
+const uint32_t kNumFrames = 3;
+const size_t kFrameSize = 1000;
+const uint32_t kNumTestFrames = 4 * kNumFrames + 1;
+
+int g_NumErrors = 0;
+
+void check(bool condition, uint32_t frame, const char* what)
+{
+	if (!condition)
+	{
+		printf("Frame %u: %s\n", frame, what);
+		g_NumErrors++;
+	}
+}
+
+class FakeUploadRingBackend final : public UploadRingBackend
+{
+public:
+	explicit FakeUploadRingBackend(uint32_t numFrames): numFrames_(numFrames) {}
+
+	uint8_t* mapMemory(size_t size) override
+	{
+		memory_.resize(size + UploadRing::kMaxAlignment);
+		frameSize_ = size / numFrames_;
+		snapshots_.resize(numFrames_);
+
+		// the same alignment as a real mapping
+		return base_ = memory_.data() + (UploadRing::kMaxAlignment - (uintptr_t)memory_.data() % UploadRing::kMaxAlignment) % UploadRing::kMaxAlignment;
+	}
+
+	void waitForFrame(uint32_t frame) override
+	{
+		numWaits_++;
+
+		// a region which has never been submitted has nothing to wait for
+		if (inFlight_.empty() || inFlight_.front() != frame)
+		{
+			for (uint32_t f : inFlight_)
+				if (f == frame)
+					numOrderErrors_++;
+			return;
+		}
+
+		// the other frames are still in flight
+		if (inFlight_.size() != numFrames_)
+			numOrderErrors_++;
+
+		inFlight_.pop_front();
+
+		if (memcmp(snapshots_[frame].data(), base_ + frame * frameSize_, frameSize_))
+			numOverwrittenFrames_++;
+	}
+
+	void signalFrame(uint32_t frame) override
+	{
+		numSignals_++;
+
+		for (uint32_t f : inFlight_)
+			if (f == frame)
+				numOrderErrors_++;
+
+		inFlight_.push_back(frame);
+		snapshots_[frame].assign(base_ + frame * frameSize_, base_ + (frame + 1) * frameSize_);
+	}
+
+	const uint8_t* getBase() const { return base_; }
+
+	uint32_t numWaits_ = 0;
+	uint32_t numSignals_ = 0;
+	uint32_t numOrderErrors_ = 0;
+	uint32_t numOverwrittenFrames_ = 0;
+
+private:
+	const uint32_t numFrames_;
+	size_t frameSize_ = 0;
+
+	std::vector<uint8_t> memory_;
+	uint8_t* base_ = nullptr;
+
+	// the frames submitted to the "GPU" and not retired yet, the oldest first
+	std::deque<uint32_t> inFlight_;
+	std::vector<std::vector<uint8_t>> snapshots_;
+};
+
+double getNanoseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+	FakeUploadRingBackend backend(kNumFrames);
+	UploadRing ring(backend, kFrameSize, kNumFrames);
+
+	const size_t frameSize = ring.getFrameSize();
+
+	check(frameSize % UploadRing::kMaxAlignment == 0 && frameSize >= kFrameSize, 0, "the region size is not rounded up to kMaxAlignment");
+
+	std::vector<uint8_t> data(frameSize);
+
+	for (uint32_t frame = 0; frame != kNumTestFrames; frame++)
+	{
+		const uint32_t numWaits = backend.numWaits_;
+
+		ring.beginFrame();
+
+		const uint32_t region = frame % kNumFrames;
+		const size_t regionStart = region * frameSize;
+		const size_t regionEnd = regionStart + frameSize;
+
+		check(ring.getCurrentFrame() == region, frame, "the regions are not used in turn");
+		check(backend.numWaits_ == numWaits + 1, frame, "beginFrame() did not wait for the region");
+		check(ring.getFrameUsage() == 0, frame, "the region is not empty");
+
+		// every allocation is aligned, inside the region and after the previous one
+		size_t prevEnd = regionStart;
+
+		for (size_t alignment : { 1, 4, 16, 64, 256, 8, 2 })
+		{
+			const size_t size = 3 + frame + alignment;
+
+			for (size_t i = 0; i != size; i++)
+				data[i] = (uint8_t)(frame * 31 + alignment + i);
+
+			const UploadAllocation a = ring.upload(data.data(), size, alignment);
+
+			check(a && a.size_ == size, frame, "a small allocation failed");
+			check(a.offset_ % alignment == 0 && (uintptr_t)a.ptr_ % alignment == 0, frame, "the allocation is not aligned");
+			check(a.ptr_ == backend.getBase() + a.offset_, frame, "the pointer does not match the offset");
+			check(a.offset_ >= prevEnd && a.offset_ + a.size_ <= regionEnd, frame, "the allocation overlaps the previous one or leaves the region");
+			check(a && !memcmp(a.ptr_, data.data(), size), frame, "the data was not copied");
+
+			prevEnd = a.offset_ + a.size_;
+		}
+
+		// a failed allocation does not change the region
+		const size_t usage = ring.getFrameUsage();
+		const uint32_t numFailed = ring.getNumFailedAllocations();
+
+		check(!ring.allocate(frameSize - usage + 1, 1), frame, "an allocation larger than the free space succeeded");
+		check(ring.getFrameUsage() == usage && ring.getNumFailedAllocations() == numFailed + 1, frame, "a failed allocation is not counted or changed the region");
+
+		// the rest of the region can still be allocated exactly, then it is full
+		const UploadAllocation rest = ring.allocate(frameSize - usage, 1);
+
+		check(rest && rest.offset_ + rest.size_ == regionEnd, frame, "the rest of the region cannot be allocated");
+		check(!ring.allocate(1, 1) && !ring.allocateArray<float>(1), frame, "an allocation from the full region succeeded");
+		check(ring.getNumFailedAllocations() == numFailed + 3, frame, "the failed allocations are not counted");
+
+		if (rest)
+			memset(rest.ptr_, (int)frame, rest.size_);
+
+		ring.endFrame();
+	}
+
+	check(backend.numWaits_ == kNumTestFrames && backend.numSignals_ == kNumTestFrames, kNumTestFrames, "every frame should wait and signal once");
+	check(!backend.numOrderErrors_, kNumTestFrames, "the frames are not waited for in the order of submission");
+	check(!backend.numOverwrittenFrames_, kNumTestFrames, "a region was written while the GPU could read it");
+	check(ring.getPeakFrameUsage() == frameSize, kNumTestFrames, "the peak usage is not the whole region");
+
+	// cost of a bump allocation with a copy of one matrix
+	const int kNumUploads = 4000;
+	const int kNumBenchmarkFrames = 1000;
+
+	FakeUploadRingBackend benchmarkBackend(kNumFrames);
+	UploadRing benchmarkRing(benchmarkBackend, kNumUploads * 64, kNumFrames);
+
+	const float matrix[16] = {};
+
+	double time = 0.0;
+
+	for (int f = 0; f != kNumBenchmarkFrames; f++)
+	{
+		benchmarkRing.beginFrame();
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i != kNumUploads; i++)
+			benchmarkRing.upload(matrix, sizeof(matrix));
+		time += getNanoseconds(start);
+		benchmarkRing.endFrame();
+	}
+
+	printf("%u frames through %u regions of %zu bytes, %u failed allocations (expected)\n", kNumTestFrames, kNumFrames, frameSize, ring.getNumFailedAllocations());
+	printf("%.1f ns per upload of 64 bytes\n", time / (kNumBenchmarkFrames * kNumUploads));
+	printf("%s\n", g_NumErrors ? "FAILED" : "OK");
+
+	return g_NumErrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
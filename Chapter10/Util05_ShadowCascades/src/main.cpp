@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "shared/ShadowCascades.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+/*
+	Headless test of fitShadowCascades() with 1 to 6 cascades, different split schemes, shadow distances, light
+	directions and cameras (GL05_Final uses just one cascade). For every combination:
+	 - the splits start at the near plane, increase monotonically, every cascade starts where the previous one ends,
+	   and the last one ends at the shadow distance,
+	 - every corner of the part of the view frustum covered by a cascade projects inside the clip volume of the cascade
+	   (for the tight cascades only the corners inside the scene bounds, as the rest is clipped away on purpose),
+	 - a stabilized cascade keeps its size and moves only by whole shadow map texels when the camera is moved by
+	   arbitrary offsets, so the shadow edges do not shimmer.
+*/
+
+const float kNear = 0.1f;
+const float kFar = 300.0f;
+const int kNumCameraMoves = 100;
+
+// relative precision of the near and far distances encoded in a float projection matrix with these planes
+const float kSplitEpsilon = 1e-3f;
+// a corner may be outside the clip volume only by rounding errors
+const float kClipEpsilon = 1e-4f;
+// the scale of a moved stabilized cascade may change only by rounding errors, and its offset in texels may differ from
+// a whole number only by rounding errors
+const float kScaleEpsilon = 1e-5f;
+const float kTexelEpsilon = 0.01f;
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+int g_NumErrors = 0;
+
+void check(bool condition, const char* config, const char* what)
+{
+	if (!condition)
+	{
+		printf("%s: %s\n", config, what);
+		g_NumErrors++;
+	}
+}
+
+bool isInside(const BoundingBox& box, const vec3& p)
+{
+	return
+		p.x >= box.min_.x && p.y >= box.min_.y && p.z >= box.min_.z &&
+		p.x <= box.max_.x && p.y <= box.max_.y && p.z <= box.max_.z;
+}
+
+void checkSplits(const std::vector<ShadowCascade>& cascades, const ShadowCascadeParams& params, const char* config)
+{
+	const float shadowDist = params.maxShadowDistance_ > 0.0f ? std::min(kFar, params.maxShadowDistance_) : kFar;
+
+	check(cascades.size() == params.numCascades_, config, "wrong number of cascades");
+	check(fabsf(cascades.front().splitNear_ - kNear) <= kSplitEpsilon * kFar, config, "the first cascade does not start at the near plane");
+	check(fabsf(cascades.back().splitFar_ - shadowDist) <= kSplitEpsilon * shadowDist, config, "the last cascade does not end at the shadow distance");
+
+	for (size_t i = 0; i != cascades.size(); i++)
+	{
+		check(cascades[i].splitFar_ > cascades[i].splitNear_, config, "the splits do not increase");
+		if (i > 0)
+			check(cascades[i].splitNear_ == cascades[i - 1].splitFar_, config, "a cascade does not start where the previous one ends");
+	}
+}
+
+void checkCorners(const std::vector<ShadowCascade>& cascades, const mat4& proj, const mat4& view, const BoundingBox& sceneBounds, bool stabilize, const char* config)
+{
+	vec4 corners[8];
+	getFrustumCorners(proj * view, corners);
+
+	for (const ShadowCascade& c : cascades)
+	{
+		// the corners of the part of the view frustum between the splits, the view depth is linear along the frustum edges
+		for (float dist : { c.splitNear_, c.splitFar_ })
+		{
+			const float t = (dist - kNear) / (kFar - kNear);
+
+			for (int i = 0; i != 4; i++)
+			{
+				const vec3 p = vec3(corners[i]) + (vec3(corners[i + 4]) - vec3(corners[i])) * t;
+
+				if (!stabilize && !isInside(sceneBounds, p))
+					continue;
+
+				const vec4 clip = c.viewProj_ * vec4(p, 1.0f);
+				const float limit = (1.0f + kClipEpsilon) * clip.w;
+
+				check(fabsf(clip.x) <= limit && fabsf(clip.y) <= limit && fabsf(clip.z) <= limit, config, "a corner of the view frustum is outside its cascade");
+			}
+		}
+	}
+}
+
+void checkStability(const mat4& proj, const mat4& view, const vec3& lightDir, const BoundingBox& sceneBounds, const ShadowCascadeParams& params, const char* config)
+{
+	const std::vector<ShadowCascade> cascades = fitShadowCascades(proj, view, lightDir, sceneBounds, params);
+
+	for (int m = 0; m != kNumCameraMoves; m++)
+	{
+		// the camera moves by an arbitrary offset and keeps its orientation
+		const vec3 offset = randomVec(vec3(-20.0f, -1.0f, -20.0f), vec3(20.0f, 1.0f, 20.0f));
+		const mat4 movedView = view * glm::translate(mat4(1.0f), -offset);
+
+		const std::vector<ShadowCascade> moved = fitShadowCascades(proj, movedView, lightDir, sceneBounds, params);
+
+		for (size_t i = 0; i != cascades.size(); i++)
+		{
+			const mat4& p0 = cascades[i].proj_;
+			const mat4& p1 = moved[i].proj_;
+
+			check(moved[i].texelSize_ == cascades[i].texelSize_ &&
+				fabsf(p1[0][0] - p0[0][0]) <= kScaleEpsilon * p0[0][0] && fabsf(p1[1][1] - p0[1][1]) <= kScaleEpsilon * p0[1][1],
+				config, "the size of a stabilized cascade has changed");
+
+			// the x and y translations of an orthographic projection map to [-1, 1], i.e. 'shadowMapSize / 2' texels per unit
+			for (int axis = 0; axis != 2; axis++)
+			{
+				const float texels = (p1[3][axis] - p0[3][axis]) * 0.5f * (float)params.shadowMapSize_;
+				check(fabsf(texels - roundf(texels)) <= kTexelEpsilon, config, "a stabilized cascade has moved by a fraction of a texel");
+			}
+		}
+	}
+}
+
+int main()
+{
+	srand(43);
+
+	const BoundingBox sceneBounds(vec3(-500.0f, -10.0f, -500.0f), vec3(500.0f, 60.0f, 500.0f));
+
+	const vec3 lightDirs[] = {
+		glm::normalize(vec3(0.3f, -1.0f, 0.2f)),
+		glm::normalize(vec3(-0.8f, -0.3f, 0.5f)),
+		// nearly vertical, so the light space uses another up vector
+		glm::normalize(vec3(0.01f, -1.0f, 0.0f)),
+	};
+
+	struct Camera
+	{
+		vec3 pos_;
+		vec3 dir_;
+	};
+
+	const Camera cameras[] = {
+		{ vec3(0.0f, 2.0f, 0.0f), vec3(0.0f, -0.1f, -1.0f) },
+		{ vec3(123.4f, 15.3f, -47.1f), vec3(-0.7f, -0.3f, 0.6f) },
+		{ vec3(-60.0f, 40.0f, 80.0f), vec3(0.5f, -0.8f, -0.3f) },
+	};
+
+	const uint32_t numCascades[] = { 1, 2, 4, 6 };
+	const float lambdas[] = { 0.0f, 0.75f, 1.0f };
+	const float shadowDistances[] = { 0.0f, 120.0f };
+
+	const mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, kNear, kFar);
+
+	int numConfigs = 0;
+
+	for (const vec3& lightDir : lightDirs)
+	for (const Camera& camera : cameras)
+	for (uint32_t n : numCascades)
+	for (float lambda : lambdas)
+	for (float shadowDist : shadowDistances)
+	for (bool stabilize : { true, false })
+	{
+		const ShadowCascadeParams params = {
+			.numCascades_ = n,
+			.shadowMapSize_ = 2048,
+			.splitLambda_ = lambda,
+			.maxShadowDistance_ = shadowDist,
+			.stabilize_ = stabilize
+		};
+
+		char config[256];
+		snprintf(config, sizeof(config), "light (%.2f %.2f %.2f), camera %d, %u cascades, lambda %.2f, distance %.0f, %s",
+			lightDir.x, lightDir.y, lightDir.z, (int)(&camera - cameras), n, lambda, shadowDist, stabilize ? "stabilized" : "tight");
+
+		const mat4 view = glm::lookAt(camera.pos_, camera.pos_ + camera.dir_, vec3(0.0f, 1.0f, 0.0f));
+
+		const std::vector<ShadowCascade> cascades = fitShadowCascades(proj, view, lightDir, sceneBounds, params);
+
+		checkSplits(cascades, params, config);
+		checkCorners(cascades, proj, view, sceneBounds, stabilize, config);
+
+		if (stabilize)
+			checkStability(proj, view, lightDir, sceneBounds, params, config);
+
+		numConfigs++;
+	}
+
+	printf("%d configurations, %d camera moves for every stabilized one\n", numConfigs, kNumCameraMoves);
+	printf("%s\n", g_NumErrors ? "FAILED" : "OK");
+
+	return g_NumErrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
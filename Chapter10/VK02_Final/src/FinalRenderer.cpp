@@ -18,11 +18,13 @@ BaseMultiRenderer::BaseMultiRenderer(
 	const PipelineInfo pInfo = initRenderPass(PipelineInfo {}, outputs, screenRenderPass, ctx.screenRenderPass);
 
 	const uint32_t indirectDataSize = (uint32_t)sceneData_.shapes_.size() * sizeof(VkDrawIndirectCommand);
+	drawCountOffset_ = indirectDataSize;
 
 	const size_t imgCount = ctx.vkDev.swapchainImages.size();
 	uniforms_.resize(imgCount);
 	shape_.resize(imgCount);
 	indirect_.resize(imgCount);
+	numDrawCommands_.resize(imgCount);
 
 	descriptorSets_.resize(imgCount);
 
@@ -61,8 +63,8 @@ BaseMultiRenderer::BaseMultiRenderer(
 
 	for (size_t i = 0; i != imgCount; i++)
 	{
-		uniforms_[i] = ctx.resources.addUniformBuffer(uniformBufferSize);
-		indirect_[i] = ctx.resources.addIndirectBuffer(indirectDataSize);
+		uniforms_[i] = ctx.resources.addUniformBuffer(uniformBufferSize, true);
+		indirect_[i] = ctx.resources.addIndirectBuffer(indirectDataSize + sizeof(uint32_t), true);
 		updateIndirectBuffers(i);
 
 		shape_[i] = ctx.resources.addStorageBuffer(shapesSize);
@@ -82,34 +84,81 @@ void BaseMultiRenderer::fillCommandBuffer(VkCommandBuffer commandBuffer, size_t
 {
 	beginRenderPass((rp != VK_NULL_HANDLE) ? rp : renderPass_.handle, (fb != VK_NULL_HANDLE) ? fb : framebuffer_, commandBuffer, currentImage);
 
-	/* For CountKHR (Vulkan 1.1) we may use indirect rendering with GPU-based object counter */
-	/// vkCmdDrawIndirectCountKHR(commandBuffer, indirectBuffers_[currentImage], 0, countBuffers_[currentImage], 0, shapes.size(), sizeof(VkDrawIndirectCommand));
-	/* For Vulkan 1.0 vkCmdDrawIndirect is enough */
-	vkCmdDrawIndirect(commandBuffer, indirect_[currentImage].buffer, 0, (uint32_t)sceneData_.shapes_.size(), sizeof(VkDrawIndirectCommand));
+	/* For CountKHR (Vulkan 1.1) the number of commands is read from the buffer written by the culling */
+	if (useDrawIndirectCount && vkCmdDrawIndirectCountKHR)
+		vkCmdDrawIndirectCountKHR(commandBuffer, indirect_[currentImage].buffer, 0, indirect_[currentImage].buffer, drawCountOffset_, (uint32_t)indices_.size(), sizeof(VkDrawIndirectCommand));
+	else /* For Vulkan 1.0 vkCmdDrawIndirect is enough */
+		vkCmdDrawIndirect(commandBuffer, indirect_[currentImage].buffer, 0, numDrawCommands_[currentImage], sizeof(VkDrawIndirectCommand));
 
 	vkCmdEndRenderPass(commandBuffer);
 }
 
-void BaseMultiRenderer::updateIndirectBuffers(size_t currentImage, bool* visibility)
+template <typename IsVisibleFunc>
+uint32_t BaseMultiRenderer::writeIndirectCommands(size_t currentImage, IsVisibleFunc isObjectVisible)
 {
-	VkDrawIndirectCommand* data = nullptr;
-	vkMapMemory(ctx_.vkDev.device, indirect_[currentImage].memory, 0, sizeof(VkDrawIndirectCommand), 0, (void**)&data);
+	VkDrawIndirectCommand* data = (VkDrawIndirectCommand*)indirect_[currentImage].ptr;
 
 	const uint32_t size = (uint32_t)indices_.size(); // (uint32_t)sceneData_.shapes_.size();
 
+	uint32_t numCommands = 0;
+
 	for (uint32_t i = 0; i != size; i++)
 	{
+		if (!isObjectVisible(indices_[i]))
+			continue;
+
 		const uint32_t j = sceneData_.shapes_[indices_[i]].meshIndex;
 
 		const uint32_t lod = sceneData_.shapes_[indices_[i]].LOD;
-		data[i] = {
+		data[numCommands++] = {
 			.vertexCount = sceneData_.meshData_.meshes_[j].getLODIndicesCount(lod),
-			.instanceCount = visibility ? (visibility[indices_[i]] ? 1u : 0u) : 1u,
+			.instanceCount = 1u,
 			.firstVertex = 0,
 			.firstInstance = (uint32_t)indices_[i]
 		};
 	}
-	vkUnmapMemory(ctx_.vkDev.device, indirect_[currentImage].memory);
+
+	numDrawCommands_[currentImage] = numCommands;
+	memcpy((uint8_t*)indirect_[currentImage].ptr + drawCountOffset_, &numCommands, sizeof(uint32_t));
+
+	return numCommands;
+}
+
+uint32_t BaseMultiRenderer::updateIndirectBuffers(size_t currentImage, bool* visibility)
+{
+	return writeIndirectCommands(currentImage, [visibility](int idx) { return !visibility || visibility[idx]; });
+}
+
+uint32_t BaseMultiRenderer::updateIndirectBuffers(size_t currentImage, const std::vector<uint64_t>& visibility)
+{
+	return writeIndirectCommands(currentImage, [&visibility](int idx) { return isVisible(visibility, idx); });
+}
+
+void FinalMultiRenderer::setShapeBoxes(const std::vector<BoundingBox>& boxes)
+{
+	shapeBoxes_.assign(boxes);
+
+	// long enough for the shadow of any caster to cross the whole scene
+	shadowSweepLength_ = boxes.empty() ? 0.0f : glm::length(combineBoxes(boxes).getSize());
+}
+
+void FinalMultiRenderer::updateShadowCasters(size_t currentImage)
+{
+	if (!enableShadowCasterCulling || !shapeBoxes_.size())
+	{
+		numShadowCasters_ = shadowRenderer.updateIndirectBuffers(currentImage);
+		return;
+	}
+
+	vec4 lightFrustumPlanes[6];
+	getFrustumPlanes(lightViewProj_, lightFrustumPlanes);
+	vec4 cameraFrustumPlanes[6];
+	getFrustumPlanes(cameraViewProj_, cameraFrustumPlanes);
+
+	cullShadowCasters(lightFrustumPlanes, lightDir_, shadowSweepLength_, cameraFrustumPlanes, nullptr, shapeBoxes_, casterVisibility_);
+
+	// the shadow renderer draws only the opaque shapes
+	numShadowCasters_ = shadowRenderer.updateIndirectBuffers(currentImage, casterVisibility_);
 }
 
 bool FinalMultiRenderer::checkLoadedTextures()
@@ -3,6 +3,7 @@
 #include "shared/vkFramework/MultiRenderer.h"
 
 #include "shared/vkFramework/effects/LuminanceCalculator.h"
+#include "shared/UtilsCulling.h"
 
 #include <algorithm>
 #include <numeric>
@@ -33,7 +34,10 @@ struct BaseMultiRenderer: public Renderer
 		const std::vector<BufferAttachment>& auxBuffers = std::vector<BufferAttachment> {},
 		const std::vector<TextureAttachment>& auxTextures = std::vector<TextureAttachment> {});
 
-	void updateIndirectBuffers(size_t currentImage, bool* visibility = nullptr);
+	/* Only the commands of the visible objects are written, so the invisible ones are not even submitted. Returns the number of commands */
+	uint32_t updateIndirectBuffers(size_t currentImage, bool* visibility = nullptr);
+	// 'visibility' is a bitmask over all the shapes (see isVisible() in UtilsCulling.h)
+	uint32_t updateIndirectBuffers(size_t currentImage, const std::vector<uint64_t>& visibility);
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
 	void updateBuffers(size_t currentImage) override {
@@ -50,13 +54,22 @@ struct BaseMultiRenderer: public Renderer
 
 	inline const VKSceneData& getSceneData() const { return sceneData_; }
 
+	// see MultiRenderer::useDrawIndirectCount
+	bool useDrawIndirectCount = true;
+
 private:
+	template <typename IsVisibleFunc>
+	uint32_t writeIndirectCommands(size_t currentImage, IsVisibleFunc isObjectVisible);
+
 	VKSceneData& sceneData_;
 
 	std::vector<int> indices_;
 
 	std::vector<VulkanBuffer> indirect_;
 	std::vector<VulkanBuffer> shape_;
+	std::vector<uint32_t> numDrawCommands_;
+	// the count for vkCmdDrawIndirectCountKHR() is stored after the commands
+	VkDeviceSize drawCountOffset_ = 0;
 
 	struct UBO {
 		mat4 proj_;
@@ -247,6 +260,8 @@ struct FinalMultiRenderer: public Renderer
 		transparentRenderer.updateBuffers(currentImage);
 		opaqueRenderer.updateBuffers(currentImage);
 
+		if (enableShadows)
+			updateShadowCasters(currentImage);
 		shadowRenderer.updateBuffers(currentImage);
 
 		uint32_t zeroCount = 0;
@@ -260,8 +275,14 @@ struct FinalMultiRenderer: public Renderer
 	inline void setMatrices(const glm::mat4& proj, const glm::mat4& view) {
 		transparentRenderer.setMatrices(proj, view);
 		opaqueRenderer.setMatrices(proj, view);
+
+		cameraViewProj_ = proj * view * glm::scale(glm::mat4(1.f), glm::vec3(1.f, -1.f, 1.f));
 	}
 
+	/* World-space boxes of all the shapes for the shadow caster culling */
+	void setShapeBoxes(const std::vector<BoundingBox>& boxes);
+	uint32_t getNumShadowCasters() const { return numShadowCasters_; }
+
 	inline void setLightParameters(const glm::mat4& lightProj, const glm::mat4& lightView)
 	{
 		LightParamsBuffer lightParamsBuffer = { .proj = lightProj, .view = lightView, .width = ctx_.vkDev.framebufferWidth, .height = ctx_.vkDev.framebufferHeight };
@@ -269,6 +290,11 @@ struct FinalMultiRenderer: public Renderer
 		uploadBufferData(ctx_.vkDev, lightParams.memory, 0, &lightParamsBuffer, sizeof(LightParamsBuffer));
 
 		shadowRenderer.setMatrices(lightProj, lightView);
+
+		// the same Y flip as in BaseMultiRenderer::setMatrices(), the light looks along -Z of its view space
+		const glm::mat4 flippedLightView = lightView * glm::scale(glm::mat4(1.f), glm::vec3(1.f, -1.f, 1.f));
+		lightViewProj_ = lightProj * flippedLightView;
+		lightDir_ = -glm::normalize(vec3(flippedLightView[0][2], flippedLightView[1][2], flippedLightView[2][2]));
 	}
 
 	inline void setCameraPosition(const glm::vec3& cameraPos) {
@@ -294,8 +320,17 @@ struct FinalMultiRenderer: public Renderer
 
 	bool enableShadows = true;
 	bool renderTransparentObjects = true;
+	bool enableShadowCasterCulling = true;
+
+	inline void setDrawIndirectCount(bool enable) {
+		transparentRenderer.useDrawIndirectCount = enable;
+		opaqueRenderer.useDrawIndirectCount = enable;
+		shadowRenderer.useDrawIndirectCount = enable;
+	}
 
 private:
+	void updateShadowCasters(size_t currentImage);
+
 	VKSceneData& sceneData_;
 
 	BaseMultiRenderer transparentRenderer;
@@ -318,4 +353,13 @@ private:
 
 	ShaderOptimalToColorBarrier outputToAttachment;
 	ColorToShaderOptimalBarrier outputToShader;
+
+	glm::mat4 cameraViewProj_ = glm::mat4(1.0f);
+	glm::mat4 lightViewProj_ = glm::mat4(1.0f);
+	vec3 lightDir_ = vec3(0.0f, -1.0f, 0.0f);
+
+	BoundingBoxSoA shapeBoxes_;
+	float shadowSweepLength_ = 0.0f;
+	std::vector<uint64_t> casterVisibility_;
+	uint32_t numShadowCasters_ = 0;
 };
@@ -113,6 +113,8 @@ struct MyApp: public CameraApp
 				bigBox.combinePoint(b.min_);
 				bigBox.combinePoint(b.max_);
 			}
+
+			finalRenderer.setShapeBoxes(reorderedBoxes);
 		}
 	}
 
@@ -123,6 +125,8 @@ struct MyApp: public CameraApp
 
 		ImGui::Checkbox("Show object bounding boxes", &showObjectBoxes);
 		ImGui::Checkbox("Render transparent objects", &finalRenderer.renderTransparentObjects);
+		if (ImGui::Checkbox("Read draw count from buffer", &useDrawIndirectCount))
+			finalRenderer.setDrawIndirectCount(useDrawIndirectCount);
 
 		ImGui::Text("HDR");
 		ImGui::Indent(indentSize);
@@ -164,6 +168,8 @@ struct MyApp: public CameraApp
 
 				ImGui::SliderFloat("Light Theta", &g_LightTheta, -85.0f, +85.0f);
 				ImGui::SliderFloat("Light Phi", &g_LightPhi, -85.0f, +85.0f);
+				ImGui::Checkbox("Cull shadow casters", &finalRenderer.enableShadowCasterCulling);
+				ImGui::Text("Shadow casters: %u", finalRenderer.getNumShadowCasters());
 
 			ImGui::PopItemFlag();
 			ImGui::PopStyleVar();
@@ -239,6 +245,8 @@ struct MyApp: public CameraApp
 	bool showLightFrustum = false;
 	bool showObjectBoxes = false;
 
+	bool useDrawIndirectCount = true;
+
 	void draw3D() override {
 		const mat4 p = getDefaultProjection();
 		const mat4 view =camera.getViewMatrix();
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "shared/Bitmap.h"
+#include "shared/UtilsCubemap.h"
+
+/*
+	Conversion of 1K, 4K and 8K equirectangular maps (RGB float, random texels) to cube maps:
+	 - through the vertical cross as in GL03_CubeMap,
+	 - straight to the cube map faces as in GLTexture,
+	 - straight to a staging buffer with all the mip levels as in createMIPCubeTextureImage() (RGBA float).
+	The faces built through the cross and without it should be exactly the same.
+*/
+
+const int kNumRepeats = 3;
+
+double getMilliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int getNumMipLevels(int size)
+{
+	int levels = 1;
+	while (size >>= 1)
+		levels++;
+	return levels;
+}
+
+int main()
+{
+	srand(48);
+
+	bool identical = true;
+
+	printf("source       %11s    %10s    %10s\n", "cross+faces", "faces", "staging");
+
+	for (int width : { 1024, 4096, 8192 })
+	{
+		Bitmap equirect(width, width / 2, 3, eBitmapFormat_Float);
+
+		float* texels = (float*)equirect.data_.data();
+		for (size_t i = 0; i != equirect.data_.size() / sizeof(float); i++)
+			texels[i] = 4.0f * (float)rand() / (float)RAND_MAX;
+
+		const int faceSize = width / 4;
+		const int numMipLevels = getNumMipLevels(faceSize);
+		std::vector<uint8_t> staging(getCubeMapFacesSize(faceSize, 4, eBitmapFormat_Float, numMipLevels));
+
+		double timeCross = 0.0;
+		double timeFaces = 0.0;
+		double timeStaging = 0.0;
+
+		for (int r = 0; r != kNumRepeats; r++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			const Bitmap facesFromCross = convertVerticalCrossToCubeMapFaces(convertEquirectangularMapToVerticalCross(equirect));
+			timeCross += getMilliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			const Bitmap faces = convertEquirectangularMapToCubeMapFaces(equirect);
+			timeFaces += getMilliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			convertEquirectangularMapToCubeMapFaces(equirect, staging.data(), 4, eBitmapFormat_Float, numMipLevels);
+			timeStaging += getMilliseconds(start);
+
+			if (faces.data_ != facesFromCross.data_)
+				identical = false;
+		}
+
+		printf("%4dx%-4d    %8.1f ms    %7.1f ms    %7.1f ms (%d mip levels)\n",
+			width, width / 2, timeCross / kNumRepeats, timeFaces / kNumRepeats, timeStaging / kNumRepeats, numMipLevels);
+	}
+
+	printf("Faces built through the cross are %s\n", identical ? "identical" : "DIFFERENT");
+
+	return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
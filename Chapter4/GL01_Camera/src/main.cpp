@@ -173,10 +173,9 @@ int main(void)
 		int w, h, comp;
 		const float* img = stbi_loadf("data/piazza_bologni_1k.hdr", &w, &h, &comp, 3);
 		Bitmap in(w, h, comp, eBitmapFormat_Float, img);
-		Bitmap out = convertEquirectangularMapToVerticalCross(in);
 		stbi_image_free((void*)img);
 
-		Bitmap cubemap = convertVerticalCrossToCubeMapFaces(out);
+		Bitmap cubemap = convertEquirectangularMapToCubeMapFaces(in);
 
 		glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &cubemapTex);
 		glTextureParameteri(cubemapTex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -4,112 +4,151 @@
 #include <assimp/cimport.h>
 #include "shared/scene/VtxData.h"
 
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
 #include <meshoptimizer.h>
 
-// This mesh conversion tool preprocess a mesh so that we can store it in a runtime efficient data format
+#include <taskflow/taskflow.hpp>
 
+// This mesh conversion tool preprocess a mesh so that we can store it in a runtime efficient data format.
+// It runs without any window or graphics API, so it can be used for batch conversion of many assets in parallel processes.
 
-// TODO: There is no global verbose flag as mentioned at page 246
+/**
+ * \brief All the settings of a single conversion (see printUsage())
+ */
+struct MeshConvertConfig
+{
+	std::string inputFile = "deps/src/bistro/Exterior/exterior.obj";
+	std::string outputFile = "data/meshes/test.meshes";
 
-MeshData g_meshData;
+	// By default, the mesh scale is 0.01
+	float scale = 0.01f;
 
-// To fill MeshData's index/vertex fields,
-// we require two counters to track offsets of index and vertex mesh data inside the file
-uint32_t g_indexOffset = 0;
-uint32_t g_vertexOffset = 0;
+	// By default, we don't calculate LODs
+	bool calculateLODs = false;
 
-// TODO: There are no flags controlling whether we need to export texture coordinates and normal vectors as mentioned at page 246
+	// By default, we export vertex coordinates (3), normal (3), and texture coordinates (2)
+	bool exportTexCoords = true;
+	bool exportNormals = true;
 
-// By default, we export vertex coordinates (3), normal (3), and texture coordinates (2).
-// Therefore, 3+3+2 elements are specified here 
-constexpr uint32_t g_numElementsToStore = 3 + 3 + 2;
+	// Number of float mantissa bits to keep in all the vertex attributes (0 - no quantization).
+	// The data stays in 32-bit floats, but more vertices become identical and the files compress better
+	int quantizationBits = 0;
 
-// TODO: Make it so that we can parse command-line arguments to check whether texture coordinates or normal vectors are needed
+	unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 1u);
 
-// By default, the mesh scale is 0.01
-float g_meshScale = 0.01f;
+	bool verbose = false;
+};
 
-// By default, we don't calculate LODs
-bool g_calculateLODs = false;
+/**
+ * \brief The number of floats in a vertex: position (3) and the optional texture coordinates (2) and normal (3)
+ */
+uint32_t getNumElementsToStore(const MeshConvertConfig& cfg)
+{
+	return 3 + (cfg.exportTexCoords ? 2 : 0) + (cfg.exportNormals ? 3 : 0);
+}
+
+/**
+ * \brief A single mesh converted into its own buffers. The offsets in 'mesh' are assigned when all the meshes are concatenated
+ */
+struct ConvertedMesh
+{
+	Mesh mesh;
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+};
 
 /**
  * \brief Create LOD indices
+ * Every LOD is simplified from the original indices (LOD 'l' targets 1/2^l of them with a growing error limit),
+ * so the simplification errors do not accumulate over the LOD chain
  * \param indices The original indices
- * \param vertices The original vertices
+ * \param vertices The original vertices (3 floats per vertex)
  * \param outLods The output collection of indices that represent LOD meshes
+ * \param verbose Print the index count of every LOD
  */
-void processLods(std::vector<uint32_t>& indices,
-                 std::vector<float>& vertices,
-                 std::vector<std::vector<uint32_t>>& outLods)
+void processLods(const std::vector<uint32_t>& indices,
+                 const std::vector<float>& vertices,
+                 std::vector<std::vector<uint32_t>>& outLods,
+                 bool verbose)
 {
 	// Each vertex is constructed from 3 float values
-	// TODO: in the book, size_t verticesCountIn = vertices.size() / 3;
-	size_t verticesCountIn = vertices.size() / 2;
-	size_t targetIndicesCount = indices.size();
-
-	uint8_t LOD = 1;
+	const size_t verticesCountIn = vertices.size() / 3;
 
-	printf("\n   LOD0: %i indices", int(indices.size()));
+	if (verbose)
+		printf("   LOD0: %i indices\n", int(indices.size()));
 
 	outLods.push_back(indices);
 
-	while (targetIndicesCount > 1024 && LOD < 8)
+	for (uint8_t LOD = 1; LOD < 8 && (indices.size() >> (LOD - 1)) > 1024; LOD++)
 	{
-		targetIndicesCount = indices.size() / 2;
+		const size_t targetIndicesCount = indices.size() >> LOD;
+		const float targetError = 0.02f * LOD;
 
 		bool sloppy = false;
 
-		size_t numOptIndices = meshopt_simplify(indices.data(),
+		std::vector<uint32_t> lod(indices.size());
+
+		size_t numOptIndices = meshopt_simplify(lod.data(),
 		                                        indices.data(),
-		                                        (uint32_t)indices.size(),
+		                                        indices.size(),
 		                                        vertices.data(),
 		                                        verticesCountIn,
 		                                        sizeof(float) * 3,
 		                                        targetIndicesCount,
-		                                        0.02f);
+		                                        targetError);
 
 		// cannot simplify further
-		if (static_cast<size_t>(numOptIndices * 1.1f) > indices.size())
+		if (static_cast<size_t>(numOptIndices * 1.1f) > outLods.back().size())
 		{
 			if (LOD > 1)
 			{
 				// try harder
 				numOptIndices = meshopt_simplifySloppy(
-					indices.data(),
+					lod.data(),
 					indices.data(), indices.size(),
 					vertices.data(), verticesCountIn,
 					sizeof(float) * 3,
-					targetIndicesCount, 0.02f);
+					targetIndicesCount, targetError, nullptr);
 				sloppy = true;
-				if (numOptIndices == indices.size()) break;
+				if (static_cast<size_t>(numOptIndices * 1.1f) > outLods.back().size()) break;
 			}
 			else
 				break;
 		}
 
-		indices.resize(numOptIndices);
+		lod.resize(numOptIndices);
 
-		meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), verticesCountIn);
+		meshopt_optimizeVertexCache(lod.data(), lod.data(), lod.size(), verticesCountIn);
 
-		printf("\n   LOD%i: %i indices %s", int(LOD), int(numOptIndices), sloppy ? "[sloppy]" : "");
+		if (verbose)
+			printf("   LOD%i: %i indices %s\n", int(LOD), int(numOptIndices), sloppy ? "[sloppy]" : "");
 
-		LOD++;
-
-		outLods.push_back(indices);
+		outLods.push_back(lod);
 	}
 }
 
 /**
- * \brief This function converts an input assimp mesh into a mesh of our own representation
+ * \brief This function converts an input assimp mesh into a mesh of our own representation.
+ * It does not touch any global state, so different meshes can be converted concurrently
  * \param m The input Assimp mesh
- * \return The mesh of our own representation
+ * \param cfg The conversion settings
+ * \return The mesh of our own representation with its own vertex and index data
  */
-Mesh convertAIMesh(const aiMesh* m)
+ConvertedMesh convertAIMesh(const aiMesh* m, const MeshConvertConfig& cfg)
 {
 	// check whether a set of texture coordinates is present in the original Assimp mesh
 	const bool hasTexCoords = m->HasTextureCoords(0);
 	// The size of the stream element in bytes is directly calculated from the number of elements per vertex
-	const uint32_t streamElementSize = static_cast<uint32_t>(g_numElementsToStore * sizeof(float));
+	const uint32_t streamElementSize = static_cast<uint32_t>(getNumElementsToStore(cfg) * sizeof(float));
+
+	auto quantize = [&cfg](float v)
+	{
+		return cfg.quantizationBits > 0 ? meshopt_quantizeFloat(v, cfg.quantizationBits) : v;
+	};
 
 	// Original data for LOD calculation
 	std::vector<float> srcVertices;
@@ -118,7 +157,10 @@ Mesh convertAIMesh(const aiMesh* m)
 	// if we don't have LOD, the first element in this vector is the original data indices
 	std::vector<std::vector<uint32_t>> outLods;
 
-	auto& vertices = g_meshData.vertexData_;
+	ConvertedMesh result;
+
+	auto& vertices = result.vertices;
+	vertices.reserve(m->mNumVertices * getNumElementsToStore(cfg));
 
 	// For each of the vertices, we extract their data from the aiMesh object
 	for (size_t i = 0; i != m->mNumVertices; i++)
@@ -128,7 +170,7 @@ Mesh convertAIMesh(const aiMesh* m)
 		const aiVector3D n = m->mNormals[i];
 		const aiVector3D t = hasTexCoords ? m->mTextureCoords[0][i] : aiVector3D();
 
-		if (g_calculateLODs)
+		if (cfg.calculateLODs)
 		{
 			srcVertices.push_back(v.x);
 			srcVertices.push_back(v.y);
@@ -136,29 +178,34 @@ Mesh convertAIMesh(const aiMesh* m)
 		}
 
 		// append vertex, texture coordinate, and normal to the vertex stream
-		vertices.push_back(v.x * g_meshScale);
-		vertices.push_back(v.y * g_meshScale);
-		vertices.push_back(v.z * g_meshScale);
+		vertices.push_back(quantize(v.x * cfg.scale));
+		vertices.push_back(quantize(v.y * cfg.scale));
+		vertices.push_back(quantize(v.z * cfg.scale));
 
-		vertices.push_back(t.x);
-		vertices.push_back(1.0f - t.y); // note: y-coordinate is flipped
+		if (cfg.exportTexCoords)
+		{
+			vertices.push_back(quantize(t.x));
+			vertices.push_back(quantize(1.0f - t.y)); // note: y-coordinate is flipped
+		}
 
-		vertices.push_back(n.x);
-		vertices.push_back(n.y);
-		vertices.push_back(n.z);
+		if (cfg.exportNormals)
+		{
+			vertices.push_back(quantize(n.x));
+			vertices.push_back(quantize(n.y));
+			vertices.push_back(quantize(n.z));
+		}
 	}
 
-	Mesh result = {
+	result.mesh = Mesh {
 		// we only have 1 vertex stream per mesh
 		.streamCount = 1,
-		// set the index and vertex offset within the input file
-		.indexOffset = g_indexOffset,
-		.vertexOffset = g_vertexOffset,
+		// the index and vertex offsets within the output file are set in concatenateMeshes()
+		.indexOffset = 0,
+		.vertexOffset = 0,
 		// vertex count is the number of vertices in this mesh
 		.vertexCount = m->mNumVertices,
-		// update stream offset and element size for this mesh
-		.streamOffset = {g_vertexOffset * streamElementSize},
-		.streamElementSize = {streamElementSize}
+		.streamOffset = { 0 },
+		.streamElementSize = { streamElementSize }
 	};
 
 	for (size_t i = 0; i != m->mNumFaces; i++)
@@ -173,50 +220,81 @@ Mesh convertAIMesh(const aiMesh* m)
 		}
 	}
 
-	if (!g_calculateLODs)
+	if (!cfg.calculateLODs)
 	{
 		outLods.push_back(srcIndices);
 	}
 	else
 	{
-		processLods(srcIndices, srcVertices, outLods);
+		processLods(srcIndices, srcVertices, outLods, cfg.verbose);
 	}
 
-	printf("\nCalculated LOD count: %u\n", (unsigned)outLods.size());
-
 	// put LOD indices into Mesh's indices
 	uint32_t numIndices = 0;
 	for (size_t l = 0; l < outLods.size(); l++)
 	{
-		for (size_t i = 0; i < outLods[l].size(); i++)
-		{
-			g_meshData.indexData_.push_back(outLods[l][i]);
-		}
+		result.indices.insert(result.indices.end(), outLods[l].begin(), outLods[l].end());
 
-		result.lodOffset[l] = numIndices;
+		result.mesh.lodOffset[l] = numIndices;
 		numIndices += (int)outLods[l].size();
 	}
 
 	// last item of loadOffset array is used for special purpose
-	result.lodOffset[outLods.size()] = numIndices;
-
-	result.lodCount = (uint32_t)outLods.size();
+	result.mesh.lodOffset[outLods.size()] = numIndices;
 
-	// After processing the input mesh, we increment offset counters for the indices and current starting vertex
-	g_indexOffset += numIndices;
-	g_vertexOffset += m->mNumVertices;
+	result.mesh.lodCount = (uint32_t)outLods.size();
 
 	return result;
 }
 
+/**
+ * \brief Append all the converted meshes to the output MeshData in their original order
+ * We require two counters to track offsets of index and vertex mesh data inside the file
+ */
+void concatenateMeshes(std::vector<ConvertedMesh>& meshes, MeshData& meshData)
+{
+	uint32_t indexOffset = 0;
+	uint32_t vertexOffset = 0;
+
+	meshData.meshes_.reserve(meshes.size());
+
+	for (auto& c: meshes)
+	{
+		c.mesh.indexOffset = indexOffset;
+		c.mesh.vertexOffset = vertexOffset;
+		c.mesh.streamOffset[0] = vertexOffset * c.mesh.streamElementSize[0];
+
+		meshData.meshes_.push_back(c.mesh);
+		meshData.indexData_.insert(meshData.indexData_.end(), c.indices.begin(), c.indices.end());
+		meshData.vertexData_.insert(meshData.vertexData_.end(), c.vertices.begin(), c.vertices.end());
+
+		// After processing the mesh, we increment offset counters for the indices and current starting vertex
+		indexOffset += (uint32_t)c.indices.size();
+		vertexOffset += c.mesh.vertexCount;
+
+		c = ConvertedMesh();
+	}
+}
+
+double getMilliseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
 /**
  * \brief This function processes the input file.
  * This includes loading the scene and converting each mesh into an internal format (our own mesh representation)
- * \param fileName The input file name
+ * \param cfg The conversion settings
+ * \param meshData The output mesh data
  */
-void loadFile(const char* fileName)
+void loadFile(const MeshConvertConfig& cfg, MeshData& meshData)
 {
-	printf("Loading '%s'...\n", fileName);
+	const char* fileName = cfg.inputFile.c_str();
+
+	if (cfg.verbose)
+		printf("Loading '%s'...\n", fileName);
+
+	const auto start = std::chrono::steady_clock::now();
 
 	// The list of flags for the ASSIMP import function
 	// TODO: aiProcess_PreTransformVertices, aiProcess_FindInstances, aiProcess_OptimizeMeshes are provided in the book, but are here
@@ -241,46 +319,157 @@ void loadFile(const char* fileName)
 		exit(255);
 	}
 
-	// After importing the scene, we reserve the memory for the mesh descriptor and bounding box containers accordingly 
-	g_meshData.meshes_.reserve(scene->mNumMeshes);
-	g_meshData.boxes_.reserve(scene->mNumMeshes);
+	const auto imported = std::chrono::steady_clock::now();
 
-	// call convertAIMesh for each mesh in the scene
-	for (unsigned int i = 0; i != scene->mNumMeshes; i++)
+	// convert all the meshes in the scene concurrently
+	std::vector<ConvertedMesh> convertedMeshes(scene->mNumMeshes);
+
+	tf::Executor executor(cfg.numThreads);
+	tf::Taskflow taskflow;
+
+	taskflow.for_each_index(0u, scene->mNumMeshes, 1u, [&](int i)
+		{
+			convertedMeshes[i] = convertAIMesh(scene->mMeshes[i], cfg);
+
+			if (cfg.verbose)
+				printf("Converted mesh %u/%u: %u LODs\n", (unsigned)i + 1, scene->mNumMeshes, convertedMeshes[i].mesh.lodCount);
+		}
+	);
+
+	executor.run(taskflow).wait();
+
+	aiReleaseImport(scene);
+
+	concatenateMeshes(convertedMeshes, meshData);
+
+	// TODO: ignore this in this chapter for now
+	meshData.boxes_.reserve(meshData.meshes_.size());
+	recalculateBoundingBoxes(meshData);
+
+	const auto converted = std::chrono::steady_clock::now();
+
+	if (cfg.verbose)
+		printf("Import: %.1f ms, conversion: %.1f ms\n", getMilliseconds(start, imported), getMilliseconds(imported, converted));
+}
+
+void printUsage()
+{
+	printf(
+		"Usage: Ch5_Tool05_MeshConvert [options] [input] [output]\n"
+		"  input                  scene file to convert (default: deps/src/bistro/Exterior/exterior.obj)\n"
+		"  output                 output .meshes file (default: data/meshes/test.meshes), draw data goes to <output>.drawdata\n"
+		"  --scale <s>            scale applied to the vertex positions (default: 0.01)\n"
+		"  --lods                 generate LODs\n"
+		"  --no-normals           do not export normal vectors\n"
+		"  --no-uvs               do not export texture coordinates\n"
+		"  --quantize <bits>      keep only <bits> mantissa bits (1..23) in all the vertex attributes\n"
+		"  --threads <n>          number of threads for the mesh conversion (default: all the cores)\n"
+		"  --verbose, -v          print the progress of every mesh and LOD\n"
+		"  --help, -h             print this message\n");
+}
+
+MeshConvertConfig parseCommandLine(int argc, char** argv)
+{
+	MeshConvertConfig cfg;
+
+	int numPositional = 0;
+
+	for (int i = 1; i < argc; i++)
 	{
-		printf("\nConverting meshes %u/%u...", i + 1, scene->mNumMeshes);
-		fflush(stdout);
-		g_meshData.meshes_.push_back(convertAIMesh(scene->mMeshes[i]));
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (arg == "--help" || arg == "-h")
+		{
+			printUsage();
+			exit(EXIT_SUCCESS);
+		}
+		else if (arg == "--verbose" || arg == "-v")
+			cfg.verbose = true;
+		else if (arg == "--lods")
+			cfg.calculateLODs = true;
+		else if (arg == "--no-normals")
+			cfg.exportNormals = false;
+		else if (arg == "--no-uvs")
+			cfg.exportTexCoords = false;
+		else if (arg == "--scale" && hasValue)
+			cfg.scale = (float)atof(argv[++i]);
+		else if (arg == "--quantize" && hasValue)
+			cfg.quantizationBits = atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue)
+			cfg.numThreads = (unsigned int)std::max(atoi(argv[++i]), 1);
+		else if (arg[0] != '-' && numPositional == 0)
+		{
+			cfg.inputFile = arg;
+			numPositional++;
+		}
+		else if (arg[0] != '-' && numPositional == 1)
+		{
+			cfg.outputFile = arg;
+			numPositional++;
+		}
+		else
+		{
+			printf("Unknown or incomplete argument '%s'\n", arg.c_str());
+			printUsage();
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	// TODO: ignore this in this chapter for now
-	recalculateBoundingBoxes(g_meshData);
+	if (cfg.quantizationBits < 0 || cfg.quantizationBits > 23)
+	{
+		printf("Invalid number of quantization bits: %d (expected 1..23, or 0 to disable)\n", cfg.quantizationBits);
+		exit(EXIT_FAILURE);
+	}
+
+	return cfg;
 }
 
-int main()
+int main(int argc, char** argv)
 {
-	loadFile("deps/src/bistro/Exterior/exterior.obj");
+	const MeshConvertConfig cfg = parseCommandLine(argc, argv);
+
+	const auto start = std::chrono::steady_clock::now();
+
+	MeshData meshData;
+
+	loadFile(cfg, meshData);
 
 	std::vector<DrawData> grid;
-	g_vertexOffset = 0;
-	for (auto i = 0; i < g_meshData.meshes_.size(); i++)
+	uint32_t vertexOffset = 0;
+	for (uint32_t i = 0; i < (uint32_t)meshData.meshes_.size(); i++)
 	{
 		grid.push_back(DrawData{
-			.meshIndex = (uint32_t)i,
+			.meshIndex = i,
 			.materialIndex = 0,
 			.LOD = 0,
-			.indexOffset = g_meshData.meshes_[i].indexOffset,
-			.vertexOffset = g_vertexOffset,
+			.indexOffset = meshData.meshes_[i].indexOffset,
+			.vertexOffset = vertexOffset,
 			.transformIndex = 0
 		});
-		g_vertexOffset += g_meshData.meshes_[i].vertexCount;
+		vertexOffset += meshData.meshes_[i].vertexCount;
 	}
 
-	saveMeshData("data/meshes/test.meshes", g_meshData);
+	saveMeshData(cfg.outputFile.c_str(), meshData);
+
+	const std::string drawDataFile = cfg.outputFile + ".drawdata";
+
+	FILE* f = fopen(drawDataFile.c_str(), "wb");
+
+	if (!f)
+	{
+		printf("Cannot write '%s'\n", drawDataFile.c_str());
+		exit(255);
+	}
 
-	FILE* f = fopen("data/meshes/test.meshes.drawdata", "wb");
 	fwrite(grid.data(), grid.size(), sizeof(DrawData), f);
 	fclose(f);
 
+	// one summary line per converted file, easy to grep in the logs of batch conversions
+	printf("%s -> %s: %u meshes, %u vertices, %u indices, %.1f ms\n",
+		cfg.inputFile.c_str(), cfg.outputFile.c_str(),
+		(uint32_t)meshData.meshes_.size(), vertexOffset, (uint32_t)meshData.indexData_.size(),
+		getMilliseconds(start, std::chrono::steady_clock::now()));
+
 	return 0;
 }
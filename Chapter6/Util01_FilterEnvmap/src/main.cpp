@@ -1,6 +1,12 @@
 #include <imgui/imgui.h>
 #include "shared/vkFramework/VulkanApp.h"
 
+#include <array>
+#include <chrono>
+#include <string.h>
+
+#include <taskflow/taskflow.hpp>
+
 #include "stb_image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -8,8 +14,16 @@
 // Image_Resize's implementation is included in UtilsVulkan.cpp
 #include "stb_image_resize.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define FILTERENVMAP_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
 int numPoints = 1024;
 
+// L2 spherical harmonics projection instead of the Monte Carlo integration (--sh)
+bool useSphericalHarmonics = false;
+
 /// From Henry J. Warren's "Hacker's Delight"
 float radicalInverse_VdC(uint32_t bits)
 {
@@ -30,6 +44,102 @@ vec2 hammersley2d(uint32_t i, uint32_t N)
     return vec2(float(i)/float(N), radicalInverse_VdC(i));
 }
 
+/*
+	The Monte Carlo samples do not depend on the output texel, so their directions and colors are computed once.
+	The tables are padded to a multiple of 4 with zero directions, which never pass the D > 0.01 test.
+*/
+struct DiffuseSamples
+{
+	std::vector<float> x_, y_, z_;
+	std::vector<float> r_, g_, b_;
+};
+
+DiffuseSamples getDiffuseSamples(const vec3* data, int srcW, int srcH, int numMonteCarloSamples)
+{
+	const size_t count = (numMonteCarloSamples + 3) & ~3;
+
+	DiffuseSamples s;
+
+	for (std::vector<float>* v : { &s.x_, &s.y_, &s.z_, &s.r_, &s.g_, &s.b_ })
+		v->resize(count, 0.0f);
+
+	for (int i = 0; i != numMonteCarloSamples; i++)
+	{
+		const vec2 h = hammersley2d(i, numMonteCarloSamples);
+		const int x1 = int(floor(h.x * srcW));
+		const int y1 = int(floor(h.y * srcH));
+		const float theta2 = float(y1) / float(srcH) * Math::PI;
+		const float phi2 = float(x1) / float(srcW) * Math::TWOPI;
+		const vec3 V2 = vec3(sin(theta2) * cos(phi2), sin(theta2) * sin(phi2), cos(theta2));
+		const vec3 color = data[y1 * srcW + x1];
+		s.x_[i] = V2.x;
+		s.y_[i] = V2.y;
+		s.z_[i] = V2.z;
+		s.r_[i] = color.x;
+		s.g_[i] = color.y;
+		s.b_[i] = color.z;
+	}
+
+	return s;
+}
+
+/* The average of the samples weighted by the cosine to V1, the samples below 0.01 are skipped */
+vec3 integrateDiffuse(const DiffuseSamples& s, const vec3& V1)
+{
+	const size_t count = s.x_.size();
+
+	vec3 color = vec3(0.0f);
+	float weight = 0.0f;
+
+	size_t i = 0;
+
+#if defined(FILTERENVMAP_USE_SSE)
+	const __m128 vx = _mm_set1_ps(V1.x);
+	const __m128 vy = _mm_set1_ps(V1.y);
+	const __m128 vz = _mm_set1_ps(V1.z);
+	const __m128 minD = _mm_set1_ps(0.01f);
+
+	__m128 r = _mm_setzero_ps();
+	__m128 g = _mm_setzero_ps();
+	__m128 b = _mm_setzero_ps();
+	__m128 w = _mm_setzero_ps();
+
+	for (; i != count; i += 4)
+	{
+		// the same order of operations as glm::dot()
+		const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&s.x_[i])), _mm_mul_ps(vy, _mm_loadu_ps(&s.y_[i]))), _mm_mul_ps(vz, _mm_loadu_ps(&s.z_[i])));
+		// max(0, D) is implied by D > 0.01
+		const __m128 D = _mm_and_ps(_mm_cmpgt_ps(dot, minD), dot);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&s.r_[i]), D));
+		g = _mm_add_ps(g, _mm_mul_ps(_mm_loadu_ps(&s.g_[i]), D));
+		b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(&s.b_[i]), D));
+		w = _mm_add_ps(w, D);
+	}
+
+	auto sum = [](__m128 v)
+	{
+		float lanes[4];
+		_mm_storeu_ps(lanes, v);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	};
+
+	color = vec3(sum(r), sum(g), sum(b));
+	weight = sum(w);
+#endif
+
+	for (; i != count; i++)
+	{
+		const float D = std::max(0.0f, V1.x * s.x_[i] + V1.y * s.y_[i] + V1.z * s.z_[i]);
+		if (D > 0.01f)
+		{
+			color += vec3(s.r_[i], s.g_[i], s.b_[i]) * D;
+			weight += D;
+		}
+	}
+
+	return color / weight;
+}
+
 void convolveDiffuse(const vec3* data, int srcW, int srcH, int dstW, int dstH, vec3* output, int numMonteCarloSamples)
 {
 	// only equirectangular maps are supported
@@ -44,41 +154,125 @@ void convolveDiffuse(const vec3* data, int srcW, int srcH, int dstW, int dstH, v
 		reinterpret_cast<float*>(tmp.data()), dstW, dstH, 0, 3,
 		STBIR_ALPHA_CHANNEL_NONE, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_CUBICBSPLINE, STBIR_COLORSPACE_LINEAR, nullptr);
 
-	const vec3* scratch = tmp.data();
-	srcW = dstW;
-	srcH = dstH;
+	const DiffuseSamples samples = getDiffuseSamples(tmp.data(), dstW, dstH, numMonteCarloSamples);
 
-	for (int y = 0; y != dstH; y++)
-	{
-		printf("Line %i...\n", y);
-		const float theta1 = float(y) / float(dstH) * Math::PI;
-		for (int x = 0; x != dstW; x++)
+	tf::Executor executor;
+	tf::Taskflow taskflow;
+
+	taskflow.for_each_index(0, dstH, 1, [&](int y)
 		{
-			const float phi1 = float(x) / float(dstW) * Math::TWOPI;
-			const vec3 V1 = vec3(sin(theta1) * cos(phi1), sin(theta1) * sin(phi1), cos(theta1));
-			vec3 color = vec3(0.0f);
-			float weight = 0.0f;
-			for (int i = 0; i != numMonteCarloSamples; i++)
+			const float theta1 = float(y) / float(dstH) * Math::PI;
+			for (int x = 0; x != dstW; x++)
 			{
-				const vec2 h = hammersley2d(i, numMonteCarloSamples);
-				const int x1 = int(floor(h.x * srcW));
-				const int y1 = int(floor(h.y * srcH));
-				const float theta2 = float(y1) / float(srcH) * Math::PI;
-				const float phi2 = float(x1) / float(srcW) * Math::TWOPI;
-				const vec3 V2 = vec3(sin(theta2) * cos(phi2), sin(theta2) * sin(phi2), cos(theta2));
-				const float D = std::max(0.0f, glm::dot(V1, V2));
-				if (D > 0.01f)
+				const float phi1 = float(x) / float(dstW) * Math::TWOPI;
+				const vec3 V1 = vec3(sin(theta1) * cos(phi1), sin(theta1) * sin(phi1), cos(theta1));
+				output[y * dstW + x] = integrateDiffuse(samples, V1);
+			}
+		}
+	);
+
+	executor.run(taskflow).wait();
+}
+
+using SH9 = std::array<vec3, 9>;
+
+/* The real spherical harmonics basis up to l = 2 */
+void getSHBasis(const vec3& n, float Y[9])
+{
+	Y[0] = 0.282095f;
+	Y[1] = 0.488603f * n.y;
+	Y[2] = 0.488603f * n.z;
+	Y[3] = 0.488603f * n.x;
+	Y[4] = 1.092548f * n.x * n.y;
+	Y[5] = 1.092548f * n.y * n.z;
+	Y[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+	Y[7] = 1.092548f * n.x * n.z;
+	Y[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+}
+
+/*
+	Irradiance from the L2 spherical harmonics projection of the environment (R. Ramamoorthi, P. Hanrahan, "An Efficient
+	Representation for Irradiance Environment Maps"). Every source texel is read once instead of every output texel
+	reading all the samples, but the lighting is band-limited, so small bright lights are smeared more.
+*/
+void convolveDiffuseSH(const vec3* data, int srcW, int srcH, int dstW, int dstH, vec3* output)
+{
+	// only equirectangular maps are supported
+	assert(srcW == 2 * srcH);
+
+	if (srcW != 2 * srcH) return;
+
+	tf::Executor executor;
+
+	// projection, one partial sum per row
+	std::vector<SH9> rowSums(srcH);
+
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, srcH, 1, [&](int y)
+			{
+				const float theta = (float(y) + 0.5f) / float(srcH) * Math::PI;
+				const float solidAngle = sin(theta) * (Math::PI / float(srcH)) * (Math::TWOPI / float(srcW));
+				SH9 sum = {};
+				float Y[9];
+				for (int x = 0; x != srcW; x++)
 				{
-					color += scratch[y1 * srcW + x1] * D;
-					weight += D;
+					const float phi = (float(x) + 0.5f) / float(srcW) * Math::TWOPI;
+					getSHBasis(vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta)), Y);
+					const vec3 color = data[y * srcW + x];
+					for (int k = 0; k != 9; k++)
+						sum[k] += color * Y[k];
 				}
+				for (int k = 0; k != 9; k++)
+					rowSums[y][k] = sum[k] * solidAngle;
 			}
-			output[y * dstW + x] = color / weight;
-		}
+		);
+		executor.run(taskflow).wait();
 	}
+
+	SH9 L = {};
+
+	for (const SH9& sum : rowSums)
+		for (int k = 0; k != 9; k++)
+			L[k] += sum[k];
+
+	// convolution with the clamped cosine (pi, 2pi/3, pi/4 per band), divided by pi: the cosine weighted average as in convolveDiffuse()
+	const float kBandScale[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+
+	for (int k = 0; k != 9; k++)
+		L[k] *= kBandScale[k];
+
+	tf::Taskflow taskflow;
+	taskflow.for_each_index(0, dstH, 1, [&](int y)
+		{
+			const float theta1 = float(y) / float(dstH) * Math::PI;
+			float Y[9];
+			for (int x = 0; x != dstW; x++)
+			{
+				const float phi1 = float(x) / float(dstW) * Math::TWOPI;
+				getSHBasis(vec3(sin(theta1) * cos(phi1), sin(theta1) * sin(phi1), cos(theta1)), Y);
+				vec3 color = vec3(0.0f);
+				for (int k = 0; k != 9; k++)
+					color += L[k] * Y[k];
+				// the band-limited reconstruction can ring below zero around bright lights
+				output[y * dstW + x] = glm::max(color, vec3(0.0f));
+			}
+		}
+	);
+	executor.run(taskflow).wait();
 }
 
-void process_cubemap(const char* filename, const char* outFilename)
+const int dstW = 256;
+const int dstH = 128;
+
+/*
+	The Monte Carlo result may differ from the shipped irradiance map by the RGBE rounding of the .hdr file, the order
+	of the sums and the resampling of the source. The errors are relative to the brightest channel of the texel.
+*/
+const float kMaxError = 0.05f;
+const float kMaxMeanError = 0.01f;
+
+bool convolve_cubemap(const char* filename, std::vector<vec3>& out)
 {
 	int w, h, comp;
 	const float* img = stbi_loadf(filename, &w, &h, &comp, 3);
@@ -86,23 +280,110 @@ void process_cubemap(const char* filename, const char* outFilename)
 	if (!img)
 	{
 		printf("Failed to load [%s] texture\n", filename); fflush(stdout);
-		return;
+		return false;
 	}
 
-	const int dstW = 256;
-	const int dstH = 128;
+	out.resize(dstW * dstH);
+
+	const auto start = std::chrono::steady_clock::now();
+
+	if (useSphericalHarmonics)
+		convolveDiffuseSH((vec3*)img, w, h, dstW, dstH, out.data());
+	else
+		convolveDiffuse((vec3*)img, w, h, dstW, dstH, out.data(), numPoints);
 
-	std::vector<vec3> out(dstW * dstH);
+	const auto end = std::chrono::steady_clock::now();
 
-	convolveDiffuse((vec3*)img, w, h, dstW, dstH, out.data(), numPoints);
+	printf("%s (%s): %.1f ms\n", filename, useSphericalHarmonics ? "spherical harmonics" : "Monte Carlo", std::chrono::duration<double, std::milli>(end - start).count());
 
 	stbi_image_free((void*)img);
-	stbi_write_hdr(outFilename, dstW, dstH, 3, (float*)out.data());
+
+	return true;
+}
+
+void process_cubemap(const char* filename, const char* outFilename)
+{
+	std::vector<vec3> out;
+
+	if (convolve_cubemap(filename, out))
+		stbi_write_hdr(outFilename, dstW, dstH, 3, (float*)out.data());
+}
+
+bool check_cubemap(const char* filename, const char* refFilename)
+{
+	std::vector<vec3> out;
+
+	if (!convolve_cubemap(filename, out))
+		return false;
+
+	int w, h, comp;
+	const float* ref = stbi_loadf(refFilename, &w, &h, &comp, 3);
+
+	if (!ref || w != dstW || h != dstH)
+	{
+		printf("Failed to load [%s] texture of %dx%d\n", refFilename, dstW, dstH);
+		stbi_image_free((void*)ref);
+		return false;
+	}
+
+	float maxError = 0.0f;
+	double sumError = 0.0;
+
+	for (int i = 0; i != dstW * dstH; i++)
+	{
+		const vec3 r = vec3(ref[3 * i + 0], ref[3 * i + 1], ref[3 * i + 2]);
+		const vec3 error = glm::abs(out[i] - r) / std::max(std::max(r.x, std::max(r.y, r.z)), 1e-6f);
+		maxError = std::max(maxError, std::max(error.x, std::max(error.y, error.z)));
+		sumError += error.x + error.y + error.z;
+	}
+
+	stbi_image_free((void*)ref);
+
+	const float meanError = float(sumError / (3 * dstW * dstH));
+
+	printf("%s: max error %.2f%%, mean error %.3f%%\n", refFilename, 100.0f * maxError, 100.0f * meanError);
+
+	return maxError <= kMaxError && meanError <= kMaxMeanError;
 }
 
-int main()
+/*
+	Usage: Ch6_Util01_FilterEnvmap [--sh] [--check]
+	 --sh     the spherical harmonics projection, written to data/piazza_bologni_1k_irradiance_sh.hdr
+	 --check  compare the Monte Carlo integration with the shipped data/piazza_bologni_1k_irradiance.hdr, nothing is written
+	Run from the root folder of the repository.
+*/
+int main(int argc, char** argv)
 {
-	process_cubemap("data/piazza_bologni_1k.hdr", "data/piazza_bologni_1k_irradiance.hdr");
+	bool check = false;
+
+	for (int i = 1; i != argc; i++)
+	{
+		if (!strcmp(argv[i], "--sh"))
+			useSphericalHarmonics = true;
+		else if (!strcmp(argv[i], "--check"))
+			check = true;
+		else
+		{
+			printf("Unknown option %s\nUsage: Ch6_Util01_FilterEnvmap [--sh] [--check]\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (check)
+	{
+		useSphericalHarmonics = false;
+
+		const bool ok = check_cubemap("data/piazza_bologni_1k.hdr", "data/piazza_bologni_1k_irradiance.hdr");
+
+		printf("%s\n", ok ? "OK" : "FAILED");
+
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (useSphericalHarmonics)
+		process_cubemap("data/piazza_bologni_1k.hdr", "data/piazza_bologni_1k_irradiance_sh.hdr");
+	else
+		process_cubemap("data/piazza_bologni_1k.hdr", "data/piazza_bologni_1k_irradiance.hdr");
 
 	return 0;
 }
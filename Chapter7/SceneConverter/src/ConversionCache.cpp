@@ -0,0 +1,245 @@
+#include "ConversionCache.h"
+
+#include <stdio.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include <rapidjson/istreamwrapper.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+namespace fs = std::filesystem;
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+
+	uint64_t h = seed;
+	for (size_t i = 0; i != size; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+uint64_t hashString(const std::string& s, uint64_t seed)
+{
+	return hashBytes(s.data(), s.length(), seed);
+}
+
+uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+	return hashBytes(&value, sizeof(value), seed);
+}
+
+static int64_t getModificationTime(const fs::path& path)
+{
+	std::error_code ec;
+	const auto t = fs::last_write_time(path, ec);
+	return ec ? 0 : (int64_t)t.time_since_epoch().count();
+}
+
+uint64_t ConversionCache::hashFile(const std::string& fileName)
+{
+	std::error_code ec;
+	const uint64_t size = (uint64_t)fs::file_size(fileName, ec);
+
+	if (ec)
+		return 0;
+
+	const int64_t modificationTime = getModificationTime(fileName);
+
+	{
+		std::lock_guard lock(mutex_);
+
+		const auto i = files_.find(fileName);
+		if (i != files_.end() && i->second.size_ == size && i->second.modificationTime_ == modificationTime)
+			return i->second.hash_;
+	}
+
+	FILE* f = fopen(fileName.c_str(), "rb");
+
+	if (!f)
+		return 0;
+
+	std::vector<uint8_t> buffer(1024 * 1024);
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (size_t bytesRead = 0; (bytesRead = fread(buffer.data(), 1, buffer.size(), f)) != 0; )
+		hash = hashBytes(buffer.data(), bytesRead, hash);
+
+	fclose(f);
+
+	std::lock_guard lock(mutex_);
+
+	files_[fileName] = CachedFileHash {
+		.size_ = size,
+		.modificationTime_ = modificationTime,
+		.hash_ = hash
+	};
+
+	return hash;
+}
+
+uint64_t ConversionCache::hashFiles(const std::vector<std::string>& fileNames, uint64_t seed)
+{
+	uint64_t key = seed;
+
+	for (const auto& f: fileNames)
+		key = hashCombine(hashString(f, key), hashFile(f));
+
+	return key;
+}
+
+bool ConversionCache::isUpToDate(const std::string& name, uint64_t key) const
+{
+	if (forceRebuild_)
+		return false;
+
+	std::lock_guard lock(mutex_);
+
+	const auto i = entries_.find(name);
+
+	if (i == entries_.end() || i->second.key_ != key)
+		return false;
+
+	for (const auto& output: i->second.outputs_)
+		if (!fs::exists(output))
+			return false;
+
+	return true;
+}
+
+void ConversionCache::update(const std::string& name, uint64_t key, const std::vector<std::string>& inputs, const std::vector<std::string>& outputs)
+{
+	std::lock_guard lock(mutex_);
+
+	entries_[name] = CacheEntry {
+		.key_ = key,
+		.inputs_ = inputs,
+		.outputs_ = outputs
+	};
+}
+
+std::vector<std::string> ConversionCache::getInputs(const std::string& name) const
+{
+	std::lock_guard lock(mutex_);
+
+	const auto i = entries_.find(name);
+
+	return i != entries_.end() ? i->second.inputs_ : std::vector<std::string>();
+}
+
+static std::vector<std::string> readStringArray(const rapidjson::Value& value)
+{
+	std::vector<std::string> result;
+
+	if (!value.IsArray())
+		return result;
+
+	for (rapidjson::SizeType i = 0; i < value.Size(); i++)
+		result.emplace_back(value[i].GetString());
+
+	return result;
+}
+
+void ConversionCache::load()
+{
+	std::ifstream ifs(manifestFile_);
+	if (!ifs.is_open())
+		return;
+
+	rapidjson::IStreamWrapper isw(ifs);
+	rapidjson::Document document;
+
+	if (document.ParseStream(isw).IsError() || !document.IsObject() || !document.HasMember("files") || !document.HasMember("entries"))
+	{
+		printf("Ignoring malformed conversion cache manifest '%s'\n", manifestFile_.c_str());
+		return;
+	}
+
+	std::lock_guard lock(mutex_);
+
+	const rapidjson::Value& files = document["files"];
+	for (rapidjson::SizeType i = 0; i < files.Size(); i++)
+	{
+		files_[files[i]["path"].GetString()] = CachedFileHash {
+			.size_ = files[i]["size"].GetUint64(),
+			.modificationTime_ = files[i]["mtime"].GetInt64(),
+			.hash_ = files[i]["hash"].GetUint64()
+		};
+	}
+
+	const rapidjson::Value& entries = document["entries"];
+	for (rapidjson::SizeType i = 0; i < entries.Size(); i++)
+	{
+		entries_[entries[i]["name"].GetString()] = CacheEntry {
+			.key_ = entries[i]["key"].GetUint64(),
+			.inputs_ = readStringArray(entries[i]["inputs"]),
+			.outputs_ = readStringArray(entries[i]["outputs"])
+		};
+	}
+}
+
+void ConversionCache::save() const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+	auto writeStringArray = [&writer](const char* name, const std::vector<std::string>& strings)
+	{
+		writer.Key(name);
+		writer.StartArray();
+		for (const auto& s: strings)
+			writer.String(s.c_str());
+		writer.EndArray();
+	};
+
+	std::lock_guard lock(mutex_);
+
+	writer.StartObject();
+
+	writer.Key("files");
+	writer.StartArray();
+	for (const auto& f: files_)
+	{
+		writer.StartObject();
+		writer.Key("path");  writer.String(f.first.c_str());
+		writer.Key("size");  writer.Uint64(f.second.size_);
+		writer.Key("mtime"); writer.Int64(f.second.modificationTime_);
+		writer.Key("hash");  writer.Uint64(f.second.hash_);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.Key("entries");
+	writer.StartArray();
+	for (const auto& e: entries_)
+	{
+		writer.StartObject();
+		writer.Key("name"); writer.String(e.first.c_str());
+		writer.Key("key");  writer.Uint64(e.second.key_);
+		writeStringArray("inputs", e.second.inputs_);
+		writeStringArray("outputs", e.second.outputs_);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.EndObject();
+
+	FILE* f = fopen(manifestFile_.c_str(), "wb");
+
+	if (!f)
+	{
+		printf("Cannot write conversion cache manifest '%s'\n", manifestFile_.c_str());
+		return;
+	}
+
+	fwrite(buffer.GetString(), 1, buffer.GetSize(), f);
+	fclose(f);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Content-addressed cache for the scene converter.
+
+	Every conversion job (a scene, a single texture, the merged Bistro scene) is identified by a name and a 64-bit key.
+	The key is a hash of the contents of all the input files plus all the settings which affect the output.
+	If the manifest contains the same key for a job and all of its output files still exist, the job can be skipped.
+
+	To avoid rehashing unchanged multi-megabyte inputs on every run, file hashes are remembered together with
+	the file size and modification time (just like a version control system index does).
+*/
+
+// 64-bit FNV-1a
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+uint64_t hashString(const std::string& s, uint64_t seed = 0xcbf29ce484222325ull);
+uint64_t hashCombine(uint64_t seed, uint64_t value);
+
+struct CachedFileHash
+{
+	uint64_t size_ = 0;
+	int64_t modificationTime_ = 0;
+	uint64_t hash_ = 0;
+};
+
+struct CacheEntry
+{
+	uint64_t key_ = 0;
+	std::vector<std::string> inputs_;
+	std::vector<std::string> outputs_;
+};
+
+class ConversionCache
+{
+public:
+	explicit ConversionCache(const std::string& manifestFile): manifestFile_(manifestFile) {}
+
+	void load();
+	void save() const;
+
+	// Disable skipping of the jobs (the manifest is still updated)
+	void setForceRebuild(bool force) { forceRebuild_ = force; }
+
+	// Hash of the file contents (0 for nonexistent files)
+	uint64_t hashFile(const std::string& fileName);
+
+	// Combine the hashes of all the input files into a single key
+	uint64_t hashFiles(const std::vector<std::string>& fileNames, uint64_t seed);
+
+	// True if the job 'name' was last completed with the same 'key' and all of its outputs still exist
+	bool isUpToDate(const std::string& name, uint64_t key) const;
+
+	void update(const std::string& name, uint64_t key, const std::vector<std::string>& inputs, const std::vector<std::string>& outputs);
+
+	// The input files of the last update() of the job 'name'
+	std::vector<std::string> getInputs(const std::string& name) const;
+
+private:
+	std::string manifestFile_;
+	bool forceRebuild_ = false;
+
+	std::unordered_map<std::string, CachedFileHash> files_;
+	std::unordered_map<std::string, CacheEntry> entries_;
+
+	// textures are converted in parallel, so all the accesses to the maps are guarded
+	mutable std::mutex mutex_;
+};
@@ -0,0 +1,58 @@
+#include "ConversionReport.h"
+
+#include <stdio.h>
+
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+const char* getSceneStageName(SceneStage stage)
+{
+	const char* names[SceneStage_Count] = { "import", "meshes", "lods", "boxes", "materials", "textures", "hierarchy", "save" };
+
+	return names[stage];
+}
+
+void saveConversionReport(const char* fileName, const std::vector<SceneConversionStats>& scenes, double mergeSeconds, double totalSeconds)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+	writer.StartObject();
+
+	writer.Key("scenes");
+	writer.StartArray();
+	for (const auto& s: scenes)
+	{
+		writer.StartObject();
+		writer.Key("file");    writer.String(s.fileName_.c_str());
+		writer.Key("skipped"); writer.Bool(s.skipped_);
+		writer.Key("stages_ms");
+		writer.StartObject();
+		for (int i = 0; i != SceneStage_Count; i++)
+		{
+			writer.Key(getSceneStageName((SceneStage)i));
+			writer.Double((double)s.microseconds_[i].load() * 1e-3);
+		}
+		writer.EndObject();
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.Key("merge_ms"); writer.Double(mergeSeconds * 1e3);
+	writer.Key("total_ms"); writer.Double(totalSeconds * 1e3);
+
+	writer.EndObject();
+
+	FILE* f = fopen(fileName, "wb");
+
+	if (!f)
+	{
+		printf("Cannot write conversion report '%s'\n", fileName);
+		return;
+	}
+
+	fwrite(buffer.GetString(), 1, buffer.GetSize(), f);
+	fclose(f);
+
+	printf("Conversion report saved to '%s'\n", fileName);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*
+	Per-stage timing of the scene conversion.
+
+	The stages of a scene run concurrently (and the meshes/LODs of a scene run on many threads at once), so the time
+	of the per-mesh stages (meshes, LODs) is summed over all the worker threads, while all the other stages are measured
+	on the thread which runs them. The report is a JSON file which can be compared between runs by scripts.
+*/
+
+enum SceneStage
+{
+	SceneStage_Import,
+	SceneStage_Meshes,      // per-mesh conversion and optimization (summed over threads)
+	SceneStage_LODs,        // LOD generation (summed over threads)
+	SceneStage_Boxes,
+	SceneStage_Materials,
+	SceneStage_Textures,
+	SceneStage_Hierarchy,
+	SceneStage_Save,
+	SceneStage_Count
+};
+
+struct SceneConversionStats
+{
+	std::string fileName_;
+	bool skipped_ = false;
+	std::atomic<uint64_t> microseconds_[SceneStage_Count] = {};
+
+	// Add the time passed since 'start' to the 'stage' and restart the measurement
+	void add(SceneStage stage, std::chrono::steady_clock::time_point& start)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		microseconds_[stage] += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+		start = now;
+	}
+};
+
+const char* getSceneStageName(SceneStage stage);
+
+void saveConversionReport(const char* fileName, const std::vector<SceneConversionStats>& scenes, double mergeSeconds, double totalSeconds);
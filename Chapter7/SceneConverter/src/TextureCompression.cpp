@@ -0,0 +1,146 @@
+#include "TextureCompression.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "stb_image_resize.h"
+
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
+
+#include "etc2comp/EtcLib/Etc/Etc.h"
+#include "etc2comp/EtcLib/Etc/EtcImage.h"
+
+TextureOutputFormat parseTextureOutputFormat(const char* name)
+{
+	if (!strcmp(name, "rgba8")) return TextureOutputFormat_RGBA8;
+	if (!strcmp(name, "bc3"))   return TextureOutputFormat_BC3;
+	if (!strcmp(name, "etc2"))  return TextureOutputFormat_ETC2;
+
+	if (strcmp(name, "png"))
+		printf("Unknown texture format '%s', falling back to PNG\n", name);
+
+	return TextureOutputFormat_PNG;
+}
+
+const char* getTextureOutputExtension(TextureOutputFormat format)
+{
+	return (format == TextureOutputFormat_PNG) ? ".png" : ".ktx";
+}
+
+int getNumMipLevels(int w, int h)
+{
+	int levels = 1;
+	while ((w | h) >> levels)
+		levels += 1;
+	return levels;
+}
+
+static gli::format getGLIFormat(TextureOutputFormat format)
+{
+	switch (format)
+	{
+	case TextureOutputFormat_BC3:
+		return gli::FORMAT_RGBA_DXT5_UNORM_BLOCK16;
+	case TextureOutputFormat_ETC2:
+		return gli::FORMAT_RGBA_ETC2_UNORM_BLOCK16;
+	default:
+		break;
+	}
+	return gli::FORMAT_RGBA8_UNORM_PACK8;
+}
+
+static void compressBC3(const uint8_t* rgba, int w, int h, uint8_t* dst)
+{
+	uint8_t block[4 * 4 * 4];
+
+	for (int by = 0; by < h; by += 4)
+		for (int bx = 0; bx < w; bx += 4)
+		{
+			// replicate the edge texels for partial blocks (levels smaller than 4x4)
+			for (int y = 0; y != 4; y++)
+				for (int x = 0; x != 4; x++)
+				{
+					const int sx = std::min(bx + x, w - 1);
+					const int sy = std::min(by + y, h - 1);
+					memcpy(block + (y * 4 + x) * 4, rgba + (sy * w + sx) * 4, 4);
+				}
+
+			stb_compress_dxt_block(dst, block, 1, STB_DXT_HIGHQUAL);
+			dst += 16;
+		}
+}
+
+static bool compressETC2(const uint8_t* rgba, int w, int h, uint8_t* dst, size_t dstSize)
+{
+	std::vector<float> rgbaf(w * h * 4);
+	for (size_t i = 0; i != rgbaf.size(); i++)
+		rgbaf[i] = rgba[i] / 255.0f;
+
+	const auto errorMetric = Etc::ErrorMetric::RGBA;
+
+	Etc::Image image(rgbaf.data(), w, h, errorMetric);
+	// textures are already converted in parallel, so every image is encoded on a single thread
+	image.Encode(Etc::Image::Format::RGBA8, errorMetric, ETCCOMP_DEFAULT_EFFORT_LEVEL, 1, 1024);
+
+	if (image.GetEncodingBitsBytes() != dstSize)
+	{
+		printf("Unexpected ETC2 encoded size for %dx%d level: %u (expected %u)\n", w, h, image.GetEncodingBitsBytes(), (unsigned)dstSize);
+		return false;
+	}
+
+	memcpy(dst, image.GetEncodingBits(), dstSize);
+
+	return true;
+}
+
+bool createMipmappedTexture(const uint8_t* rgba, int w, int h, bool isLinear, TextureOutputFormat format, gli::texture2d& texture)
+{
+	const int numLevels = getNumMipLevels(w, h);
+
+	texture = gli::texture2d(getGLIFormat(format), gli::extent2d(w, h), numLevels);
+
+	std::vector<uint8_t> level(rgba, rgba + w * h * 4);
+	std::vector<uint8_t> nextLevel;
+
+	for (int l = 0; l != numLevels; l++)
+	{
+		uint8_t* dst = static_cast<uint8_t*>(texture.data(0, 0, l));
+
+		switch (format)
+		{
+		case TextureOutputFormat_BC3:
+			compressBC3(level.data(), w, h, dst);
+			break;
+		case TextureOutputFormat_ETC2:
+			if (!compressETC2(level.data(), w, h, dst, texture.size(l)))
+				return false;
+			break;
+		default:
+			memcpy(dst, level.data(), texture.size(l));
+			break;
+		}
+
+		if (l == numLevels - 1)
+			break;
+
+		const int newW = std::max(w >> 1, 1);
+		const int newH = std::max(h >> 1, 1);
+
+		nextLevel.resize(newW * newH * 4);
+
+		if (isLinear)
+			stbir_resize_uint8(level.data(), w, h, 0, nextLevel.data(), newW, newH, 0, 4);
+		else
+			stbir_resize_uint8_srgb(level.data(), w, h, 0, nextLevel.data(), newW, newH, 0, 4, 3, 0);
+
+		level.swap(nextLevel);
+		w = newW;
+		h = newH;
+	}
+
+	return true;
+}
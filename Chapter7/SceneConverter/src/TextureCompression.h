@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <gli/gli.hpp>
+#include <gli/texture2d.hpp>
+
+/*
+	Output formats for the converted textures.
+	PNG is the original single-level output. All the other formats are .ktx files with a complete precomputed mip chain,
+	so the runtime loaders only have to copy the data into a staging buffer.
+*/
+enum TextureOutputFormat
+{
+	TextureOutputFormat_PNG,
+	TextureOutputFormat_RGBA8,  // uncompressed RGBA8 + mips
+	TextureOutputFormat_BC3,    // DXT5 via stb_dxt, 1 byte per texel (desktop GPUs)
+	TextureOutputFormat_ETC2,   // ETC2 RGBA8 EAC via etc2comp, 1 byte per texel (mobile GPUs)
+};
+
+// "png", "rgba8", "bc3" or "etc2"
+TextureOutputFormat parseTextureOutputFormat(const char* name);
+
+// ".png" or ".ktx"
+const char* getTextureOutputExtension(TextureOutputFormat format);
+
+// Number of levels in a full mip chain (down to 1x1)
+int getNumMipLevels(int w, int h);
+
+/*
+	Build a full mip chain from the RGBA8 image and encode it in the requested block format.
+	Color textures are filtered in linear space (sRGB decode -> box filter -> sRGB encode), the textures
+	with non-color data (normal maps) are filtered directly with 'isLinear' set to true.
+	Returns false if a level could not be encoded, the contents of 'texture' are undefined then.
+*/
+bool createMipmappedTexture(const uint8_t* rgba, int w, int h, bool isLinear, TextureOutputFormat format, gli::texture2d& texture);
@@ -1,8 +1,13 @@
 
 #include <algorithm>
-#include <execution>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 #include <assimp/cimport.h>
 #include <assimp/material.h>
@@ -19,6 +24,10 @@
 #include "shared/scene/Scene.h"
 #include "shared/scene/MergeUtil.h"
 
+#include "ConversionCache.h"
+#include "ConversionReport.h"
+#include "TextureCompression.h"
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "stb_image.h"
@@ -26,15 +35,23 @@
 
 #include <meshoptimizer.h>
 
-namespace fs = std::filesystem;
+#include <gli/save_ktx.hpp>
 
-MeshData g_MeshData;
+#include <taskflow/taskflow.hpp>
 
-uint32_t g_indexOffset = 0;
-uint32_t g_vertexOffset = 0;
+namespace fs = std::filesystem;
 
 const uint32_t g_numElementsToStore = 3 + 3 + 2; // pos(vec3) + normal(vec3) + uv(vec2)
 
+// all the textures are downscaled to fit into this size
+const int g_maxTextureWidth = 512;
+const int g_maxTextureHeight = 512;
+
+// Bump this whenever the output formats or the conversion code change: all the cached outputs become invalid
+const uint64_t g_converterVersion = 4;
+
+ConversionCache g_Cache("data/meshes/sceneconverter_cache.json");
+
 struct SceneConfig
 {
 	std::string fileName;
@@ -44,6 +61,28 @@ struct SceneConfig
 	float scale;
 	bool calculateLODs;
 	bool mergeInstances;
+	TextureOutputFormat textureFormat;
+	bool compactLODs;
+	unsigned int assimpFlags;
+};
+
+/* Everything produced by processScene(). The merge steps consume these directly instead of reloading the output files */
+struct ConvertedScene
+{
+	MeshData meshData;
+	Scene scene;
+	std::vector<MaterialDescription> materials;
+	std::vector<std::string> textureFiles;
+	// false if the scene was up to date and nothing was converted in this run
+	bool isConverted = false;
+};
+
+/* A single mesh converted into its own buffers. Offsets in 'mesh' are relative to these buffers until the meshes are concatenated */
+struct ConvertedMesh
+{
+	Mesh mesh;
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
 };
 
 MaterialDescription convertAIMaterialToDescription(const aiMaterial* M, std::vector<std::string>& files, std::vector<std::string>& opacityMaps)
@@ -82,7 +121,7 @@ MaterialDescription convertAIMaterialToDescription(const aiMaterial* M, std::vec
 
 	if (aiGetMaterialColor(M, AI_MATKEY_COLOR_TRANSPARENT, &Color) == AI_SUCCESS)
 	{
-		const float Opacity = std::max(std::max(Color.r, Color.g), Color.b);
+		Opacity = std::max(std::max(Color.r, Color.g), Color.b);
 		D.transparencyFactor_ = glm::clamp(Opacity, 0.0f, 1.0f);
 		if (D.transparencyFactor_ >= 1.0f - opaquenessThreshold) D.transparencyFactor_ = 0.0f;
 		D.alphaTest_ = 0.5f;
@@ -162,82 +201,207 @@ MaterialDescription convertAIMaterialToDescription(const aiMaterial* M, std::vec
 	return D;
 }
 
-void processLods(std::vector<uint32_t>& indices, std::vector<float>& vertices, std::vector<std::vector<uint32_t>>& outLods)
+const uint32_t g_maxLODs = 8;
+
+// meshes with fewer indices are not simplified further
+const size_t g_minLODIndices = 1024;
+
+/*
+	Every LOD is simplified directly from LOD0 (LOD 'l' targets 1/2^l of the indices with a growing error limit), so the errors
+	do not accumulate over the chain and all the LODs of a mesh are computed concurrently.
+	The vertices are interleaved, positions go first in every vertex.
+*/
+void processLods(tf::Subflow& subflow, const std::vector<uint32_t>& indices, const std::vector<float>& vertices, std::vector<std::vector<uint32_t>>& outLods)
 {
-	size_t verticesCountIn = vertices.size() / 2;
-	size_t targetIndicesCount = indices.size();
+	const size_t vertexCount = vertices.size() / g_numElementsToStore;
+	const size_t vertexStride = g_numElementsToStore * sizeof(float);
 
-	uint8_t LOD = 1;
+	uint32_t numLODs = 1;
+	while (numLODs < g_maxLODs && (indices.size() >> (numLODs - 1)) > g_minLODIndices)
+		numLODs++;
 
-	printf("\n   LOD0: %i indices", int(indices.size()));
+	std::vector<std::vector<uint32_t>> lods(numLODs);
+	// not std::vector<bool>: the elements are written concurrently
+	std::vector<uint8_t> sloppy(numLODs, 0);
 
-	outLods.push_back(indices);
+	lods[0] = indices;
 
-	while ( targetIndicesCount > 1024 && LOD < 8 )
-	{
-		targetIndicesCount = indices.size() / 2;
+	subflow.for_each_index(1u, numLODs, 1u, [&](int l)
+		{
+			const size_t targetIndicesCount = indices.size() >> l;
+			const float targetError = 0.02f * l;
 
-		bool sloppy = false;
+			std::vector<uint32_t>& lod = lods[l];
+			lod.resize(indices.size());
 
-		size_t numOptIndices = meshopt_simplify(
-			indices.data(),
-			indices.data(), (uint32_t)indices.size(),
-			vertices.data(), verticesCountIn,
-			sizeof( float ) * 3,
-			targetIndicesCount, 0.02f );
+			size_t numOptIndices = meshopt_simplify(
+				lod.data(),
+				indices.data(), indices.size(),
+				vertices.data(), vertexCount,
+				vertexStride,
+				targetIndicesCount, targetError);
 
-		// cannot simplify further
-		if (static_cast<size_t>(numOptIndices * 1.1f) > indices.size())
-		{
-			if (LOD > 1)
+			// the topology does not allow reaching the target: try harder (but never for the first LOD)
+			if (l > 1 && static_cast<size_t>(numOptIndices * 1.1f) > (indices.size() >> (l - 1)))
 			{
-				// try harder
 				numOptIndices = meshopt_simplifySloppy(
-					indices.data(),
+					lod.data(),
 					indices.data(), indices.size(),
-					vertices.data(), verticesCountIn,
-					sizeof(float) * 3,
-					targetIndicesCount, 0.02f, nullptr);
-				sloppy = true;
-				if (numOptIndices == indices.size()) break;
+					vertices.data(), vertexCount,
+					vertexStride,
+					targetIndicesCount, targetError, nullptr);
+				sloppy[l] = 1;
 			}
-			else
-				break;
+
+			lod.resize(numOptIndices);
 		}
+	);
+
+	subflow.join();
 
-		indices.resize(numOptIndices);
+	printf("   LOD0: %i indices\n", int(indices.size()));
 
-		meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), verticesCountIn);
+	outLods.push_back(lods[0]);
 
-		printf("\n   LOD%i: %i indices %s", int(LOD), int(numOptIndices), sloppy ? "[sloppy]" : "");
+	// stop at the first LOD which is not noticeably smaller than the previous one
+	for (uint32_t l = 1; l < numLODs; l++)
+	{
+		if (static_cast<size_t>(lods[l].size() * 1.1f) > outLods.back().size())
+			break;
 
-		LOD++;
+		printf("   LOD%i: %i indices %s\n", int(l), int(lods[l].size()), sloppy[l] ? "[sloppy]" : "");
 
-		outLods.push_back(indices);
+		outLods.push_back(std::move(lods[l]));
 	}
 }
 
-Mesh convertAIMesh(const aiMesh* m, const SceneConfig& cfg)
+// post-transform cache parameters used by the meshoptimizer demo in Chapter 2
+const unsigned int g_vertexCacheSize = 16;
+
+// overdraw optimization may degrade the vertex cache efficiency by at most 5%
+const float g_overdrawThreshold = 1.05f;
+
+struct MeshOptimizationStats
+{
+	float acmr_ = 0.0f;       // average cache miss ratio: transformed vertices per triangle
+	float atvr_ = 0.0f;       // average transformed vertex ratio: transformed vertices per vertex (1.0 is ideal)
+	float overfetch_ = 0.0f;  // fetched vertex bytes per vertex buffer byte (1.0 is ideal)
+};
+
+MeshOptimizationStats analyzeMesh(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	if (indices.empty() || !vertexCount)
+		return MeshOptimizationStats();
+
+	const meshopt_VertexCacheStatistics vcs = meshopt_analyzeVertexCache(indices.data(), indices.size(), vertexCount, g_vertexCacheSize, 0, 0);
+	const meshopt_VertexFetchStatistics vfs = meshopt_analyzeVertexFetch(indices.data(), indices.size(), vertexCount, g_numElementsToStore * sizeof(float));
+
+	return MeshOptimizationStats {
+		.acmr_ = vcs.acmr,
+		.atvr_ = vcs.atvr,
+		.overfetch_ = vfs.overfetch
+	};
+}
+
+/*
+	Weld the vertices which became identical after scaling and UV flipping (aiProcess_JoinIdenticalVertices works on the original data)
+	and drop the unreferenced ones. The vertices are interleaved: pos(vec3) + uv(vec2) + normal(vec3).
+*/
+void weldVertices(std::vector<float>& vertices, std::vector<uint32_t>& indices)
+{
+	const size_t vertexSize = g_numElementsToStore * sizeof(float);
+	const size_t vertexCount = vertices.size() / g_numElementsToStore;
+
+	std::vector<uint32_t> remap(vertexCount);
+	const size_t uniqueVertexCount = meshopt_generateVertexRemap(remap.data(), indices.data(), indices.size(), vertices.data(), vertexCount, vertexSize);
+
+	meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+	meshopt_remapVertexBuffer(vertices.data(), vertices.data(), vertexCount, vertexSize, remap.data());
+
+	vertices.resize(uniqueVertexCount * g_numElementsToStore);
+}
+
+/* Reorder the triangles for the post-transform vertex cache first and then for less overdraw (positions are at the start of every vertex) */
+void optimizeTriangleOrder(std::vector<uint32_t>& indices, const std::vector<float>& vertices)
 {
+	const size_t vertexCount = vertices.size() / g_numElementsToStore;
+
+	meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), vertexCount);
+	meshopt_optimizeOverdraw(indices.data(), indices.data(), indices.size(), vertices.data(), vertexCount, g_numElementsToStore * sizeof(float), g_overdrawThreshold);
+}
+
+/*
+	Reorder the vertices in the order of their first use. All the LODs share one vertex buffer, so the remap table is built from
+	all of them at once (LOD0 goes first and determines the order). Unreferenced vertices are removed.
+*/
+void optimizeVertexFetch(std::vector<float>& vertices, std::vector<std::vector<uint32_t>>& lods)
+{
+	const size_t vertexSize = g_numElementsToStore * sizeof(float);
+	const size_t vertexCount = vertices.size() / g_numElementsToStore;
+
+	std::vector<uint32_t> allIndices;
+	for (const auto& l: lods)
+		mergeVectors(allIndices, l);
+
+	std::vector<uint32_t> remap(vertexCount);
+	const size_t usedVertexCount = meshopt_optimizeVertexFetchRemap(remap.data(), allIndices.data(), allIndices.size(), vertexCount);
+
+	for (auto& l: lods)
+		meshopt_remapIndexBuffer(l.data(), l.data(), l.size(), remap.data());
+
+	std::vector<float> newVertices(usedVertexCount * g_numElementsToStore);
+	meshopt_remapVertexBuffer(newVertices.data(), vertices.data(), vertexCount, vertexSize, remap.data());
+
+	vertices.swap(newVertices);
+}
+
+/*
+	Give every LOD except LOD0 its own compact copy of the vertices it references, appended to the vertex buffer of the mesh.
+	The LODs only use a small fraction of the vertices, so this trades memory for better vertex fetch locality.
+	Indices remain relative to the first vertex of the mesh.
+*/
+void compactLodVertices(std::vector<float>& vertices, std::vector<std::vector<uint32_t>>& lods)
+{
+	const size_t vertexSize = g_numElementsToStore * sizeof(float);
+	const size_t vertexCount = vertices.size() / g_numElementsToStore;
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<float> lodVertices;
+
+	for (size_t l = 1; l < lods.size(); l++)
+	{
+		auto& lod = lods[l];
+
+		const size_t usedVertexCount = meshopt_optimizeVertexFetchRemap(remap.data(), lod.data(), lod.size(), vertexCount);
+
+		lodVertices.resize(usedVertexCount * g_numElementsToStore);
+		meshopt_remapVertexBuffer(lodVertices.data(), vertices.data(), vertexCount, vertexSize, remap.data());
+
+		const uint32_t baseVertex = (uint32_t)(vertices.size() / g_numElementsToStore);
+
+		for (auto& i: lod)
+			i = remap[i] + baseVertex;
+
+		mergeVectors(vertices, lodVertices);
+	}
+}
+
+// Convert a single mesh into its own vertex/index buffers. This function does not touch any global state and can be run concurrently for different meshes
+ConvertedMesh convertAIMesh(tf::Subflow& subflow, const aiMesh* m, const SceneConfig& cfg, SceneConversionStats& stats)
+{
+	auto start = std::chrono::steady_clock::now();
+
 	const bool hasTexCoords = m->HasTextureCoords(0);
 	const uint32_t streamElementSize = static_cast<uint32_t>(g_numElementsToStore * sizeof(float));
 
-	Mesh result = {
-		.streamCount = 1,
-		.indexOffset = g_indexOffset,
-		.vertexOffset = g_vertexOffset,
-		.vertexCount = m->mNumVertices,
-		.streamOffset = { g_vertexOffset * streamElementSize },
-		.streamElementSize = { streamElementSize }
-	};
+	ConvertedMesh result;
 
-	// Original data for LOD calculation
-	std::vector<float> srcVertices;
 	std::vector<uint32_t> srcIndices;
 
 	std::vector<std::vector<uint32_t>> outLods;
 
-	auto& vertices = g_MeshData.vertexData_;
+	auto& vertices = result.vertices;
+	vertices.reserve(m->mNumVertices * g_numElementsToStore);
 
 	for (size_t i = 0; i != m->mNumVertices; i++)
 	{
@@ -245,13 +409,6 @@ Mesh convertAIMesh(const aiMesh* m, const SceneConfig& cfg)
 		const aiVector3D n = m->mNormals[i];
 		const aiVector3D t = hasTexCoords ? m->mTextureCoords[0][i] : aiVector3D();
 
-		if (cfg.calculateLODs)
-		{
-			srcVertices.push_back(v.x);
-			srcVertices.push_back(v.y);
-			srcVertices.push_back(v.z);
-		}
-
 		vertices.push_back(v.x * cfg.scale);
 		vertices.push_back(v.y * cfg.scale);
 		vertices.push_back(v.z * cfg.scale);
@@ -272,33 +429,145 @@ Mesh convertAIMesh(const aiMesh* m, const SceneConfig& cfg)
 			srcIndices.push_back(m->mFaces[i].mIndices[j]);
 	}
 
+	const MeshOptimizationStats before = analyzeMesh(srcIndices, m->mNumVertices);
+
+	weldVertices(vertices, srcIndices);
+	optimizeTriangleOrder(srcIndices, vertices);
+
 	if (!cfg.calculateLODs)
 		outLods.push_back(srcIndices);
 	else
-		processLods(srcIndices, srcVertices, outLods);
+	{
+		// scaling does not matter, the simplification error is relative to the mesh extents
+		stats.add(SceneStage_Meshes, start);
+
+		processLods(subflow, srcIndices, vertices, outLods);
+
+		stats.add(SceneStage_LODs, start);
+
+		for (size_t l = 1; l < outLods.size(); l++)
+			optimizeTriangleOrder(outLods[l], vertices);
+	}
+
+	optimizeVertexFetch(vertices, outLods);
 
-	printf("\nCalculated LOD count: %u\n", (unsigned)outLods.size());
+	const uint32_t lod0VertexCount = (uint32_t)(vertices.size() / g_numElementsToStore);
+
+	if (cfg.compactLODs)
+		compactLodVertices(vertices, outLods);
+
+	const uint32_t vertexCount = (uint32_t)(vertices.size() / g_numElementsToStore);
+
+	const MeshOptimizationStats after = analyzeMesh(outLods[0], lod0VertexCount);
+
+	printf("Mesh [%s]: %u -> %u vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overfetch %.3f -> %.3f\n",
+		m->mName.C_Str(), m->mNumVertices, lod0VertexCount, before.acmr_, after.acmr_, before.atvr_, after.atvr_, before.overfetch_, after.overfetch_);
+
+	for (size_t l = 1; l < outLods.size(); l++)
+	{
+		const MeshOptimizationStats lod = analyzeMesh(outLods[l], vertexCount);
+		printf("   LOD%u: ACMR %.3f, ATVR %.3f\n", (uint32_t)l, lod.acmr_, lod.atvr_);
+	}
+
+	result.mesh = Mesh {
+		.streamCount = 1,
+		.indexOffset = 0,
+		.vertexOffset = 0,
+		.vertexCount = vertexCount,
+		.streamOffset = { 0 },
+		.streamElementSize = { streamElementSize }
+	};
 
 	uint32_t numIndices = 0;
 
 	for (size_t l = 0 ; l < outLods.size() ; l++)
 	{
-		for (size_t i = 0 ; i < outLods[l].size() ; i++)
-			g_MeshData.indexData_.push_back(outLods[l][i]);
+		mergeVectors(result.indices, outLods[l]);
 
-		result.lodOffset[l] = numIndices;
+		result.mesh.lodOffset[l] = numIndices;
 		numIndices += (int)outLods[l].size();
 	}
 
-	result.lodOffset[outLods.size()] = numIndices;
-	result.lodCount = (uint32_t)outLods.size();
+	result.mesh.lodOffset[outLods.size()] = numIndices;
+	result.mesh.lodCount = (uint32_t)outLods.size();
 
-	g_indexOffset  += numIndices;
-	g_vertexOffset += m->mNumVertices;
+	stats.add(SceneStage_Meshes, start);
 
 	return result;
 }
 
+// Compute the final index/vertex offsets with a prefix sum and concatenate all the converted meshes into one MeshData in parallel.
+// The result is byte-identical to appending the meshes one by one in their original order.
+void concatenateConvertedMeshes(tf::Subflow& subflow, std::vector<ConvertedMesh>& converted, MeshData& out)
+{
+	const uint32_t streamElementSize = static_cast<uint32_t>(g_numElementsToStore * sizeof(float));
+
+	uint32_t indexOffset = 0;
+	uint32_t vertexOffset = 0;
+
+	for (auto& c: converted)
+	{
+		c.mesh.indexOffset = indexOffset;
+		c.mesh.vertexOffset = vertexOffset;
+		c.mesh.streamOffset[0] = vertexOffset * streamElementSize;
+
+		indexOffset += (uint32_t)c.indices.size();
+		vertexOffset += c.mesh.vertexCount;
+	}
+
+	out.indexData_.resize(indexOffset);
+	out.vertexData_.resize((size_t)vertexOffset * g_numElementsToStore);
+	out.meshes_.resize(converted.size());
+
+	subflow.for_each_index(0u, (uint32_t)converted.size(), 1u, [&](int i)
+		{
+			ConvertedMesh& c = converted[i];
+			std::copy(c.indices.begin(), c.indices.end(), out.indexData_.begin() + c.mesh.indexOffset);
+			std::copy(c.vertices.begin(), c.vertices.end(), out.vertexData_.begin() + (size_t)c.mesh.vertexOffset * g_numElementsToStore);
+			out.meshes_[i] = c.mesh;
+
+			// release the intermediate buffers as soon as possible
+			c.indices = std::vector<uint32_t>();
+			c.vertices = std::vector<float>();
+		}
+	);
+
+	subflow.join();
+}
+
+// Convert all the meshes of the scene independently and concatenate them into 'meshData'
+void convertAllMeshes(tf::Subflow& subflow, const aiScene* scene, const SceneConfig& cfg, MeshData& meshData, SceneConversionStats& stats)
+{
+	std::vector<ConvertedMesh> convertedMeshes(scene->mNumMeshes);
+
+	// the offsets are known only after all the meshes are converted
+	tf::Task concatenate = subflow.emplace([&](tf::Subflow& sf) { concatenateConvertedMeshes(sf, convertedMeshes, meshData); });
+
+	// one subflow per mesh: the LODs of a mesh are computed concurrently too
+	for (unsigned int i = 0; i != scene->mNumMeshes; i++)
+	{
+		subflow.emplace([&, i](tf::Subflow& sf)
+			{
+				convertedMeshes[i] = convertAIMesh(sf, scene->mMeshes[i], cfg, stats);
+				printf("Converted mesh %u/%u: %u LODs\n", i + 1, scene->mNumMeshes, convertedMeshes[i].mesh.lodCount);
+			}
+		).precede(concatenate);
+	}
+
+	subflow.join();
+
+	auto start = std::chrono::steady_clock::now();
+
+	meshData.boxes_.reserve(scene->mNumMeshes);
+	recalculateBoundingBoxes(meshData);
+
+	stats.add(SceneStage_Boxes, start);
+
+	saveMeshData(cfg.outputMesh.c_str(), meshData);
+
+	stats.add(SceneStage_Save, start);
+}
+
 void makePrefix(int ofs) { for(int i = 0 ; i < ofs ; i++) printf("\t"); }
 
 void printMat4(const aiMatrix4x4& m)
@@ -422,21 +691,166 @@ std::string fixTextureFile(const std::string& file)
     return fs::exists(file) ? file : findSubstitute(file);
 }
 
-std::string convertTexture(const std::string& file, const std::string& basePath, std::unordered_map<std::string, uint32_t>& opacityMapIndices, const std::vector<std::string>& opacityMaps)
+/*
+	Texture conversion runs on all the cores, but the decoded full-resolution images can be huge (an 8K RGBA texture is 256 Mb).
+	Every texture reserves its estimated memory footprint from this budget before loading and waits until enough memory is released
+	by the other textures in flight. A single texture larger than the whole budget is still processed, but only on its own.
+*/
+class MemoryBudget
 {
-	const int maxNewWidth = 512;
-	const int maxNewHeight = 512;
+public:
+	explicit MemoryBudget(uint64_t maxBytes): maxBytes_(maxBytes) {}
+
+	void setLimit(uint64_t maxBytes)
+	{
+		std::lock_guard lock(mutex_);
+		maxBytes_ = maxBytes;
+	}
+
+	void acquire(uint64_t bytes)
+	{
+		std::unique_lock lock(mutex_);
+		released_.wait(lock, [this, bytes]() { return inFlight_ == 0 || inFlight_ + bytes <= maxBytes_; });
+		inFlight_ += bytes;
+		peak_ = std::max(peak_, inFlight_);
+	}
+
+	void release(uint64_t bytes)
+	{
+		{
+			std::lock_guard lock(mutex_);
+			inFlight_ -= bytes;
+		}
+		released_.notify_all();
+	}
+
+	uint64_t getPeak() const
+	{
+		std::lock_guard lock(mutex_);
+		return peak_;
+	}
+
+private:
+	uint64_t maxBytes_ = 0;
+	uint64_t inFlight_ = 0;
+	uint64_t peak_ = 0;
+	mutable std::mutex mutex_;
+	std::condition_variable released_;
+};
+
+MemoryBudget g_TextureMemoryBudget(1024ull * 1024ull * 1024ull);
+
+enum TextureStage
+{
+	TextureStage_Wait,
+	TextureStage_Load,
+	TextureStage_Opacity,
+	TextureStage_Resize,
+	TextureStage_Encode,
+	TextureStage_Write,
+	TextureStage_Count
+};
+
+/* Per-stage time accumulated over all the worker threads */
+struct TextureConversionStats
+{
+	std::atomic<uint64_t> microseconds_[TextureStage_Count] = {};
+	std::atomic<uint32_t> converted_ = 0;
+	std::atomic<uint32_t> cached_ = 0;
+	// saved as RGBA8 because the requested format could not be encoded
+	std::atomic<uint32_t> fallbacks_ = 0;
+
+	void add(TextureStage stage, std::chrono::steady_clock::time_point& start)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		microseconds_[stage] += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+		start = now;
+	}
+
+	void print(double wallSeconds) const
+	{
+		const char* names[TextureStage_Count] = { "wait", "load", "opacity", "resize", "encode", "write" };
+
+		printf("Textures: %u converted, %u up to date in %.2f s (peak memory in flight %.1f Mb)\n",
+			converted_.load(), cached_.load(), wallSeconds, (double)g_TextureMemoryBudget.getPeak() / (1024.0 * 1024.0));
+
+		for (int i = 0; i != TextureStage_Count; i++)
+			printf("   %-8s %8.2f s (summed over threads)\n", names[i], (double)microseconds_[i].load() * 1e-6);
+	}
+};
+
+/* Everything convertTexture() needs to know about the scene textures */
+struct TextureConversionParams
+{
+	std::string basePath;
+	std::unordered_map<std::string, uint32_t> opacityMapIndices;
+	std::vector<std::string> opacityMaps;
+	// textures with non-color data (normal maps) are not gamma-corrected when downscaled
+	std::unordered_set<std::string> linearTextures;
+	TextureOutputFormat format;
+};
+
+/* 'inputs' receives the resolved source files of the texture: the image itself and its opacity mask */
+std::string convertTexture(const std::string& file, const TextureConversionParams& params, TextureConversionStats& stats, std::vector<std::string>& inputs)
+{
+	const int maxNewWidth = g_maxTextureWidth;
+	const int maxNewHeight = g_maxTextureHeight;
+
+	const auto& basePath = params.basePath;
+	const auto& opacityMapIndices = params.opacityMapIndices;
+	const auto& opacityMaps = params.opacityMaps;
+
+	const bool isLinear = params.linearTextures.count(file) > 0;
+	const bool isKTX = params.format != TextureOutputFormat_PNG;
 
 	const auto srcFile = replaceAll(basePath + file, "\\",  "/");
-	const auto newFile = std::string("data/out_textures/") + lowercaseString(replaceAll(replaceAll(srcFile, "..", "__"), "/", "__") + std::string("__rescaled")) + std::string(".png");
+	const auto newFile = std::string("data/out_textures/") + lowercaseString(replaceAll(replaceAll(srcFile, "..", "__"), "/", "__") + std::string("__rescaled")) + std::string(getTextureOutputExtension(params.format));
+
+	const bool hasOpacityMap = opacityMapIndices.count(file) > 0;
+	const auto opacityMapFile = hasOpacityMap ? replaceAll(basePath + opacityMaps[opacityMapIndices.at(file)], "\\", "/") : std::string();
+
+	// the output depends on the texture itself, its opacity mask and the target size
+	inputs = { fixTextureFile(srcFile) };
+	if (hasOpacityMap)
+		inputs.push_back(fixTextureFile(opacityMapFile));
+
+	uint64_t seed = hashCombine(hashCombine(g_converterVersion, maxNewWidth), maxNewHeight);
+	seed = hashCombine(hashCombine(seed, params.format), isLinear ? 1 : 0);
+
+	const uint64_t key = g_Cache.hashFiles(inputs, seed);
+
+	if (g_Cache.isUpToDate(newFile, key))
+	{
+		printf("Texture [%s] is up to date\n", srcFile.c_str());
+		stats.cached_++;
+		return newFile;
+	}
+
+	// estimate the memory footprint from the image header without decoding it: RGBA source + 8-bit opacity mask + RGBA output (+ mip chain and its encoded copy)
+	int infoWidth = maxNewWidth, infoHeight = maxNewHeight, infoChannels = 0;
+	if (!stbi_info(inputs[0].c_str(), &infoWidth, &infoHeight, &infoChannels))
+	{
+		infoWidth = maxNewWidth;
+		infoHeight = maxNewHeight;
+	}
+
+	const uint64_t srcPixels = (uint64_t)infoWidth * (uint64_t)infoHeight;
+	const uint64_t dstPixels = (uint64_t)std::min(infoWidth, maxNewWidth) * (uint64_t)std::min(infoHeight, maxNewHeight);
+	const uint64_t estimatedBytes = srcPixels * 4 + (hasOpacityMap ? srcPixels : 0) + dstPixels * (isKTX ? 12 : 4);
+
+	auto start = std::chrono::steady_clock::now();
+
+	g_TextureMemoryBudget.acquire(estimatedBytes);
+
+	stats.add(TextureStage_Wait, start);
 
 	// load this image
 	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(fixTextureFile(srcFile).c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	stbi_uc* pixels = stbi_load(inputs[0].c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 	uint8_t* src = pixels;
 	texChannels = STBI_rgb_alpha;
 
-	std::vector<uint8_t> tmpImage(maxNewWidth * maxNewHeight * 4);
+	std::vector<uint8_t> tmpImage;
 
 	if (!src)
 	{
@@ -444,6 +858,7 @@ std::string convertTexture(const std::string& file, const std::string& basePath,
 		texWidth = maxNewWidth;
 		texHeight = maxNewHeight;
 		texChannels = STBI_rgb_alpha;
+		tmpImage.resize(maxNewWidth * maxNewHeight * 4);
 		src = tmpImage.data();
 	}
 	else
@@ -451,11 +866,12 @@ std::string convertTexture(const std::string& file, const std::string& basePath,
 		printf("Loaded [%s] %dx%d texture with %d channels\n", srcFile.c_str(), texWidth, texHeight, texChannels);
 	}
 
-	if (opacityMapIndices.count(file) > 0)
+	stats.add(TextureStage_Load, start);
+
+	if (hasOpacityMap)
 	{
-		const auto opacityMapFile = replaceAll(basePath + opacityMaps[opacityMapIndices[file]], "\\", "/");
 		int opacityWidth, opacityHeight;
-		stbi_uc* opacityPixels = stbi_load(fixTextureFile(opacityMapFile).c_str(), &opacityWidth, &opacityHeight, nullptr, 1);
+		stbi_uc* opacityPixels = stbi_load(inputs[1].c_str(), &opacityWidth, &opacityHeight, nullptr, 1);
 
 		if (!opacityPixels)
 		{
@@ -473,41 +889,168 @@ std::string convertTexture(const std::string& file, const std::string& basePath,
 					src[(y * opacityWidth + x) * texChannels + 3] = opacityPixels[y * opacityWidth + x];
 
 		stbi_image_free(opacityPixels);
-	}
 
-	const uint32_t imgSize = texWidth * texHeight * texChannels;
-	std::vector<uint8_t> mipData(imgSize);
-	uint8_t* dst = mipData.data();
+		stats.add(TextureStage_Opacity, start);
+	}
 
 	const int newW = std::min(texWidth, maxNewWidth);
 	const int newH = std::min(texHeight, maxNewHeight);
 
-	stbir_resize_uint8(src, texWidth, texHeight, 0, dst, newW, newH, 0, texChannels);
+	// the output buffer is only as large as the downscaled image
+	std::vector<uint8_t> mipData((size_t)newW * newH * texChannels);
+	uint8_t* dst = mipData.data();
 
-	stbi_write_png(newFile.c_str(), newW, newH, texChannels, dst, 0);
+	// PNG output keeps the original (non gamma-correct) filtering
+	if (isKTX && !isLinear)
+		stbir_resize_uint8_srgb(src, texWidth, texHeight, 0, dst, newW, newH, 0, texChannels, 3, 0);
+	else
+		stbir_resize_uint8(src, texWidth, texHeight, 0, dst, newW, newH, 0, texChannels);
 
+	// the full-resolution image is not needed anymore
 	if (pixels)
 		stbi_image_free(pixels);
 
+	stats.add(TextureStage_Resize, start);
+
+	bool isCacheable = true;
+
+	if (isKTX)
+	{
+		gli::texture2d texture;
+
+		// an uncompressed texture is better than a broken one, it is not cached so the encoding is retried by the next run
+		if (!createMipmappedTexture(dst, newW, newH, isLinear, params.format, texture))
+		{
+			printf("Failed to encode [%s], saving it as RGBA8\n", srcFile.c_str());
+			createMipmappedTexture(dst, newW, newH, isLinear, TextureOutputFormat_RGBA8, texture);
+			isCacheable = false;
+			stats.fallbacks_++;
+		}
+
+		stats.add(TextureStage_Encode, start);
+
+		gli::save_ktx(texture, newFile);
+	}
+	else
+	{
+		stbi_write_png(newFile.c_str(), newW, newH, texChannels, dst, 0);
+	}
+
+	stats.add(TextureStage_Write, start);
+
+	mipData = std::vector<uint8_t>();
+
+	g_TextureMemoryBudget.release(estimatedBytes);
+
+	stats.converted_++;
+
+	if (isCacheable)
+		g_Cache.update(newFile, key, inputs, { newFile });
+
 	return newFile;
 }
 
-void convertAndDownscaleAllTextures(
-	const std::vector<MaterialDescription>& materials, const std::string& basePath, std::vector<std::string>& files, std::vector<std::string>& opacityMaps
+/*
+	'inputFiles' receives the source files of all the textures and opacity masks.
+	Returns false if some textures were not saved in the requested format.
+*/
+bool convertAndDownscaleAllTextures(
+	tf::Subflow& subflow, const std::vector<MaterialDescription>& materials, const std::string& basePath, std::vector<std::string>& files, std::vector<std::string>& opacityMaps,
+	TextureOutputFormat format, std::vector<std::string>& inputFiles
 )
 {
-	std::unordered_map<std::string, uint32_t> opacityMapIndices(files.size());
+	TextureConversionParams params = {
+		.basePath = basePath,
+		.opacityMapIndices = std::unordered_map<std::string, uint32_t>(files.size()),
+		.opacityMaps = opacityMaps,
+		.format = format
+	};
 
 	for (const auto& m : materials)
+	{
 		if (m.opacityMap_ != 0xFFFFFFFF && m.albedoMap_ != 0xFFFFFFFF)
-			opacityMapIndices[files[m.albedoMap_]] = (uint32_t)m.opacityMap_;
+			params.opacityMapIndices[files[m.albedoMap_]] = (uint32_t)m.opacityMap_;
+		if (m.normalMap_ != 0xFFFFFFFF)
+			params.linearTextures.insert(files[m.normalMap_]);
+	}
+
+	TextureConversionStats stats;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::vector<std::string>> textureInputs(files.size());
+
+	// the textures share the worker threads (and the --jobs limit) with everything else
+	subflow.for_each_index(0u, (uint32_t)files.size(), 1u, [&](int i)
+		{
+			files[i] = convertTexture(files[i], params, stats, textureInputs[i]);
+		}
+	);
+
+	subflow.join();
+
+	for (const auto& inputs: textureInputs)
+		mergeVectors(inputFiles, inputs);
+
+	stats.print(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	return stats.fallbacks_ == 0;
+}
+
+// Assimp post-processing steps used by default. Triangulation and normals generation are always required by convertAIMesh()
+const unsigned int g_requiredAssimpFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals;
+
+/*
+	Optional steps which can be switched on and off per scene in the "assimp_flags" object, e.g. { "improve_cache_locality": false }.
+	Some of them are redundant because the converter does the same work later (vertex welding and cache optimization with meshoptimizer).
+*/
+const struct
+{
+	const char* name;
+	unsigned int flag;
+	bool enabledByDefault;
+} g_optionalAssimpSteps[] = {
+	{ "join_identical_vertices",    aiProcess_JoinIdenticalVertices,    true },
+	{ "limit_bone_weights",         aiProcess_LimitBoneWeights,         true },
+	{ "split_large_meshes",         aiProcess_SplitLargeMeshes,         true },
+	{ "improve_cache_locality",     aiProcess_ImproveCacheLocality,     true },
+	{ "remove_redundant_materials", aiProcess_RemoveRedundantMaterials, true },
+	{ "find_degenerates",           aiProcess_FindDegenerates,          true },
+	{ "find_invalid_data",          aiProcess_FindInvalidData,          true },
+	{ "gen_uv_coords",              aiProcess_GenUVCoords,              true },
+};
 
-	auto converter = [&](const std::string& s) -> std::string
+unsigned int parseAssimpFlags(const rapidjson::Value& sceneDesc)
+{
+	unsigned int flags = g_requiredAssimpFlags;
+
+	for (const auto& step: g_optionalAssimpSteps)
+		if (step.enabledByDefault)
+			flags |= step.flag;
+
+	if (!sceneDesc.HasMember("assimp_flags"))
+		return flags;
+
+	const rapidjson::Value& switches = sceneDesc["assimp_flags"];
+
+	for (auto i = switches.MemberBegin(); i != switches.MemberEnd(); i++)
 	{
-		return convertTexture(s, basePath, opacityMapIndices, opacityMaps);
-	};
+		const auto step = std::find_if(std::begin(g_optionalAssimpSteps), std::end(g_optionalAssimpSteps),
+			[&i](const auto& s) { return !strcmp(s.name, i->name.GetString()); });
+
+		if (step == std::end(g_optionalAssimpSteps))
+		{
+			printf("Unknown Assimp post-processing step '%s' ignored\n", i->name.GetString());
+			continue;
+		}
 
-	std::transform(std::execution::par, std::begin(files), std::end(files), std::begin(files), converter);
+		if (i->value.GetBool())
+			flags |= step->flag;
+		else
+			flags &= ~step->flag;
+	}
+
+	return flags;
 }
 
 std::vector<SceneConfig> readConfigFile(const char* cfgFileName)
@@ -537,43 +1080,96 @@ std::vector<SceneConfig> readConfigFile(const char* cfgFileName)
 			.outputMaterials = document[i]["output_materials"].GetString(),
 			.scale = (float)document[i]["scale"].GetDouble(),
 			.calculateLODs = document[i]["calculate_LODs"].GetBool(),
-			.mergeInstances = document[i]["merge_instances"].GetBool()
+			.mergeInstances = document[i]["merge_instances"].GetBool(),
+			// optional: "png" (default), "rgba8", "bc3" or "etc2"
+			.textureFormat = document[i].HasMember("texture_format") ? parseTextureOutputFormat(document[i]["texture_format"].GetString()) : TextureOutputFormat_PNG,
+			// optional: a separate compact vertex range for every LOD
+			.compactLODs = document[i].HasMember("compact_LODs") && document[i]["compact_LODs"].GetBool(),
+			.assimpFlags = parseAssimpFlags(document[i])
 		});
 	}
 
 	return configList;
 }
 
-void processScene(const SceneConfig& cfg)
+/* The scene file itself and the files next to it with the same name (.mtl for .obj, .bin for .gltf) */
+std::vector<std::string> getSceneInputFiles(const std::string& fileName)
+{
+	std::vector<std::string> inputs = { fileName };
+
+	const fs::path scenePath(fileName);
+	const fs::path dir = scenePath.has_parent_path() ? scenePath.parent_path() : fs::path(".");
+
+	std::error_code ec;
+	for (const auto& p: fs::directory_iterator(dir, ec))
+		if (p.path().stem() == scenePath.stem() && p.path().filename() != scenePath.filename())
+			inputs.push_back(p.path().string());
+
+	// directory iteration order is unspecified
+	std::sort(inputs.begin() + 1, inputs.end());
+
+	return inputs;
+}
+
+/* The scene files followed by the texture source files (sorted, without duplicates and without the scene files) */
+std::vector<std::string> getAllSceneInputFiles(const std::vector<std::string>& sceneFiles, std::vector<std::string> textureFiles)
 {
-	// clear mesh data from previous scene
-	g_MeshData.meshes_.clear();
-	g_MeshData.boxes_.clear();
-	g_MeshData.indexData_.clear();
-	g_MeshData.vertexData_.clear();
+	std::sort(textureFiles.begin(), textureFiles.end());
+	textureFiles.erase(std::unique(textureFiles.begin(), textureFiles.end()), textureFiles.end());
 
-	g_indexOffset = 0;
-	g_vertexOffset = 0;
+	std::vector<std::string> inputs = sceneFiles;
+
+	for (const auto& f: textureFiles)
+		if (std::find(sceneFiles.begin(), sceneFiles.end(), f) == sceneFiles.end())
+			inputs.push_back(f);
+
+	return inputs;
+}
+
+uint64_t getSceneKey(const SceneConfig& cfg, const std::vector<std::string>& inputs)
+{
+	uint64_t seed = g_converterVersion;
+	seed = hashBytes(&cfg.scale, sizeof(cfg.scale), seed);
+	seed = hashCombine(seed, cfg.calculateLODs ? 1 : 0);
+	seed = hashCombine(seed, cfg.mergeInstances ? 1 : 0);
+	seed = hashCombine(seed, cfg.textureFormat);
+	seed = hashCombine(seed, cfg.compactLODs ? 1 : 0);
+	seed = hashCombine(seed, cfg.assimpFlags);
+	seed = hashCombine(seed, g_maxTextureWidth);
+	seed = hashCombine(seed, g_maxTextureHeight);
+
+	return g_Cache.hashFiles(inputs, seed);
+}
+
+/*
+	Convert a single scene. The meshes, the materials with their textures and the scene hierarchy do not depend on each other
+	and are converted concurrently as subtasks of this scene's task.
+*/
+void processScene(tf::Subflow& subflow, const SceneConfig& cfg, ConvertedScene& out, SceneConversionStats& stats)
+{
+	const std::vector<std::string> sceneFiles = getSceneInputFiles(cfg.fileName);
+
+	// the texture files are known only after the import, so the ones recorded by the last conversion are checked
+	const uint64_t sceneKey = getSceneKey(cfg, getAllSceneInputFiles(sceneFiles, g_Cache.getInputs(cfg.outputScene)));
+
+	stats.fileName_ = cfg.fileName;
+
+	if (g_Cache.isUpToDate(cfg.outputScene, sceneKey))
+	{
+		printf("Scene '%s' is up to date, skipping\n", cfg.fileName.c_str());
+		stats.skipped_ = true;
+		return;
+	}
 
 	// extract base model path
 	const std::size_t pathSeparator = cfg.fileName.find_last_of("/\\");
 	const std::string basePath = (pathSeparator != std::string::npos) ? cfg.fileName.substr(0, pathSeparator + 1) : std::string();
 
-	const unsigned int flags = 0 |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_Triangulate |
-		aiProcess_GenSmoothNormals |
-		aiProcess_LimitBoneWeights |
-		aiProcess_SplitLargeMeshes |
-		aiProcess_ImproveCacheLocality |
-		aiProcess_RemoveRedundantMaterials |
-		aiProcess_FindDegenerates |
-		aiProcess_FindInvalidData |
-		aiProcess_GenUVCoords;
-
 	printf("Loading scene from '%s'...\n", cfg.fileName.c_str());
 
-	const aiScene* scene = aiImportFile(cfg.fileName.c_str(), flags);
+	auto start = std::chrono::steady_clock::now();
+
+	const aiScene* scene = aiImportFile(cfg.fileName.c_str(), cfg.assimpFlags);
 
 	if (!scene || !scene->HasMeshes())
 	{
@@ -581,88 +1177,134 @@ void processScene(const SceneConfig& cfg)
 		exit(EXIT_FAILURE);
 	}
 
-	// 1. Mesh conversion as in Chapter 5
-	g_MeshData.meshes_.reserve(scene->mNumMeshes);
-	g_MeshData.boxes_.reserve(scene->mNumMeshes);
+	stats.add(SceneStage_Import, start);
 
-	for (unsigned int i = 0; i != scene->mNumMeshes; i++)
-	{
-		printf("\nConverting meshes %u/%u...", i + 1, scene->mNumMeshes);
-		Mesh mesh = convertAIMesh(scene->mMeshes[i], cfg);
-		g_MeshData.meshes_.push_back(mesh);
-	}
+	// 1. Mesh conversion as in Chapter 5: every mesh is converted independently on a task pool and then concatenated
+	subflow.emplace([&](tf::Subflow& sf) { convertAllMeshes(sf, scene, cfg, out.meshData, stats); }).name("meshes");
 
-	recalculateBoundingBoxes(g_MeshData);
+	// 2. Material conversion, 3. Texture processing, rescaling and packing
+	std::vector<std::string> textureInputs;
+	bool texturesComplete = true;
 
-	saveMeshData(cfg.outputMesh.c_str(), g_MeshData);
+	subflow.emplace([&](tf::Subflow& sf)
+		{
+			auto materialsStart = std::chrono::steady_clock::now();
 
-	Scene ourScene;
+			// only materialNames_ is written here, traverse() below never touches it
+			std::vector<std::string>& materialNames = out.scene.materialNames_;
 
-	// 2. Material conversion
-	std::vector<MaterialDescription> materials;
-	std::vector<std::string>& materialNames = ourScene.materialNames_;
+			std::vector<std::string> opacityMaps;
 
-	std::vector<std::string> files;
-	std::vector<std::string> opacityMaps;
+			for (unsigned int m = 0 ; m < scene->mNumMaterials ; m++)
+			{
+				aiMaterial* mm = scene->mMaterials[m];
 
-	for (unsigned int m = 0 ; m < scene->mNumMaterials ; m++)
-	{
-		aiMaterial* mm = scene->mMaterials[m];
+				printf("Material [%s] %u\n", mm->GetName().C_Str(), m);
+				materialNames.push_back(std::string(mm->GetName().C_Str()));
 
-		printf("Material [%s] %u\n", mm->GetName().C_Str(), m);
-		materialNames.push_back(std::string(mm->GetName().C_Str()));
+				MaterialDescription D = convertAIMaterialToDescription(mm, out.textureFiles, opacityMaps);
+				out.materials.push_back(D);
+				//dumpMaterial(out.textureFiles, D);
+			}
 
-		MaterialDescription D = convertAIMaterialToDescription(mm, files, opacityMaps);
-		materials.push_back(D);
-		//dumpMaterial(files, D);
-	}
+			stats.add(SceneStage_Materials, materialsStart);
 
-	// 3. Texture processing, rescaling and packing
-	convertAndDownscaleAllTextures(materials, basePath, files, opacityMaps);
+			texturesComplete = convertAndDownscaleAllTextures(sf, out.materials, basePath, out.textureFiles, opacityMaps, cfg.textureFormat, textureInputs);
 
-	saveMaterials(cfg.outputMaterials.c_str(), materials, files);
+			stats.add(SceneStage_Textures, materialsStart);
+
+			saveMaterials(cfg.outputMaterials.c_str(), out.materials, out.textureFiles);
+
+			stats.add(SceneStage_Save, materialsStart);
+		}
+	).name("materials");
 
 	// 4. Scene hierarchy conversion
-	traverse(scene, ourScene, scene->mRootNode, -1, 0);
+	subflow.emplace([&]()
+		{
+			auto hierarchyStart = std::chrono::steady_clock::now();
+			traverse(scene, out.scene, scene->mRootNode, -1, 0);
+			stats.add(SceneStage_Hierarchy, hierarchyStart);
+		}
+	).name("hierarchy");
+
+	subflow.join();
+
+	aiReleaseImport(scene);
+
+	start = std::chrono::steady_clock::now();
+
+	saveScene(cfg.outputScene.c_str(), out.scene);
+
+	stats.add(SceneStage_Save, start);
+
+	std::vector<std::string> outputs = { cfg.outputMesh, cfg.outputScene, cfg.outputMaterials };
+	mergeVectors(outputs, out.textureFiles);
+
+	const std::vector<std::string> inputs = getAllSceneInputFiles(sceneFiles, textureInputs);
+
+	// the scene is converted again by the next run to retry the textures which fell back to RGBA8
+	if (texturesComplete)
+		g_Cache.update(cfg.outputScene, getSceneKey(cfg, inputs), inputs, outputs);
+
+	out.isConverted = true;
+}
+
+/* Reload the output files of a scene which was not converted in this run */
+void loadConvertedScene(const SceneConfig& cfg, ConvertedScene& s)
+{
+	if (s.isConverted)
+		return;
 
-	saveScene(cfg.outputScene.c_str(), ourScene);
+	loadMeshData(cfg.outputMesh.c_str(), s.meshData);
+	loadScene(cfg.outputScene.c_str(), s.scene);
+	loadMaterials(cfg.outputMaterials.c_str(), s.materials, s.textureFiles);
 }
 
-/** Chapter9: Merge meshes (interior/exterior) */
-void mergeBistro()
+const char* g_bistroExteriorScene = "data/meshes/test.scene";
+const char* g_bistroInteriorScene = "data/meshes/test2.scene";
+
+/** Chapter9: Merge meshes (interior/exterior). The inputs come straight from processScene() whenever possible */
+void mergeBistro(const SceneConfig& cfg1, ConvertedScene& s1, const SceneConfig& cfg2, ConvertedScene& s2)
 {
-	Scene scene1, scene2;
-	std::vector<Scene*> scenes = { &scene1, &scene2 };
+	const std::vector<std::string> inputs = {
+		cfg1.outputMesh, cfg1.outputScene, cfg1.outputMaterials,
+		cfg2.outputMesh, cfg2.outputScene, cfg2.outputMaterials
+	};
+	const std::vector<std::string> outputs = {
+		"data/meshes/bistro_all.meshes", "data/meshes/bistro_all.scene", "data/meshes/bistro_all.materials"
+	};
+
+	const uint64_t key = g_Cache.hashFiles(inputs, g_converterVersion);
+
+	if (g_Cache.isUpToDate(outputs[1], key))
+	{
+		printf("Merged Bistro scene is up to date, skipping\n");
+		return;
+	}
 
-	MeshData m1, m2;
-	MeshFileHeader header1 = loadMeshData("data/meshes/test.meshes", m1);
-	MeshFileHeader header2 = loadMeshData("data/meshes/test2.meshes", m2);
+	loadConvertedScene(cfg1, s1);
+	loadConvertedScene(cfg2, s2);
 
-	std::vector<uint32_t> meshCounts = { header1.meshCount, header2.meshCount };
+	std::vector<Scene*> scenes = { &s1.scene, &s2.scene };
 
-	loadScene("data/meshes/test.scene", scene1);
-	loadScene("data/meshes/test2.scene", scene2);
+	std::vector<uint32_t> meshCounts = { (uint32_t)s1.meshData.meshes_.size(), (uint32_t)s2.meshData.meshes_.size() };
 
 	Scene scene;
 	mergeScenes(scene, scenes, {}, meshCounts);
 
 	MeshData meshData;
-	std::vector<MeshData*> meshDatas = { &m1, &m2 };
+	std::vector<MeshData*> meshDatas = { &s1.meshData, &s2.meshData };
 
-	MeshFileHeader header = mergeMeshData(meshData, meshDatas);
+	mergeMeshData(meshData, meshDatas);
 
 	// now the material lists:
-	std::vector<MaterialDescription> materials1, materials2;
-	std::vector<std::string> textureFiles1, textureFiles2;
-	loadMaterials("data/meshes/test.materials", materials1, textureFiles1);
-	loadMaterials("data/meshes/test2.materials", materials2, textureFiles2);
-
 	std::vector<MaterialDescription> allMaterials;
 	std::vector<std::string> allTextures;
 
 	mergeMaterialLists(
-		{ &materials1, &materials2 },
-		{ &textureFiles1, &textureFiles2 },
+		{ &s1.materials, &s2.materials },
+		{ &s1.textureFiles, &s2.textureFiles },
 		allMaterials, allTextures);
 
 	saveMaterials("data/meshes/bistro_all.materials", allMaterials, allTextures);
@@ -679,19 +1321,91 @@ void mergeBistro()
 
 	saveMeshData("data/meshes/bistro_all.meshes", meshData);
 	saveScene("data/meshes/bistro_all.scene", scene);
+
+	g_Cache.update(outputs[1], key, inputs, outputs);
 }
 
-int main()
+int main(int argc, char** argv)
 {
 	fs::create_directory("data/out_textures");
 
+	// "--force" reconverts everything regardless of the cache contents
+	// "--texture-memory-mb N" limits the amount of decoded texture data in flight
+	// "--jobs N" limits the number of worker threads (all the scenes, meshes and textures share them)
+	// "--report file.json" sets the file for the per-stage timing report
+	unsigned int numJobs = std::max(std::thread::hardware_concurrency(), 1u);
+	const char* reportFile = "data/meshes/sceneconverter_report.json";
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--force"))
+			g_Cache.setForceRebuild(true);
+		else if (!strcmp(argv[i], "--texture-memory-mb") && i + 1 < argc)
+			g_TextureMemoryBudget.setLimit((uint64_t)atoi(argv[++i]) * 1024ull * 1024ull);
+		else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+			numJobs = (unsigned int)std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "--report") && i + 1 < argc)
+			reportFile = argv[++i];
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	g_Cache.load();
+
 	const auto configs = readConfigFile("data/sceneconverter.json");
 
-	for (const auto& cfg: configs)
-		processScene(cfg);
+	// the Bistro parts consumed by the merge step (the results of all the other scenes are released as soon as they are saved)
+	int exteriorIdx = -1;
+	int interiorIdx = -1;
+
+	for (int i = 0; i != (int)configs.size(); i++)
+	{
+		if (configs[i].outputScene == g_bistroExteriorScene) exteriorIdx = i;
+		if (configs[i].outputScene == g_bistroInteriorScene) interiorIdx = i;
+	}
+
+	std::vector<ConvertedScene> convertedScenes(configs.size());
+	std::vector<SceneConversionStats> sceneStats(configs.size());
+	double mergeSeconds = 0.0;
+
+	tf::Executor executor(numJobs);
+	tf::Taskflow taskflow;
+
+	std::vector<tf::Task> sceneTasks(configs.size());
+
+	for (int i = 0; i != (int)configs.size(); i++)
+	{
+		sceneTasks[i] = taskflow.emplace([&, i](tf::Subflow& subflow)
+			{
+				processScene(subflow, configs[i], convertedScenes[i], sceneStats[i]);
+
+				if (i != exteriorIdx && i != interiorIdx)
+					convertedScenes[i] = ConvertedScene();
+			}
+		).name(configs[i].fileName);
+	}
+
+	// Final step: optimize bistro scene as soon as both of its parts are ready
+	if (exteriorIdx >= 0 && interiorIdx >= 0)
+	{
+		tf::Task merge = taskflow.emplace([&]()
+			{
+				const auto mergeStart = std::chrono::steady_clock::now();
+				mergeBistro(configs[exteriorIdx], convertedScenes[exteriorIdx], configs[interiorIdx], convertedScenes[interiorIdx]);
+				mergeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mergeStart).count();
+			}
+		).name("mergeBistro");
+
+		merge.succeed(sceneTasks[exteriorIdx], sceneTasks[interiorIdx]);
+	}
+
+	printf("Converting %u scenes using %u threads\n", (unsigned)configs.size(), numJobs);
+
+	executor.run(taskflow).wait();
+
+	g_Cache.save();
 
-	// Final step: optimize bistro scene
-	mergeBistro();
+	saveConversionReport(reportFile, sceneStats, mergeSeconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
 
 	return 0;
 }
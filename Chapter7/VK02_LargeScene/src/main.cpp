@@ -2,6 +2,25 @@
 #include "shared/vkFramework/GuiRenderer.h"
 #include "shared/vkFramework/MultiRenderer.h"
 
+#include <imgui/imgui.h>
+
+#include <taskflow/taskflow.hpp>
+
+// world-space boxes of the shapes in the order of sceneData.shapes_
+BoundingBoxSoA getShapeBoxes(const VKSceneData& sceneData)
+{
+	BoundingBoxSoA boxes;
+	boxes.resize(sceneData.shapes_.size());
+
+	for (size_t i = 0; i != sceneData.shapes_.size(); i++)
+	{
+		const DrawData& d = sceneData.shapes_[i];
+		boxes.set(i, sceneData.meshData_.boxes_[d.meshIndex].getTransformed(sceneData.scene_.globalTransform_[d.transformIndex]));
+	}
+
+	return boxes;
+}
+
 struct MyApp: public CameraApp
 {
 	MyApp()
@@ -13,12 +32,30 @@ struct MyApp: public CameraApp
 	, multiRenderer(ctx_, sceneData)
 	, multiRenderer2(ctx_, sceneData2)
 	, imgui(ctx_)
+	, shapeBoxes(getShapeBoxes(sceneData))
+	, shapeBoxes2(getShapeBoxes(sceneData2))
 	{
 		positioner = CameraPositioner_FirstPerson(glm::vec3(-10.0f, -3.0f, 3.0f), glm::vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
 
 		onScreenRenderers_.emplace_back(multiRenderer);
 		onScreenRenderers_.emplace_back(multiRenderer2);
 		onScreenRenderers_.emplace_back(imgui, false);
+
+		setFrustumCulling(true);
+	}
+
+	void setFrustumCulling(bool enable)
+	{
+		// both scenes are culled one after another on the same worker threads
+		multiRenderer.setFrustumCulling(enable ? &executor : nullptr, &shapeBoxes);
+		multiRenderer2.setFrustumCulling(enable ? &executor : nullptr, &shapeBoxes2);
+	}
+
+	void drawUI() override {
+		ImGui::Begin("Control", nullptr);
+		if (ImGui::Checkbox("Frustum culling", &enableFrustumCulling))
+			setFrustumCulling(enableFrustumCulling);
+		ImGui::End();
 	}
 
 	void draw3D() override {
@@ -32,6 +69,8 @@ struct MyApp: public CameraApp
 		multiRenderer2.setCameraPosition(positioner.getPosition());
 	}
 private:
+	tf::Executor executor;
+
 	VulkanTexture envMap;
 	VulkanTexture irrMap;
 
@@ -41,6 +80,11 @@ private:
 	MultiRenderer multiRenderer;
 	MultiRenderer multiRenderer2;
 	GuiRenderer imgui;
+
+	BoundingBoxSoA shapeBoxes;
+	BoundingBoxSoA shapeBoxes2;
+
+	bool enableFrustumCulling = true;
 };
 
 int main()
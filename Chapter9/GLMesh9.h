@@ -1,6 +1,6 @@
 #pragma once
 
-#include <functional>
+#include "shared/DrawSortKeys.h"
 
 const GLuint kBufferIndex_PerFrameUniforms = 0;
 const GLuint kBufferIndex_ModelMatrices = 1;
@@ -29,7 +29,8 @@ public:
 		glNamedBufferSubData(bufferIndirect_.getHandle(), 0, sizeof(DrawElementsIndirectCommand) * drawCommands_.size(), drawCommands_.data());
 	}
 
-	void selectTo(GLIndirectBuffer& buf, const std::function<bool(const DrawElementsIndirectCommand&)>& pred)
+	template <typename PredT>
+	void selectTo(GLIndirectBuffer& buf, PredT pred)
 	{
 		buf.drawCommands_.clear();
 		for (const auto& c : drawCommands_)
@@ -40,10 +41,43 @@ public:
 		buf.uploadIndirectBuffer();
 	}
 
+	/*
+		Copy the commands matching 'pred' to 'buf' in the order of the keys returned by 'sortKey(command)' (see DrawSortKeys.h).
+		The keys do not need the index bits, they are added here. If there are more than kMaxSortKeyIndex + 1 commands,
+		their indices do not fit into the keys and the commands are copied unsorted by selectTo().
+	*/
+	template <typename PredT, typename SortKeyT>
+	void selectSortedTo(GLIndirectBuffer& buf, PredT pred, SortKeyT sortKey)
+	{
+		if (drawCommands_.size() > kMaxSortKeyIndex + 1)
+		{
+			selectTo(buf, pred);
+			return;
+		}
+
+		buf.sortKeys_.clear();
+		for (uint32_t i = 0; i != (uint32_t)drawCommands_.size(); i++)
+		{
+			if (pred(drawCommands_[i]))
+				buf.sortKeys_.push_back(sortKey(drawCommands_[i]) | i);
+		}
+
+		sortDrawKeys(buf.sortKeys_, buf.sortTemp_);
+
+		buf.drawCommands_.resize(buf.sortKeys_.size());
+		for (size_t i = 0; i != buf.sortKeys_.size(); i++)
+			buf.drawCommands_[i] = drawCommands_[getSortKeyIndex(buf.sortKeys_[i])];
+
+		buf.uploadIndirectBuffer();
+	}
+
 	std::vector<DrawElementsIndirectCommand> drawCommands_;
 
 private:
 	GLBuffer bufferIndirect_;
+
+	std::vector<uint64_t> sortKeys_;
+	std::vector<uint64_t> sortTemp_;
 };
 
 template <typename GLSceneDataType>
@@ -102,12 +136,18 @@ public:
 	}
 
 	void draw(size_t numDrawCommands, const GLIndirectBuffer* buffer = nullptr) const
+	{
+		draw(numDrawCommands, (buffer ? *buffer : bufferIndirect_).getHandle(), 0);
+	}
+
+	/* Draw the commands stored at 'offset' of any buffer, e.g. an allocation of UploadRing */
+	void draw(size_t numDrawCommands, GLuint indirectBuffer, size_t offset) const
 	{
 		glBindVertexArray(vao_);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kBufferIndex_Materials, bufferMaterials_.getHandle());
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kBufferIndex_ModelMatrices, bufferModelMatrices_.getHandle());
-		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, (buffer ? *buffer : bufferIndirect_).getHandle());
-		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, (GLsizei)numDrawCommands, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)offset, (GLsizei)numDrawCommands, 0);
 	}
 
 	~GLMesh()
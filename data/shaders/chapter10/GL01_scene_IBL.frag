@@ -47,7 +47,8 @@ float shadowFactor(vec4 shadowCoord)
 
 	vec4 shadowCoords4 = shadowCoord / shadowCoord.w;
 
-	if (shadowCoords4.z > -1.0 && shadowCoords4.z < 1.0)
+	// the shadow map may cover only a part of the view
+	if (shadowCoords4.z > -1.0 && shadowCoords4.z < 1.0 && all(greaterThanEqual(shadowCoords4.xy, vec2(0.0))) && all(lessThanEqual(shadowCoords4.xy, vec2(1.0))))
 	{
 		float depthBias = -0.001;
 		float shadowSample = PCF( 13, shadowCoords4.xy, shadowCoords4.z + depthBias );
@@ -0,0 +1,332 @@
+#include "shared/Bitmap.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define BITMAP_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
+namespace
+{
+	// the conversions to/from vec4 go through a small buffer on the stack
+	constexpr size_t kChunkPixels = 256;
+}
+
+void convertUnsignedByteToFloat(const uint8_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(BITMAP_USE_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(255.0f);
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+		const __m128i lo = _mm_unpacklo_epi8(b, zero);
+		const __m128i hi = _mm_unpackhi_epi8(b, zero);
+		// division instead of a multiplication by 1/255 gives the same results as the scalar code
+		_mm_storeu_ps(dst + i +  0, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i +  4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i +  8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+#endif
+
+	for (; i != count; i++)
+		dst[i] = float(src[i]) / 255.0f;
+}
+
+void convertFloatToUnsignedByte(const float* src, uint8_t* dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(BITMAP_USE_SSE)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+
+	auto convert4 = [&](const float* p)
+	{
+		// max() returns its second operand for NaNs
+		const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p), zero), one);
+		return _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+	};
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i lo = _mm_packs_epi32(convert4(src + i + 0), convert4(src + i + 4));
+		const __m128i hi = _mm_packs_epi32(convert4(src + i + 8), convert4(src + i + 12));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for (; i != count; i++)
+		dst[i] = floatToUnsignedByte(src[i]);
+}
+
+void convertRGBToRGBA(const float* src, float* dst, size_t numPixels, float alpha)
+{
+	if (!numPixels)
+		return;
+
+	size_t i = 0;
+
+#if defined(BITMAP_USE_SSE)
+	const __m128 rgbMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 a = _mm_set_ps(alpha, 0.0f, 0.0f, 0.0f);
+
+	// every load reads the red component of the next pixel, so the last pixel is done separately
+	for (; i + 1 < numPixels; i++)
+		_mm_storeu_ps(dst + 4 * i, _mm_or_ps(_mm_and_ps(_mm_loadu_ps(src + 3 * i), rgbMask), a));
+#endif
+
+	for (; i != numPixels; i++)
+	{
+		dst[4 * i + 0] = src[3 * i + 0];
+		dst[4 * i + 1] = src[3 * i + 1];
+		dst[4 * i + 2] = src[3 * i + 2];
+		dst[4 * i + 3] = alpha;
+	}
+}
+
+void convertRGBToRGBA(const uint8_t* src, uint8_t* dst, size_t numPixels, uint8_t alpha)
+{
+	if (!numPixels)
+		return;
+
+	size_t i = 0;
+
+	if constexpr (std::endian::native == std::endian::little)
+	{
+		const uint32_t a = uint32_t(alpha) << 24;
+
+		// 4 bytes at once, the extra byte read from the next pixel is replaced by alpha
+		for (; i + 1 < numPixels; i++)
+		{
+			uint32_t p;
+			memcpy(&p, src + 3 * i, sizeof(p));
+			p = (p & 0x00FFFFFFu) | a;
+			memcpy(dst + 4 * i, &p, sizeof(p));
+		}
+	}
+
+	for (; i != numPixels; i++)
+	{
+		dst[4 * i + 0] = src[3 * i + 0];
+		dst[4 * i + 1] = src[3 * i + 1];
+		dst[4 * i + 2] = src[3 * i + 2];
+		dst[4 * i + 3] = alpha;
+	}
+}
+
+void convertRGBAToRGB(const float* src, float* dst, size_t numPixels)
+{
+	if (!numPixels)
+		return;
+
+	size_t i = 0;
+
+#if defined(BITMAP_USE_SSE)
+	// every store writes one float too many, it is overwritten by the next pixel
+	for (; i + 1 < numPixels; i++)
+		_mm_storeu_ps(dst + 3 * i, _mm_loadu_ps(src + 4 * i));
+#endif
+
+	for (; i != numPixels; i++)
+	{
+		dst[3 * i + 0] = src[4 * i + 0];
+		dst[3 * i + 1] = src[4 * i + 1];
+		dst[3 * i + 2] = src[4 * i + 2];
+	}
+}
+
+void convertRGBAToRGB(const uint8_t* src, uint8_t* dst, size_t numPixels)
+{
+	if (!numPixels)
+		return;
+
+	size_t i = 0;
+
+	// 4 bytes at once, the extra byte is overwritten by the next pixel
+	for (; i + 1 < numPixels; i++)
+		memcpy(dst + 3 * i, src + 4 * i, 4);
+
+	dst[3 * i + 0] = src[4 * i + 0];
+	dst[3 * i + 1] = src[4 * i + 1];
+	dst[3 * i + 2] = src[4 * i + 2];
+}
+
+void convertPixelsToVec4(const void* src, eBitmapFormat fmt, int comp, glm::vec4* dst, size_t numPixels)
+{
+	float* out = (float*)dst;
+
+	if (fmt == eBitmapFormat_Float)
+	{
+		const float* in = (const float*)src;
+
+		if (comp == 4)
+			memcpy(out, in, numPixels * sizeof(glm::vec4));
+		else if (comp == 3)
+			convertRGBToRGBA(in, out, numPixels, 0.0f);
+		else
+			for (size_t i = 0; i != numPixels; i++)
+				for (int c = 0; c != 4; c++)
+					out[4 * i + c] = c < comp ? in[comp * i + c] : 0.0f;
+		return;
+	}
+
+	const uint8_t* in = (const uint8_t*)src;
+
+	if (comp == 4)
+	{
+		convertUnsignedByteToFloat(in, out, 4 * numPixels);
+		return;
+	}
+
+	uint8_t rgba[4 * kChunkPixels];
+
+	for (size_t first = 0; first < numPixels; first += kChunkPixels)
+	{
+		const size_t n = std::min(kChunkPixels, numPixels - first);
+
+		if (comp == 3)
+			convertRGBToRGBA(in + 3 * first, rgba, n, 0);
+		else
+			for (size_t i = 0; i != n; i++)
+				for (int c = 0; c != 4; c++)
+					rgba[4 * i + c] = c < comp ? in[comp * (first + i) + c] : 0;
+
+		convertUnsignedByteToFloat(rgba, out + 4 * first, 4 * n);
+	}
+}
+
+void convertVec4ToPixels(const glm::vec4* src, eBitmapFormat fmt, int comp, void* dst, size_t numPixels)
+{
+	const float* in = (const float*)src;
+
+	if (fmt == eBitmapFormat_Float)
+	{
+		float* out = (float*)dst;
+
+		if (comp == 4)
+			memcpy(out, in, numPixels * sizeof(glm::vec4));
+		else if (comp == 3)
+			convertRGBAToRGB(in, out, numPixels);
+		else
+			for (size_t i = 0; i != numPixels; i++)
+				for (int c = 0; c != comp; c++)
+					out[comp * i + c] = in[4 * i + c];
+		return;
+	}
+
+	uint8_t* out = (uint8_t*)dst;
+
+	if (comp == 4)
+	{
+		convertFloatToUnsignedByte(in, out, 4 * numPixels);
+		return;
+	}
+
+	uint8_t rgba[4 * kChunkPixels];
+
+	for (size_t first = 0; first < numPixels; first += kChunkPixels)
+	{
+		const size_t n = std::min(kChunkPixels, numPixels - first);
+
+		convertFloatToUnsignedByte(in + 4 * first, rgba, 4 * n);
+
+		if (comp == 3)
+			convertRGBAToRGB(rgba, out + 3 * first, n);
+		else
+			for (size_t i = 0; i != n; i++)
+				for (int c = 0; c != comp; c++)
+					out[comp * (first + i) + c] = rgba[4 * i + c];
+	}
+}
+
+void Bitmap::getPixels(int x, int y, int count, glm::vec4* pixels) const
+{
+	convertPixelsToVec4(getPixelData(x, y), fmt_, comp_, pixels, count);
+}
+
+void Bitmap::setPixels(int x, int y, int count, const glm::vec4* pixels)
+{
+	convertVec4ToPixels(pixels, fmt_, comp_, getPixelData(x, y), count);
+}
+
+void Bitmap::getRegion(int x, int y, int w, int h, glm::vec4* pixels) const
+{
+	for (int j = 0; j != h; j++)
+		getPixels(x, y + j, w, pixels + size_t(j) * w);
+}
+
+void Bitmap::setRegion(int x, int y, int w, int h, const glm::vec4* pixels)
+{
+	for (int j = 0; j != h; j++)
+		setPixels(x, y + j, w, pixels + size_t(j) * w);
+}
+
+Bitmap convertBitmap(const Bitmap& b, int comp, eBitmapFormat fmt)
+{
+	Bitmap result(b.w_, b.h_, b.d_, comp, fmt);
+	result.type_ = b.type_;
+
+	const size_t numPixels = size_t(b.w_) * b.h_ * b.d_;
+
+	if (b.comp_ == comp && b.fmt_ == fmt)
+	{
+		result.data_ = b.data_;
+		return result;
+	}
+
+	if (b.comp_ == comp)
+	{
+		if (fmt == eBitmapFormat_Float)
+			convertUnsignedByteToFloat(b.data_.data(), (float*)result.data_.data(), numPixels * comp);
+		else
+			convertFloatToUnsignedByte((const float*)b.data_.data(), result.data_.data(), numPixels * comp);
+		return result;
+	}
+
+	if (b.fmt_ == fmt && b.comp_ == 3 && comp == 4)
+	{
+		if (fmt == eBitmapFormat_Float)
+			convertRGBToRGBA((const float*)b.data_.data(), (float*)result.data_.data(), numPixels);
+		else
+			convertRGBToRGBA(b.data_.data(), result.data_.data(), numPixels);
+		return result;
+	}
+
+	if (b.fmt_ == fmt && b.comp_ == 4 && comp == 3)
+	{
+		if (fmt == eBitmapFormat_Float)
+			convertRGBAToRGB((const float*)b.data_.data(), (float*)result.data_.data(), numPixels);
+		else
+			convertRGBAToRGB(b.data_.data(), result.data_.data(), numPixels);
+		return result;
+	}
+
+	// everything else goes through vec4
+	glm::vec4 pixels[kChunkPixels];
+
+	const uint8_t* src = b.data_.data();
+	uint8_t* dst = result.data_.data();
+
+	for (size_t first = 0; first < numPixels; first += kChunkPixels)
+	{
+		const size_t n = std::min(kChunkPixels, numPixels - first);
+
+		convertPixelsToVec4(src + first * b.getBytesPerPixel(), b.fmt_, b.comp_, pixels, n);
+
+		if (b.comp_ < 4 && comp == 4)
+			for (size_t i = 0; i != n; i++)
+				pixels[i].w = 1.0f;
+
+		convertVec4ToPixels(pixels, fmt, comp, dst + first * result.getBytesPerPixel(), n);
+	}
+
+	return result;
+}
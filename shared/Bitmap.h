@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include <stdint.h>
 #include <string.h>
 #include <vector>
 
@@ -17,6 +18,14 @@ enum eBitmapFormat
 	eBitmapFormat_Float,
 };
 
+/* Clamp to [0, 1], multiply by 255 and truncate, NaNs become 0 */
+inline uint8_t floatToUnsignedByte(float v)
+{
+	v = v > 0.0f ? v : 0.0f;
+	v = v < 1.0f ? v : 1.0f;
+	return uint8_t(v * 255.0f);
+}
+
 /// R/RG/RGB/RGBA bitmaps
 struct Bitmap
 {
@@ -54,6 +63,11 @@ struct Bitmap
 		return 0;
 	}
 
+	int getBytesPerPixel() const { return comp_ * getBytesPerComponent(fmt_); }
+
+	uint8_t* getPixelData(int x, int y, int z = 0) { return data_.data() + ((size_t(z) * h_ + y) * w_ + x) * getBytesPerPixel(); }
+	const uint8_t* getPixelData(int x, int y, int z = 0) const { return data_.data() + ((size_t(z) * h_ + y) * w_ + x) * getBytesPerPixel(); }
+
 	void setPixel(int x, int y, const glm::vec4& c)
 	{
 		(*this.*setPixelFunc)(x, y, c);
@@ -62,6 +76,15 @@ struct Bitmap
 	{
 		return ((*this.*getPixelFunc)(x, y));
 	}
+
+	/*
+		Bulk versions of getPixel()/setPixel() for 'count' pixels of the row 'y' starting at 'x', and for a w * h region.
+		They convert whole spans with the kernels below instead of one pixel at a time.
+	*/
+	void getPixels(int x, int y, int count, glm::vec4* pixels) const;
+	void setPixels(int x, int y, int count, const glm::vec4* pixels);
+	void getRegion(int x, int y, int w, int h, glm::vec4* pixels) const;
+	void setRegion(int x, int y, int w, int h, const glm::vec4* pixels);
 private:
 	using setPixel_t = void(Bitmap::*)(int, int, const glm::vec4&);
 	using getPixel_t = glm::vec4(Bitmap::*)(int, int) const;
@@ -110,10 +133,10 @@ private:
 	void setPixelUnsignedByte(int x, int y, const glm::vec4& c)
 	{
 		const int ofs = comp_ * (y * w_ + x);
-		if (comp_ > 0) data_[ofs + 0] = uint8_t(c.x * 255.0f);
-		if (comp_ > 1) data_[ofs + 1] = uint8_t(c.y * 255.0f);
-		if (comp_ > 2) data_[ofs + 2] = uint8_t(c.z * 255.0f);
-		if (comp_ > 3) data_[ofs + 3] = uint8_t(c.w * 255.0f);
+		if (comp_ > 0) data_[ofs + 0] = floatToUnsignedByte(c.x);
+		if (comp_ > 1) data_[ofs + 1] = floatToUnsignedByte(c.y);
+		if (comp_ > 2) data_[ofs + 2] = floatToUnsignedByte(c.z);
+		if (comp_ > 3) data_[ofs + 3] = floatToUnsignedByte(c.w);
 	}
 	glm::vec4 getPixelUnsignedByte(int x, int y) const
 	{
@@ -125,3 +148,24 @@ private:
 			comp_ > 3 ? float(data_[ofs + 3]) / 255.0f : 0.0f);
 	}
 };
+
+/*
+	Pixel format conversion kernels (SSE2 where available).
+
+	u8 <-> float conversions work on 'count' components: bytes are divided by 255, floats are converted with
+	floatToUnsignedByte() (the same as Bitmap::setPixel()). RGB <-> RGBA conversions work on 'numPixels' pixels
+	and the source and destination should not overlap.
+*/
+void convertUnsignedByteToFloat(const uint8_t* src, float* dst, size_t count);
+void convertFloatToUnsignedByte(const float* src, uint8_t* dst, size_t count);
+void convertRGBToRGBA(const float* src, float* dst, size_t numPixels, float alpha = 1.0f);
+void convertRGBToRGBA(const uint8_t* src, uint8_t* dst, size_t numPixels, uint8_t alpha = 255);
+void convertRGBAToRGB(const float* src, float* dst, size_t numPixels);
+void convertRGBAToRGB(const uint8_t* src, uint8_t* dst, size_t numPixels);
+
+/* Pixels with 'comp' components of the format 'fmt' to/from vec4 (the missing components are 0, as in Bitmap::getPixel()) */
+void convertPixelsToVec4(const void* src, eBitmapFormat fmt, int comp, glm::vec4* dst, size_t numPixels);
+void convertVec4ToPixels(const glm::vec4* src, eBitmapFormat fmt, int comp, void* dst, size_t numPixels);
+
+/* A copy of the 2D or cube bitmap 'b' with another component count and/or format. New alpha components are opaque */
+Bitmap convertBitmap(const Bitmap& b, int comp, eBitmapFormat fmt);
@@ -0,0 +1,64 @@
+#include "shared/DrawSortKeys.h"
+
+#include <string.h>
+
+void radixSortKeys(uint64_t* keys, uint64_t* temp, size_t count, uint32_t firstBit)
+{
+	if (count < 2 || firstBit >= 64)
+		return;
+
+	// not worth clearing the histograms for
+	if (count <= 32)
+	{
+		for (size_t i = 1; i != count; i++)
+		{
+			const uint64_t key = keys[i];
+			size_t j = i;
+			for (; j > 0 && (keys[j - 1] >> firstBit) > (key >> firstBit); j--)
+				keys[j] = keys[j - 1];
+			keys[j] = key;
+		}
+		return;
+	}
+
+	const uint32_t numPasses = (64 - firstBit + 7) / 8;
+
+	// the histograms of all the passes are collected in one read of the keys
+	uint32_t histograms[8][256] = {};
+
+	for (size_t i = 0; i != count; i++)
+	{
+		const uint64_t key = keys[i] >> firstBit;
+		for (uint32_t p = 0; p != numPasses; p++)
+			histograms[p][(key >> (8 * p)) & 0xFF]++;
+	}
+
+	uint64_t* src = keys;
+	uint64_t* dst = temp;
+
+	for (uint32_t p = 0; p != numPasses; p++)
+	{
+		uint32_t* histogram = histograms[p];
+		const uint32_t shift = firstBit + 8 * p;
+
+		// all the keys have the same digit, the order does not change
+		if (histogram[(src[0] >> shift) & 0xFF] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t d = 0; d != 256; d++)
+		{
+			const uint32_t n = histogram[d];
+			histogram[d] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i != count; i++)
+			dst[histogram[(src[i] >> shift) & 0xFF]++] = src[i];
+
+		std::swap(src, dst);
+	}
+
+	if (src != keys)
+		memcpy(keys, src, count * sizeof(uint64_t));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+/*
+	64-bit sort keys for draw commands.
+
+	The low kSortKeyIndexBits bits of a key hold the index of its command, so sorting the keys sorts the commands and
+	the equal keys keep the original order of the commands. The upper bits are built by makeFrontToBackSortKey(): the
+	front-to-back order helps early-z rejection of the opaque objects. The depth is quantized to the upper 16 bits of its
+	float representation (~1% relative precision), so the commands at about the same distance are still grouped by material.
+*/
+
+constexpr uint32_t kSortKeyIndexBits = 20;
+constexpr uint32_t kMaxSortKeyIndex = (1u << kSortKeyIndexBits) - 1;
+
+/* Positive floats are ordered the same way as their bits */
+inline uint64_t quantizeSortDepth(float viewDepth)
+{
+	return std::bit_cast<uint32_t>(std::max(viewDepth, 0.0f)) >> 16;
+}
+
+inline uint64_t makeFrontToBackSortKey(float viewDepth, uint32_t materialIndex)
+{
+	return ((quantizeSortDepth(viewDepth) << 28) | (materialIndex & 0xFFFFFFF)) << kSortKeyIndexBits;
+}
+
+inline uint32_t getSortKeyIndex(uint64_t key)
+{
+	return (uint32_t)(key & kMaxSortKeyIndex);
+}
+
+/*
+	Stable LSD radix sort by the bits of the keys starting from 'firstBit', 8 bits per pass. The passes where all the keys
+	have the same digit are skipped. 'temp' should have room for 'count' keys, the result is in 'keys'.
+*/
+void radixSortKeys(uint64_t* keys, uint64_t* temp, size_t count, uint32_t firstBit = 0);
+
+/* Sort keys made by makeFrontToBackSortKey(). They are unique and their indices are in increasing order, so the index bits are skipped */
+inline void sortDrawKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& temp)
+{
+	temp.resize(keys.size());
+	radixSortKeys(keys.data(), temp.data(), keys.size(), kSortKeyIndexBits);
+}
@@ -0,0 +1,464 @@
+#include "shared/OcclusionBuffer.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define OCCLUSION_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
+namespace
+{
+	constexpr float kFarDepth = 1.0f;
+
+	// triangles reaching further than this many buffer sizes from the screen are skipped to keep the edge functions precise
+	constexpr float kGuardBand = 8.0f;
+
+	/* Edge function A * x + B * y + C which is positive inside a counter-clockwise triangle */
+	struct Edge
+	{
+		float A, B, C;
+
+		Edge(const vec3& a, const vec3& b)
+		: A(a.y - b.y)
+		, B(b.x - a.x)
+		, C(-(A * a.x + B * a.y))
+		{}
+
+		float eval(float x, float y) const { return A * x + B * y + C; }
+	};
+
+	/* Clip a polygon by the near plane z >= -w */
+	int clipByNearPlane(const vec4* in, int numIn, vec4* out)
+	{
+		int numOut = 0;
+
+		for (int i = 0; i != numIn; i++)
+		{
+			const vec4& a = in[i];
+			const vec4& b = in[(i + 1) % numIn];
+
+			const float da = a.z + a.w;
+			const float db = b.z + b.w;
+
+			if (da >= 0.0f)
+				out[numOut++] = a;
+
+			if ((da >= 0.0f) != (db >= 0.0f))
+				out[numOut++] = a + (b - a) * (da / (da - db));
+		}
+
+		return numOut;
+	}
+}
+
+OcclusionBuffer::OcclusionBuffer(tf::Executor& executor, int width, int height)
+: width_((width + kTileWidth - 1) / kTileWidth * kTileWidth)
+, height_((height + kTileHeight - 1) / kTileHeight * kTileHeight)
+, tilesX_(width_ / kTileWidth)
+, tilesY_(height_ / kTileHeight)
+, executor_(executor)
+{
+	for (uint32_t l = 0; ; l++)
+	{
+		levels_.emplace_back((size_t)getLevelWidth(l) * getLevelHeight(l), kFarDepth);
+		if (getLevelWidth(l) == 1 && getLevelHeight(l) == 1)
+			break;
+	}
+}
+
+void OcclusionBuffer::addOccluder(const float* vertices, size_t vertexStride, const uint32_t* indices, size_t numIndices, const glm::mat4& model)
+{
+	occluderVertices_.reserve(occluderVertices_.size() + numIndices);
+
+	for (size_t i = 0; i != numIndices; i++)
+	{
+		const float* v = vertices + indices[i] * vertexStride;
+		occluderVertices_.push_back(vec3(model * vec4(v[0], v[1], v[2], 1.0f)));
+	}
+}
+
+uint32_t OcclusionBuffer::setupTriangle(const glm::mat4& viewProj, const vec3* p, ScreenTriangle* out) const
+{
+	vec4 clip[3];
+	for (int i = 0; i != 3; i++)
+		clip[i] = viewProj * vec4(p[i], 1.0f);
+
+	// trivially rejected if all the vertices are outside of the same side plane or behind the far plane
+	auto allOutside = [&clip](auto isOutside)
+	{
+		return isOutside(clip[0]) && isOutside(clip[1]) && isOutside(clip[2]);
+	};
+
+	if (allOutside([](const vec4& c) { return c.x < -c.w; }) || allOutside([](const vec4& c) { return c.x > c.w; }) ||
+	    allOutside([](const vec4& c) { return c.y < -c.w; }) || allOutside([](const vec4& c) { return c.y > c.w; }) ||
+	    allOutside([](const vec4& c) { return c.z > c.w; }))
+		return 0;
+
+	vec4 poly[4];
+	const int numVertices = clipByNearPlane(clip, 3, poly);
+
+	uint32_t numTriangles = 0;
+
+	for (int t = 0; t + 2 < numVertices; t++)
+	{
+		const vec4* c[3] = { &poly[0], &poly[t + 1], &poly[t + 2] };
+
+		ScreenTriangle& tri = out[numTriangles];
+
+		for (int i = 0; i != 3; i++)
+		{
+			const float invW = 1.0f / c[i]->w;
+			tri.v[i] = vec3(
+				(c[i]->x * invW * 0.5f + 0.5f) * (float)width_,
+				(c[i]->y * invW * 0.5f + 0.5f) * (float)height_,
+				c[i]->z * invW * 0.5f + 0.5f);
+		}
+
+		// skipping an occluder triangle is always safe, it can only make fewer boxes occluded
+		bool insideGuardBand = true;
+		for (int i = 0; i != 3; i++)
+			insideGuardBand = insideGuardBand &&
+				std::abs(tri.v[i].x - 0.5f * (float)width_) <= kGuardBand * (float)width_ &&
+				std::abs(tri.v[i].y - 0.5f * (float)height_) <= kGuardBand * (float)height_;
+
+		if (!insideGuardBand)
+			continue;
+
+		// twice the area: a triangle smaller than a pixel cannot cover any pixel completely
+		const float area = Edge(tri.v[0], tri.v[1]).eval(tri.v[2].x, tri.v[2].y);
+
+		if (std::abs(area) < 2.0f)
+			continue;
+
+		if (area < 0.0f)
+			std::swap(tri.v[1], tri.v[2]);
+
+		const vec3 vmin = glm::min(glm::min(tri.v[0], tri.v[1]), tri.v[2]);
+		const vec3 vmax = glm::max(glm::max(tri.v[0], tri.v[1]), tri.v[2]);
+
+		// the pixels whose centers can be inside the triangle
+		tri.minX = (int)std::max(0.0f, std::floor(vmin.x));
+		tri.minY = (int)std::max(0.0f, std::floor(vmin.y));
+		tri.maxX = (int)std::min((float)(width_ - 1), std::ceil(vmax.x));
+		tri.maxY = (int)std::min((float)(height_ - 1), std::ceil(vmax.y));
+
+		if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+			continue;
+
+		numTriangles++;
+	}
+
+	return numTriangles;
+}
+
+void OcclusionBuffer::render(const glm::mat4& viewProj)
+{
+	viewProj_ = viewProj;
+
+	const size_t numTriangles = occluderVertices_.size() / 3;
+	const int numTiles = tilesX_ * tilesY_;
+
+	numChunks_ = (int)std::clamp<size_t>(numTriangles / 1024, 1, 4 * executor_.num_workers());
+	const size_t chunkSize = (numTriangles + numChunks_ - 1) / numChunks_;
+
+	triangles_.resize(2 * numTriangles);
+	bins_.resize((size_t)numChunks_ * numTiles);
+
+	tf::Taskflow taskflow;
+
+	tf::Task setupTask = taskflow.for_each_index(0, numChunks_, 1, [&](int chunk)
+		{
+			std::vector<uint32_t>* bins = &bins_[(size_t)chunk * numTiles];
+
+			for (int t = 0; t != numTiles; t++)
+				bins[t].clear();
+
+			const size_t last = std::min(numTriangles, (chunk + 1) * chunkSize);
+
+			for (size_t i = chunk * chunkSize; i < last; i++)
+			{
+				const uint32_t n = setupTriangle(viewProj, &occluderVertices_[3 * i], &triangles_[2 * i]);
+
+				for (uint32_t k = 0; k != n; k++)
+				{
+					const ScreenTriangle& tri = triangles_[2 * i + k];
+
+					for (int ty = tri.minY / kTileHeight; ty <= tri.maxY / kTileHeight; ty++)
+						for (int tx = tri.minX / kTileWidth; tx <= tri.maxX / kTileWidth; tx++)
+							bins[ty * tilesX_ + tx].push_back((uint32_t)(2 * i + k));
+				}
+			}
+		}
+	);
+
+	tf::Task rasterTask = taskflow.for_each_index(0, numTiles, 1, [this](int tile) { rasterizeTile(tile); });
+
+	tf::Task hiZTask = taskflow.emplace([this]() { buildHiZ(); });
+
+	setupTask.precede(rasterTask);
+	rasterTask.precede(hiZTask);
+
+	executor_.run(taskflow).wait();
+}
+
+void OcclusionBuffer::rasterizeTile(int tile)
+{
+	const int tileX0 = (tile % tilesX_) * kTileWidth;
+	const int tileY0 = (tile / tilesX_) * kTileHeight;
+	const int tileX1 = tileX0 + kTileWidth - 1;
+	const int tileY1 = tileY0 + kTileHeight - 1;
+
+	float* depth = levels_[0].data();
+
+	for (int y = tileY0; y <= tileY1; y++)
+		std::fill_n(depth + (size_t)y * width_ + tileX0, kTileWidth, kFarDepth);
+
+	const int numTiles = tilesX_ * tilesY_;
+
+	// the chunks are processed in order, so the result does not depend on the scheduling
+	for (int chunk = 0; chunk != numChunks_; chunk++)
+	{
+		for (uint32_t triIdx: bins_[(size_t)chunk * numTiles + tile])
+		{
+			const ScreenTriangle& tri = triangles_[triIdx];
+
+			const Edge e[3] = { Edge(tri.v[1], tri.v[2]), Edge(tri.v[2], tri.v[0]), Edge(tri.v[0], tri.v[1]) };
+
+			// the whole pixel is inside the edge if its center is at least this far from it
+			float bias[3];
+			for (int i = 0; i != 3; i++)
+				bias[i] = 0.5f * (std::abs(e[i].A) + std::abs(e[i].B));
+
+			// depth plane from the barycentric coordinates
+			const float invArea = 1.0f / e[2].eval(tri.v[2].x, tri.v[2].y);
+			const float zA = (e[0].A * tri.v[0].z + e[1].A * tri.v[1].z + e[2].A * tri.v[2].z) * invArea;
+			const float zB = (e[0].B * tri.v[0].z + e[1].B * tri.v[1].z + e[2].B * tri.v[2].z) * invArea;
+			const float zC = (e[0].C * tri.v[0].z + e[1].C * tri.v[1].z + e[2].C * tri.v[2].z) * invArea
+				+ 0.5f * (std::abs(zA) + std::abs(zB)); // the farthest depth inside the pixel
+
+			const int x0 = std::max(tri.minX, tileX0);
+			const int x1 = std::min(tri.maxX, tileX1);
+			const int y0 = std::max(tri.minY, tileY0);
+			const int y1 = std::min(tri.maxY, tileY1);
+
+#if defined(OCCLUSION_USE_SSE)
+			// the tiles are a multiple of 4 pixels wide, so the aligned groups never leave the tile
+			const int xStart = x0 & ~3;
+
+			const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 farDepth = _mm_set1_ps(kFarDepth);
+
+			__m128 eA[3], eB[3], eC[3];
+			for (int i = 0; i != 3; i++)
+			{
+				eA[i] = _mm_set1_ps(e[i].A);
+				eB[i] = _mm_set1_ps(e[i].B);
+				eC[i] = _mm_set1_ps(e[i].C - bias[i]);
+			}
+
+			const __m128 vzA = _mm_set1_ps(zA);
+			const __m128 vzB = _mm_set1_ps(zB);
+			const __m128 vzC = _mm_set1_ps(zC);
+
+			for (int y = y0; y <= y1; y++)
+			{
+				const __m128 py = _mm_set1_ps((float)y + 0.5f);
+				float* row = depth + (size_t)y * width_;
+
+				for (int x = xStart; x <= x1; x += 4)
+				{
+					const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+
+					__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(eA[0], px), _mm_mul_ps(eB[0], py)), eC[0]), _mm_setzero_ps());
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(eA[1], px), _mm_mul_ps(eB[1], py)), eC[1]), _mm_setzero_ps()));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(eA[2], px), _mm_mul_ps(eB[2], py)), eC[2]), _mm_setzero_ps()));
+
+					if (!_mm_movemask_ps(inside))
+						continue;
+
+					const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vzA, px), _mm_mul_ps(vzB, py)), vzC);
+					const __m128 zMasked = _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, farDepth));
+
+					_mm_storeu_ps(row + x, _mm_min_ps(_mm_loadu_ps(row + x), zMasked));
+				}
+			}
+#else
+			for (int y = y0; y <= y1; y++)
+			{
+				const float py = (float)y + 0.5f;
+				float* row = depth + (size_t)y * width_;
+
+				for (int x = x0; x <= x1; x++)
+				{
+					const float px = (float)x + 0.5f;
+
+					if (e[0].eval(px, py) >= bias[0] && e[1].eval(px, py) >= bias[1] && e[2].eval(px, py) >= bias[2])
+						row[x] = std::min(row[x], zA * px + zB * py + zC);
+				}
+			}
+#endif
+		}
+	}
+}
+
+void OcclusionBuffer::buildHiZ()
+{
+	for (uint32_t l = 1; l != levels_.size(); l++)
+	{
+		const int srcW = getLevelWidth(l - 1);
+		const int srcH = getLevelHeight(l - 1);
+		const int dstW = getLevelWidth(l);
+		const int dstH = getLevelHeight(l);
+
+		const float* src = levels_[l - 1].data();
+		float* dst = levels_[l].data();
+
+		for (int y = 0; y != dstH; y++)
+		{
+			const float* row0 = src + (size_t)std::min(2 * y, srcH - 1) * srcW;
+			const float* row1 = src + (size_t)std::min(2 * y + 1, srcH - 1) * srcW;
+
+			for (int x = 0; x != dstW; x++)
+			{
+				const int x0 = std::min(2 * x, srcW - 1);
+				const int x1 = std::min(2 * x + 1, srcW - 1);
+				dst[y * dstW + x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::isBoxVisible(const BoundingBox& box) const
+{
+	vec3 vmin(std::numeric_limits<float>::max());
+	vec3 vmax(std::numeric_limits<float>::lowest());
+
+	for (int i = 0; i != 8; i++)
+	{
+		const vec3 p((i & 1) ? box.max_.x : box.min_.x, (i & 2) ? box.max_.y : box.min_.y, (i & 4) ? box.max_.z : box.min_.z);
+		const vec4 c = viewProj_ * vec4(p, 1.0f);
+
+		// the box crosses the near plane
+		if (c.z < -c.w)
+			return true;
+
+		const vec3 ndc = vec3(c) / c.w;
+		vmin = glm::min(vmin, ndc);
+		vmax = glm::max(vmax, ndc);
+	}
+
+	const float minX = (vmin.x * 0.5f + 0.5f) * (float)width_;
+	const float maxX = (vmax.x * 0.5f + 0.5f) * (float)width_;
+	const float minY = (vmin.y * 0.5f + 0.5f) * (float)height_;
+	const float maxY = (vmax.y * 0.5f + 0.5f) * (float)height_;
+	const float minDepth = vmin.z * 0.5f + 0.5f;
+
+	// completely off-screen boxes are left to the frustum culling
+	if (maxX < 0.0f || maxY < 0.0f || minX >= (float)width_ || minY >= (float)height_)
+		return true;
+
+	const int x0 = (int)std::max(0.0f, minX);
+	const int y0 = (int)std::max(0.0f, minY);
+	const int x1 = (int)std::min((float)(width_ - 1), maxX);
+	const int y1 = (int)std::min((float)(height_ - 1), maxY);
+
+	// the finest level where the rectangle covers at most 2x2 texels
+	uint32_t level = 0;
+	while (level + 1 < levels_.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		level++;
+
+	const int w = getLevelWidth(level);
+	const float* depth = levels_[level].data();
+
+	for (int y = y0 >> level; y <= (y1 >> level); y++)
+		for (int x = x0 >> level; x <= (x1 >> level); x++)
+			if (depth[y * w + x] >= minDepth)
+				return true;
+
+	return false;
+}
+
+uint32_t OcclusionBuffer::testBoxes(const std::vector<BoundingBox>& boxes, std::vector<uint64_t>& visibility)
+{
+	const size_t kChunkSize = 1024;
+
+	const int numChunks = (int)((boxes.size() + kChunkSize - 1) / kChunkSize);
+
+	std::vector<uint32_t> numVisible(numChunks, 0);
+
+	auto testChunk = [&](int chunk)
+	{
+		const size_t first = chunk * kChunkSize;
+		const size_t last = std::min(first + kChunkSize, boxes.size());
+
+		for (size_t w = first >> 6; w != (last + 63) >> 6; w++)
+		{
+			for (uint64_t bits = visibility[w]; bits; bits &= bits - 1)
+			{
+				const int bit = std::countr_zero(bits);
+				if (isBoxVisible(boxes[(w << 6) + bit]))
+					numVisible[chunk]++;
+				else
+					visibility[w] &= ~(1ull << bit);
+			}
+		}
+	};
+
+	if (numChunks > 1)
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, numChunks, 1, testChunk);
+		executor_.run(taskflow).wait();
+	}
+	else if (numChunks == 1)
+	{
+		testChunk(0);
+	}
+
+	uint32_t total = 0;
+	for (uint32_t n: numVisible)
+		total += n;
+
+	return total;
+}
+
+Bitmap OcclusionBuffer::getDepthBitmap(uint32_t level) const
+{
+	const int w = getLevelWidth(level);
+	const int h = getLevelHeight(level);
+
+	Bitmap bmp(w, h, 1, eBitmapFormat_Float);
+
+	for (int y = 0; y != h; y++)
+		for (int x = 0; x != w; x++)
+			bmp.setPixel(x, h - 1 - y, vec4(levels_[level][y * w + x]));
+
+	return bmp;
+}
+
+uint32_t addSceneOccluders(OcclusionBuffer& buffer, const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms, const std::vector<BoundingBox>& shapeBoxes, float minSize)
+{
+	uint32_t numOccluders = 0;
+
+	for (size_t i = 0; i != shapes.size(); i++)
+	{
+		if (glm::length(shapeBoxes[i].getSize()) < minSize)
+			continue;
+
+		const Mesh& mesh = meshData.meshes_[shapes[i].meshIndex];
+		const uint32_t lod = mesh.lodCount - 1;
+
+		buffer.addOccluder(
+			meshData.vertexData_.data() + (size_t)mesh.vertexOffset * (mesh.streamElementSize[0] / sizeof(float)),
+			mesh.streamElementSize[0] / sizeof(float),
+			meshData.indexData_.data() + mesh.indexOffset + mesh.lodOffset[lod],
+			mesh.getLODIndicesCount(lod),
+			globalTransforms[shapes[i].transformIndex]);
+
+		numOccluders++;
+	}
+
+	return numOccluders;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <taskflow/taskflow.hpp>
+
+#include "shared/Bitmap.h"
+#include "shared/UtilsMath.h"
+#include "shared/scene/VtxData.h"
+
+/*
+	Software occlusion culling.
+
+	A few large occluders (e.g. the lowest LODs of the biggest meshes) are rasterized on the CPU into a low-resolution
+	depth buffer. The buffer is split into tiles: the triangles are set up and binned to the tiles in parallel, and then
+	every tile is rasterized on its own thread, 4 pixels at a time with SSE. The rasterization is conservative: a pixel
+	is written only if it is completely covered by the triangle, and it gets the farthest depth of the triangle inside the
+	pixel, so the software depth is never closer than the real one.
+
+	After rasterization a hierarchical-Z pyramid with the farthest depth of every 2x2 block is built. The screen rectangle
+	of a box is tested against the pyramid level where it covers at most 2x2 texels, which makes the test cost constant.
+
+	Nothing here depends on the graphics API, so the depth is compared with a reference image headless (getDepthBitmap(), see Chapter10/Util03_OcclusionBuffer).
+*/
+
+class OcclusionBuffer final
+{
+public:
+	static constexpr int kTileWidth = 64;
+	static constexpr int kTileHeight = 32;
+
+	// The size is rounded up to whole tiles. The tiles are rasterized on the worker threads of 'executor', which can be shared with other systems
+	explicit OcclusionBuffer(tf::Executor& executor, int width = 320, int height = 192);
+
+	/* Occluders are static triangles which are transformed to world space once */
+	void addOccluder(const float* vertices, size_t vertexStride, const uint32_t* indices, size_t numIndices, const glm::mat4& model);
+	void clearOccluders() { occluderVertices_.clear(); }
+	size_t getNumOccluderTriangles() const { return occluderVertices_.size() / 3; }
+
+	/* Rasterize all the occluders and build the hierarchical-Z pyramid. 'viewProj' is an OpenGL-style projection (z in [-w, w]) */
+	void render(const glm::mat4& viewProj);
+
+	/* Test against the last render(). Boxes crossing the near plane are always visible */
+	bool isBoxVisible(const BoundingBox& box) const;
+
+	/* Clear the bits of the occluded boxes in the 'visibility' mask (see isVisible() in UtilsCulling.h). Returns the number of boxes left */
+	uint32_t testBoxes(const std::vector<BoundingBox>& boxes, std::vector<uint64_t>& visibility);
+
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+	uint32_t getNumLevels() const { return (uint32_t)levels_.size(); }
+
+	/* Depth in [0..1] (1 is the far plane) of the given pyramid level as a 1-component float image, the first row is the top of the screen */
+	Bitmap getDepthBitmap(uint32_t level = 0) const;
+
+private:
+	struct ScreenTriangle
+	{
+		vec3 v[3]; // screen-space x, y and depth
+		int minX, minY, maxX, maxY;
+	};
+
+	uint32_t setupTriangle(const glm::mat4& viewProj, const vec3* p, ScreenTriangle* out) const;
+	void rasterizeTile(int tile);
+	void buildHiZ();
+
+	int getLevelWidth(uint32_t level) const { return (width_ + (1 << level) - 1) >> level; }
+	int getLevelHeight(uint32_t level) const { return (height_ + (1 << level) - 1) >> level; }
+
+	int width_;
+	int height_;
+	int tilesX_;
+	int tilesY_;
+
+	glm::mat4 viewProj_ = glm::mat4(1.0f);
+
+	// level 0 is the depth buffer itself
+	std::vector<std::vector<float>> levels_;
+
+	std::vector<vec3> occluderVertices_;
+
+	// up to 2 triangles for every occluder triangle after clipping by the near plane
+	std::vector<ScreenTriangle> triangles_;
+
+	// triangles of every tile binned by every setup chunk: bins_[chunk * numTiles + tile]
+	std::vector<std::vector<uint32_t>> bins_;
+	int numChunks_ = 0;
+
+	tf::Executor& executor_;
+};
+
+/*
+	Add the lowest LOD of every shape whose world-space box diagonal is at least 'minSize' as an occluder.
+	'shapeBoxes' are the world-space boxes of the shapes. Returns the number of occluder shapes.
+*/
+uint32_t addSceneOccluders(OcclusionBuffer& buffer, const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms, const std::vector<BoundingBox>& shapeBoxes, float minSize);
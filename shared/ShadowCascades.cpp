@@ -0,0 +1,140 @@
+#include "shared/ShadowCascades.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+void getShadowCascadeSplits(float nearDist, float farDist, uint32_t numCascades, float lambda, float* splits)
+{
+	splits[0] = nearDist;
+
+	for (uint32_t i = 1; i < numCascades; i++)
+	{
+		const float f = (float)i / (float)numCascades;
+		const float logSplit = nearDist * powf(farDist / nearDist, f);
+		const float uniformSplit = nearDist + (farDist - nearDist) * f;
+		splits[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+	}
+
+	splits[numCascades] = farDist;
+}
+
+namespace
+{
+	/* Round 'value' down to a multiple of 'step' */
+	float snapToGrid(float value, float step)
+	{
+		return floorf(value / step) * step;
+	}
+}
+
+std::vector<ShadowCascade> fitShadowCascades(const glm::mat4& cameraProj, const glm::mat4& cameraView, const vec3& lightDir, const BoundingBox& sceneBounds, const ShadowCascadeParams& params)
+{
+	const uint32_t numCascades = std::max(params.numCascades_, 1u);
+	const float mapSize = (float)params.shadowMapSize_;
+
+	// corners 0-3 are on the near plane, 4-7 are the matching corners on the far plane, in view space
+	vec4 corners[8];
+	getFrustumCorners(cameraProj, corners);
+
+	const float nearDist = -corners[0].z;
+	const float farDist = -corners[4].z;
+
+	const glm::mat4 invView = glm::inverse(cameraView);
+	const float shadowDist = params.maxShadowDistance_ > 0.0f ? std::min(farDist, params.maxShadowDistance_) : farDist;
+
+	std::vector<float> splits(numCascades + 1);
+	getShadowCascadeSplits(nearDist, shadowDist, numCascades, params.splitLambda_, splits.data());
+
+	// the light space does not depend on the camera, so the texel grid stays in place while the camera moves
+	const vec3 up = fabsf(lightDir.y) > 0.99f ? vec3(0.0f, 0.0f, 1.0f) : vec3(0.0f, 1.0f, 0.0f);
+	const glm::mat4 lightView = glm::lookAt(vec3(0.0f), lightDir, up);
+	const BoundingBox sceneLS = sceneBounds.getTransformed(lightView);
+
+	std::vector<ShadowCascade> cascades(numCascades);
+
+	for (uint32_t i = 0; i != numCascades; i++)
+	{
+		// the view depth changes linearly along the frustum edges
+		const float t0 = (splits[i] - nearDist) / (farDist - nearDist);
+		const float t1 = (splits[i + 1] - nearDist) / (farDist - nearDist);
+
+		// view space
+		vec3 points[8];
+		for (int c = 0; c != 4; c++)
+		{
+			const vec3 n = vec3(corners[c]);
+			const vec3 f = vec3(corners[c + 4]);
+			points[c] = n + (f - n) * t0;
+			points[c + 4] = n + (f - n) * t1;
+		}
+
+		BoundingBox fit;
+		float texelSize = 0.0f;
+
+		if (params.stabilize_)
+		{
+			// the sphere is fitted in view space, so its radius does not depend on the position and rotation of the camera
+			vec3 center(0.0f);
+			for (const vec3& p : points)
+				center += p;
+			center /= 8.0f;
+
+			float radius = 0.0f;
+			for (const vec3& p : points)
+				radius = std::max(radius, glm::length(p - center));
+			// quantize the radius, so the float noise does not change the size of the cascade
+			radius = ceilf(radius * 16.0f) / 16.0f;
+
+			texelSize = 2.0f * radius / mapSize;
+
+			vec3 centerLS = vec3(lightView * invView * vec4(center, 1.0f));
+			centerLS.x = snapToGrid(centerLS.x, texelSize);
+			centerLS.y = snapToGrid(centerLS.y, texelSize);
+
+			fit = BoundingBox(centerLS - vec3(radius), centerLS + vec3(radius));
+		}
+		else
+		{
+			const glm::mat4 viewToLight = lightView * invView;
+
+			for (vec3& p : points)
+				p = vec3(viewToLight * vec4(p, 1.0f));
+
+			fit = BoundingBox(points, 8);
+
+			// nothing outside the scene casts or receives shadows
+			fit.min_.x = std::max(fit.min_.x, sceneLS.min_.x);
+			fit.min_.y = std::max(fit.min_.y, sceneLS.min_.y);
+			fit.max_.x = std::max(std::min(fit.max_.x, sceneLS.max_.x), fit.min_.x);
+			fit.max_.y = std::max(std::min(fit.max_.y, sceneLS.max_.y), fit.min_.y);
+
+			// one texel is left for snapping the minimum down
+			const vec3 size = fit.getSize();
+			texelSize = std::max(std::max(size.x, size.y) / (mapSize - 1.0f), 1e-6f);
+
+			// a square covering whole texels, so the texels are square too
+			fit.min_.x = snapToGrid(fit.min_.x, texelSize);
+			fit.min_.y = snapToGrid(fit.min_.y, texelSize);
+			fit.max_.x = fit.min_.x + texelSize * mapSize;
+			fit.max_.y = fit.min_.y + texelSize * mapSize;
+		}
+
+		// all the casters between the light and this cascade
+		fit.min_.z = std::min(fit.min_.z, sceneLS.min_.z);
+		fit.max_.z = std::max(fit.max_.z, sceneLS.max_.z);
+
+		const glm::mat4 lightProj = glm::ortho(fit.min_.x, fit.max_.x, fit.min_.y, fit.max_.y, -fit.max_.z, -fit.min_.z);
+
+		cascades[i] = ShadowCascade {
+			.splitNear_ = splits[i],
+			.splitFar_ = splits[i + 1],
+			.view_ = lightView,
+			.proj_ = lightProj,
+			.viewProj_ = lightProj * lightView,
+			.texelSize_ = texelSize
+		};
+	}
+
+	return cascades;
+}
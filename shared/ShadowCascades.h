@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "shared/UtilsMath.h"
+
+/*
+	Cascaded shadow maps for a directional light.
+
+	The view frustum is split along the view direction, and every part gets its own orthographic light frustum, so the
+	shadow map resolution is spent where the camera actually looks. The split distances use the "practical" scheme: a blend
+	of the logarithmic splits (constant resolution relative to the distance) and the uniform ones.
+
+	A stabilized cascade is fitted around the bounding sphere of its part of the view frustum in view space: its size
+	does not change when the camera moves or rotates, and its position is snapped to whole shadow map texels in a light
+	space which does not depend on the camera, so the shadow edges do not shimmer while the camera moves. A tight
+	cascade is the light-space bounding box of its part of the view frustum clipped by the scene bounds. It uses the
+	texels better but shimmers. In both cases the depth range covers the whole scene, so the casters between the light
+	and the view are included.
+
+	Everything here is pure math without any graphics API calls.
+*/
+
+struct ShadowCascadeParams
+{
+	uint32_t numCascades_ = 4;
+	uint32_t shadowMapSize_ = 2048;
+	// 0 is the uniform split scheme, 1 is the logarithmic one
+	float splitLambda_ = 0.75f;
+	// the far distance of the last cascade, if it is less than the distance of the far plane of the camera
+	float maxShadowDistance_ = 0.0f;
+	bool stabilize_ = true;
+};
+
+struct ShadowCascade
+{
+	// view-space distances along the view direction covered by this cascade
+	float splitNear_;
+	float splitFar_;
+
+	glm::mat4 view_;
+	glm::mat4 proj_;
+	glm::mat4 viewProj_;
+
+	// the size of a shadow map texel in world units
+	float texelSize_;
+};
+
+/* Fill 'splits' with 'numCascades + 1' distances from 'nearDist' to 'farDist' */
+void getShadowCascadeSplits(float nearDist, float farDist, uint32_t numCascades, float lambda, float* splits);
+
+/*
+	Fit the light frusta to the view frustum given by 'cameraProj' (an OpenGL-style projection, z in [-w, w]) and 'cameraView'.
+	'lightDir' is the direction of the light rays. Nothing outside 'sceneBounds' is expected to cast or receive shadows.
+*/
+std::vector<ShadowCascade> fitShadowCascades(const glm::mat4& cameraProj, const glm::mat4& cameraView, const vec3& lightDir, const BoundingBox& sceneBounds, const ShadowCascadeParams& params);
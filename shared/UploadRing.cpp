@@ -0,0 +1,68 @@
+#include "shared/UploadRing.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace
+{
+	size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+UploadRing::UploadRing(UploadRingBackend& backend, size_t frameSize, uint32_t numFrames)
+: backend_(backend)
+, frameSize_(alignUp(frameSize, kMaxAlignment))
+, numFrames_(numFrames)
+// the first beginFrame() wraps around to the region 0
+, frame_(numFrames - 1)
+, offset_(frameSize_ * (numFrames - 1))
+{
+	assert(numFrames > 0);
+	memory_ = backend_.mapMemory(getTotalSize());
+}
+
+void UploadRing::beginFrame()
+{
+	assert(!inFrame_);
+
+	frame_ = (frame_ + 1) % numFrames_;
+	backend_.waitForFrame(frame_);
+
+	offset_ = frame_ * frameSize_;
+	inFrame_ = true;
+}
+
+void UploadRing::endFrame()
+{
+	assert(inFrame_);
+
+	peakUsage_ = std::max(peakUsage_, getFrameUsage());
+	backend_.signalFrame(frame_);
+
+	inFrame_ = false;
+}
+
+UploadAllocation UploadRing::allocate(size_t size, size_t alignment)
+{
+	assert(inFrame_);
+	assert(alignment > 0 && alignment <= kMaxAlignment && (alignment & (alignment - 1)) == 0);
+
+	const size_t offset = alignUp(offset_, alignment);
+
+	if (offset + size > (frame_ + 1) * frameSize_)
+	{
+		numFailedAllocations_++;
+		return UploadAllocation();
+	}
+
+	offset_ = offset + size;
+
+	return UploadAllocation {
+		.ptr_ = memory_ + offset,
+		.offset_ = offset,
+		.size_ = size
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+	Per-frame upload arena for CPU-to-GPU data (uniforms, draw commands, transforms).
+
+	One persistently mapped buffer is split into 'numFrames' equal regions, one for every frame in flight. A frame allocates
+	from its own region by bumping an offset, and writes the data right into the mapped memory, so there are no buffer
+	updates and no map/unmap calls per upload. Before a region is reused the ring waits until the GPU has finished the frame
+	which used it last time.
+
+	The graphics API is hidden behind UploadRingBackend. Only OpenGL has a backend (GLUploadRing.h, used for the
+	uniforms and the culled indirect draws of GL01_CullingCPU): the Vulkan renderers keep one persistently mapped buffer
+	per swapchain image, and drawFrame() waits for the device to become idle after every frame, so they have no frames
+	in flight to protect. The allocator itself is tested headless with a fake backend in Chapter10/Util04_UploadRing.
+*/
+
+class UploadRingBackend
+{
+public:
+	virtual ~UploadRingBackend() = default;
+
+	/* The start of the persistently mapped buffer of 'size' bytes (called once) */
+	virtual uint8_t* mapMemory(size_t size) = 0;
+	/* Block until the GPU has finished the work submitted before signalFrame(frame) */
+	virtual void waitForFrame(uint32_t frame) = 0;
+	/* Mark the end of the work which uses the region of 'frame' */
+	virtual void signalFrame(uint32_t frame) = 0;
+};
+
+struct UploadAllocation
+{
+	// null if the region of the current frame is full
+	uint8_t* ptr_ = nullptr;
+	// offset from the start of the whole buffer, to be used in buffer bindings and indirect draws
+	size_t offset_ = 0;
+	size_t size_ = 0;
+
+	explicit operator bool() const { return ptr_ != nullptr; }
+};
+
+class UploadRing
+{
+public:
+	/* 'frameSize' is rounded up to kMaxAlignment, so every region starts at an aligned offset */
+	UploadRing(UploadRingBackend& backend, size_t frameSize, uint32_t numFrames);
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	/* Switch to the next region and wait until the GPU no longer reads it */
+	void beginFrame();
+	/* All the allocations of this frame have been submitted */
+	void endFrame();
+
+	/* 'alignment' should be a power of two not greater than kMaxAlignment */
+	UploadAllocation allocate(size_t size, size_t alignment = 16);
+
+	UploadAllocation upload(const void* data, size_t size, size_t alignment = 16)
+	{
+		const UploadAllocation a = allocate(size, alignment);
+		if (a)
+			memcpy(a.ptr_, data, size);
+		return a;
+	}
+
+	template <typename T>
+	T* allocateArray(size_t count, size_t alignment = alignof(T))
+	{
+		return (T*)allocate(sizeof(T) * count, alignment).ptr_;
+	}
+
+	size_t getFrameSize() const { return frameSize_; }
+	size_t getTotalSize() const { return frameSize_ * numFrames_; }
+	uint32_t getCurrentFrame() const { return frame_; }
+	/* Bytes allocated in the current frame, including the alignment padding */
+	size_t getFrameUsage() const { return offset_ - frame_ * frameSize_; }
+	size_t getPeakFrameUsage() const { return peakUsage_; }
+	uint32_t getNumFailedAllocations() const { return numFailedAllocations_; }
+
+	static constexpr size_t kMaxAlignment = 256;
+
+private:
+	UploadRingBackend& backend_;
+
+	const size_t frameSize_;
+	const uint32_t numFrames_;
+
+	uint8_t* memory_ = nullptr;
+
+	uint32_t frame_ = 0;
+	// absolute offset of the next allocation in the region of 'frame_'
+	size_t offset_ = 0;
+	bool inFrame_ = false;
+
+	size_t peakUsage_ = 0;
+	uint32_t numFailedAllocations_ = 0;
+};
@@ -38,21 +38,28 @@ inline int addUnique(std::vector<std::string>& files, const std::string& file)
 	return (int)std::distance(files.begin(), i);
 }
 
-// From https://stackoverflow.com/a/64152990/1182653
 // Delete a list of items from std::vector with indices in 'selection'
+// Linear time: the selection is expanded into a flag table and the surviving items are moved forward in a single pass
 template <class T, class Index = int> inline void eraseSelected(std::vector<T>& v, const std::vector<Index>& selection)
 // e.g., eraseSelected({1, 2, 3, 4, 5}, {1, 3})  ->   {1, 3, 5}
 //                         ^     ^    2 and 4 get deleted
 {
-	// cut off the elements moved to the end of the vector by std::stable_partition
-	v.resize(std::distance(
-			v.begin(),
-			// the stable_partition moves any element whose index is in 'selection' to the end
-			std::stable_partition(v.begin(), v.end(),
-				[&selection, &v](const T& item) {
-					return !std::binary_search(
-						selection.begin(), selection.end(),
-						/* std::distance(std::find(v.begin(), v.end(), item), v.begin()) - if you don't like the pointer arithmetic below */
-						static_cast<Index>(static_cast<const T*>(&item) - &v[0]));
-				})));
+	std::vector<bool> toErase(v.size(), false);
+	for (const Index& i: selection)
+		if (static_cast<size_t>(i) < v.size())
+			toErase[static_cast<size_t>(i)] = true;
+
+	size_t dst = 0;
+	for (size_t i = 0; i != v.size(); i++)
+	{
+		if (toErase[i])
+			continue;
+
+		if (dst != i)
+			v[dst] = std::move(v[i]);
+
+		dst++;
+	}
+
+	v.erase(v.begin() + dst, v.end());
 }
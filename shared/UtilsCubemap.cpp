@@ -1,6 +1,16 @@
 ﻿#include "UtilsMath.h"
 #include "UtilsCubemap.h"
 
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <taskflow/taskflow.hpp>
+
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
@@ -23,10 +33,248 @@ vec3 faceCoordsToXYZ(int i, int j, int faceID, int faceSize)
 	return vec3();
 }
 
-Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
+namespace
 {
-	// TODO: Black box (come back later)
+	/*
+		Floating point source coordinates of the cross face pixels in an equirectangular map, for one face size.
+
+		Most of the angles are shared between the faces: theta of the side faces (0..3) depends only on the column, phi of
+		the faces 1..3 is -phi of the face 0 and phi of the face 5 is -phi of the face 4. So the tables hold only 4 values
+		per pixel of one face instead of 12 atan2() per pixel of the whole cube, and the coordinates are exactly the same
+		as the ones computed per pixel.
+	*/
+	class EquirectangularCoords
+	{
+	public:
+		EquirectangularCoords(int faceSize, tf::Executor& executor)
+		: faceSize_(faceSize)
+		, sideU_(4 * faceSize)
+		, sidePhi_(size_t(faceSize) * faceSize)
+		, polePhi_(size_t(faceSize) * faceSize)
+		{
+			for (int face = 0; face != 2; face++)
+				poleU_[face].resize(size_t(faceSize) * faceSize);
+
+			for (int face = 0; face != 4; face++)
+				for (int i = 0; i != faceSize; i++)
+					sideU_[face * faceSize + i] = getU(faceCoordsToXYZ(i, 0, face, faceSize));
+
+			tf::Taskflow taskflow;
+			taskflow.for_each_index(0, faceSize, 1, [&](int j)
+				{
+					for (int i = 0; i != faceSize; i++)
+					{
+						const size_t k = size_t(j) * faceSize + i;
+						sidePhi_[k] = getPhi(faceCoordsToXYZ(i, j, 0, faceSize));
+						const vec3 P = faceCoordsToXYZ(i, j, 4, faceSize);
+						poleU_[0][k] = getU(P);
+						polePhi_[k] = getPhi(P);
+						// not derived from the face 4, atan2(0, 0) and atan2(0, -0) differ in the center
+						poleU_[1][k] = getU(faceCoordsToXYZ(i, j, 5, faceSize));
+					}
+				}
+			);
+			executor.run(taskflow).wait();
+		}
+
+		int getFaceSize() const { return faceSize_; }
+
+		/* Coordinates of the row 'j' of the cross face 'face' */
+		void getRow(int face, int j, float* U, float* V) const
+		{
+			const size_t row = size_t(j) * faceSize_;
+			const bool mirrored = face != 0 && face != 4;
+
+			if (face < 4)
+				memcpy(U, sideU_.data() + face * faceSize_, faceSize_ * sizeof(float));
+			else
+				memcpy(U, poleU_[face - 4].data() + row, faceSize_ * sizeof(float));
+
+			const float* phi = (face < 4 ? sidePhi_.data() : polePhi_.data()) + row;
+
+			for (int i = 0; i != faceSize_; i++)
+				V[i] = getV(mirrored ? -phi[i] : phi[i]);
+		}
+
+	private:
+		float getU(const vec3& P) const
+		{
+			const float theta = atan2(P.y, P.x);
+			return float(2.0f * faceSize_ * (theta + M_PI) / M_PI);
+		}
+
+		static float getPhi(const vec3& P)
+		{
+			const float R = hypot(P.x, P.y);
+			return atan2(P.z, R);
+		}
+
+		float getV(float phi) const
+		{
+			return float(2.0f * faceSize_ * (M_PI / 2.0f - phi) / M_PI);
+		}
+
+		const int faceSize_;
+		// [face * faceSize + i]
+		std::vector<float> sideU_;
+		// [j * faceSize + i] of the face 0
+		std::vector<float> sidePhi_;
+		// the faces 4 and 5
+		std::vector<float> poleU_[2];
+		// the face 4
+		std::vector<float> polePhi_;
+	};
+
+	/* The worker threads of all the conversions, started on the first use */
+	tf::Executor& getExecutor()
+	{
+		static tf::Executor executor;
+		return executor;
+	}
+
+	/*
+		The tables of the last kMaxCachedFaceSizes face sizes. The same sizes come again and again (every environment map
+		of a scene usually has the same resolution), and the tables of a 2048 face take 64 MB, so only a few are kept.
+	*/
+	std::shared_ptr<const EquirectangularCoords> getEquirectangularCoords(int faceSize)
+	{
+		constexpr size_t kMaxCachedFaceSizes = 2;
+
+		static std::mutex mutex;
+		// the most recently used last
+		static std::vector<std::shared_ptr<const EquirectangularCoords>> cache;
+
+		std::lock_guard lock(mutex);
+
+		auto it = std::find_if(cache.begin(), cache.end(), [faceSize](const auto& c) { return c->getFaceSize() == faceSize; });
+
+		std::shared_ptr<const EquirectangularCoords> coords =
+			it != cache.end() ? *it : std::make_shared<const EquirectangularCoords>(faceSize, getExecutor());
+
+		if (it != cache.end())
+			cache.erase(it);
+		else if (cache.size() == kMaxCachedFaceSizes)
+			cache.erase(cache.begin());
+
+		cache.push_back(coords);
+
+		return coords;
+	}
+
+	/*
+		Convert all the cross faces of the equirectangular map 'b' on the worker threads. Every task converts a tile of
+		kTileRows rows of one face and passes them one by one to writeRow(face, j, pixels).
+	*/
+	template <typename WriteRow>
+	void convertEquirectangularRows(tf::Executor& executor, const Bitmap& b, int faceSize, WriteRow writeRow)
+	{
+		constexpr int kTileRows = 16;
+
+		const std::shared_ptr<const EquirectangularCoords> cachedCoords = getEquirectangularCoords(faceSize);
+		const EquirectangularCoords& coords = *cachedCoords;
+
+		const int clampW = b.w_ - 1;
+		const int clampH = b.h_ - 1;
+
+		// float RGB(A) texels are read directly, everything else is converted to float RGBA first, kTileRows rows per task
+		const bool directFetch = b.fmt_ == eBitmapFormat_Float && b.comp_ >= 3;
+		const float* srcData = reinterpret_cast<const float*>(b.data_.data());
+		const int comp = b.comp_;
+
+		std::vector<vec4> converted;
+
+		if (!directFetch)
+		{
+			converted.resize(size_t(b.w_) * b.h_);
+
+			tf::Taskflow taskflow;
+			taskflow.for_each_index(0, b.h_, kTileRows, [&](int y)
+				{
+					const int numRows = std::min(kTileRows, b.h_ - y);
+					convertPixelsToVec4(b.getPixelData(0, y), b.fmt_, b.comp_, converted.data() + size_t(y) * b.w_, size_t(numRows) * b.w_);
+				}
+			);
+			executor.run(taskflow).wait();
+		}
+
+		auto fetch = [&](int x, int y)
+		{
+			if (!directFetch)
+				return converted[size_t(y) * b.w_ + x];
+			const float* p = srcData + comp * (size_t(y) * b.w_ + x);
+			return vec4(p[0], p[1], p[2], comp > 3 ? p[3] : 0.0f);
+		};
+
+		const int numTiles = (faceSize + kTileRows - 1) / kTileRows;
+
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, 6 * numTiles, 1, [&](int tile)
+			{
+				const int face = tile / numTiles;
+				const int firstRow = (tile % numTiles) * kTileRows;
+				const int lastRow = std::min(firstRow + kTileRows, faceSize);
+
+				std::vector<float> U(faceSize);
+				std::vector<float> V(faceSize);
+				std::vector<vec4> row(faceSize);
+
+				for (int j = firstRow; j != lastRow; j++)
+				{
+					coords.getRow(face, j, U.data(), V.data());
+
+					for (int i = 0; i != faceSize; i++)
+					{
+						const float Uf = U[i];
+						const float Vf = V[i];
+						// 4-samples for bilinear interpolation
+						const int U1 = clamp(int(floor(Uf)), 0, clampW);
+						const int V1 = clamp(int(floor(Vf)), 0, clampH);
+						const int U2 = clamp(U1 + 1, 0, clampW);
+						const int V2 = clamp(V1 + 1, 0, clampH);
+						// fractional part
+						const float s = Uf - U1;
+						const float t = Vf - V1;
+						// fetch 4-samples
+						const vec4 A = fetch(U1, V1);
+						const vec4 B = fetch(U2, V1);
+						const vec4 C = fetch(U1, V2);
+						const vec4 D = fetch(U2, V2);
+						// bilinear interpolation
+						row[i] = A * (1 - s) * (1 - t) + B * (s) * (1 - t) + C * (1 - s) * t + D * (s) * (t);
+					}
+
+					writeRow(face, j, row.data());
+				}
+			}
+		);
+		executor.run(taskflow).wait();
+	}
+
+	/* 2x2 box filter of the 6 faces of one mip level */
+	void downsampleCubeMapFaces(tf::Executor& executor, const vec4* src, int srcSize, vec4* dst, int dstSize)
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, 6, 1, [&](int face)
+			{
+				const vec4* srcFace = src + size_t(face) * srcSize * srcSize;
+				vec4* dstFace = dst + size_t(face) * dstSize * dstSize;
+
+				for (int j = 0; j != dstSize; j++)
+				{
+					const vec4* row0 = srcFace + size_t(2 * j) * srcSize;
+					const vec4* row1 = row0 + srcSize;
 
+					for (int i = 0; i != dstSize; i++)
+						dstFace[size_t(j) * dstSize + i] = 0.25f * (row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1]);
+				}
+			}
+		);
+		executor.run(taskflow).wait();
+	}
+}
+
+Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
+{
 	if (b.type_ != eBitmapType_2D) return Bitmap();
 
 	const int faceSize = b.w_ / 4;
@@ -46,43 +294,113 @@ Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
 		ivec2(faceSize, faceSize * 2)
 	};
 
-	const int clampW = b.w_ - 1;
-	const int clampH = b.h_ - 1;
+	tf::Executor& executor = getExecutor();
 
-	for (int face = 0; face != 6; face++)
-	{
-		for (int i = 0; i != faceSize; i++)
+	convertEquirectangularRows(executor, b, faceSize, [&](int face, int j, const vec4* row)
 		{
-			for (int j = 0; j != faceSize; j++)
+			result.setPixels(kFaceOffsets[face].x, j + kFaceOffsets[face].y, faceSize, row);
+		}
+	);
+
+	return result;
+}
+
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b)
+{
+	if (b.type_ != eBitmapType_2D) return Bitmap();
+
+	const int faceSize = b.w_ / 4;
+
+	Bitmap cubemap(faceSize, faceSize, 6, b.comp_, b.fmt_);
+	cubemap.type_ = eBitmapType_Cube;
+
+	convertEquirectangularMapToCubeMapFaces(b, cubemap.data_.data(), b.comp_, b.fmt_);
+
+	return cubemap;
+}
+
+size_t getCubeMapFacesSize(int faceSize, int comp, eBitmapFormat fmt, int numMipLevels)
+{
+	size_t numPixels = 0;
+
+	for (int level = 0; level != numMipLevels; level++)
+		numPixels += 6 * size_t(faceSize >> level) * (faceSize >> level);
+
+	return numPixels * comp * Bitmap::getBytesPerComponent(fmt);
+}
+
+void convertEquirectangularMapToCubeMapFaces(const Bitmap& b, void* dst, int comp, eBitmapFormat fmt, int numMipLevels)
+{
+	assert(b.type_ == eBitmapType_2D);
+
+	const int faceSize = b.w_ / 4;
+
+	assert(numMipLevels > 0 && (faceSize >> (numMipLevels - 1)) > 0);
+
+	// the cube face of every cross face, the same layout as in convertVerticalCrossToCubeMapFaces()
+	const int kCubeFaces[] = { 4, 0, 5, 1, 2, 3 };
+	// these cross faces are rotated by 180 degrees
+	const bool kMirrored[] = { true, false, false, false, true, true };
+
+	const size_t pixelSize = comp * Bitmap::getBytesPerComponent(fmt);
+	const size_t rowSize = faceSize * pixelSize;
+	const bool addAlpha = b.comp_ < 4 && comp == 4;
+
+	uint8_t* faces = static_cast<uint8_t*>(dst);
+
+	// the mip levels are built in memory, 'dst' is only written (it can be uncached mapped memory)
+	const int mipSize = numMipLevels > 1 ? faceSize / 2 : 0;
+	std::vector<vec4> mip(6 * size_t(mipSize) * mipSize);
+	// every row of the level 1 is the sum of two rows, which can come from different tasks
+	std::vector<std::mutex> mipRowLocks(6 * size_t(mipSize));
+
+	tf::Executor& executor = getExecutor();
+
+	convertEquirectangularRows(executor, b, faceSize, [&](int face, int j, vec4* row)
+		{
+			const int cubeFace = kCubeFaces[face];
+			if (kMirrored[face])
 			{
-				const vec3 P = faceCoordsToXYZ(i, j, face, faceSize);
-				const float R = hypot(P.x, P.y);
-				const float theta = atan2(P.y, P.x);
-				const float phi = atan2(P.z, R);
-				//	float point source coordinates
-				const float Uf = float(2.0f * faceSize * (theta + M_PI) / M_PI);
-				const float Vf = float(2.0f * faceSize * (M_PI / 2.0f - phi) / M_PI);
-				// 4-samples for bilinear interpolation
-				const int U1 = clamp(int(floor(Uf)), 0, clampW);
-				const int V1 = clamp(int(floor(Vf)), 0, clampH);
-				const int U2 = clamp(U1 + 1, 0, clampW);
-				const int V2 = clamp(V1 + 1, 0, clampH);
-				// fractional part
-				const float s = Uf - U1;
-				const float t = Vf - V1;
-				// fetch 4-samples
-				const vec4 A = b.getPixel(U1, V1);
-				const vec4 B = b.getPixel(U2, V1);
-				const vec4 C = b.getPixel(U1, V2);
-				const vec4 D = b.getPixel(U2, V2);
-				// bilinear interpolation
-				const vec4 color = A * (1 - s) * (1 - t) + B * (s) * (1 - t) + C * (1 - s) * t + D * (s) * (t);
-				result.setPixel(i + kFaceOffsets[face].x, j + kFaceOffsets[face].y, color);
+				std::reverse(row, row + faceSize);
+				j = faceSize - 1 - j;
 			}
-		};
-	}
+			if (addAlpha)
+			{
+				for (int i = 0; i != faceSize; i++)
+					row[i].w = 1.0f;
+			}
+			convertVec4ToPixels(row, fmt, comp, faces + (size_t(cubeFace) * faceSize + j) * rowSize, faceSize);
 
-	return result;
+			if (j / 2 < mipSize)
+			{
+				const size_t mipRow = size_t(cubeFace) * mipSize + j / 2;
+				vec4* out = mip.data() + mipRow * mipSize;
+				std::lock_guard lock(mipRowLocks[mipRow]);
+				for (int i = 0; i != mipSize; i++)
+					out[i] += 0.25f * (row[2 * i] + row[2 * i + 1]);
+			}
+		}
+	);
+
+	faces += 6 * size_t(faceSize) * rowSize;
+
+	std::vector<vec4> nextMip;
+
+	for (int level = 1; level < numMipLevels; level++)
+	{
+		const int size = faceSize >> level;
+		const size_t numPixels = 6 * size_t(size) * size;
+
+		convertVec4ToPixels(mip.data(), fmt, comp, faces, numPixels);
+		faces += numPixels * pixelSize;
+
+		if (level + 1 < numMipLevels)
+		{
+			nextMip.resize(6 * size_t(size / 2) * (size / 2));
+			downsampleCubeMapFaces(executor, mip.data(), size, nextMip.data(), size / 2);
+			std::swap(mip, nextMip);
+		}
+	}
 }
 
 Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
@@ -110,60 +428,73 @@ Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
 			------
 	*/
 
-	const int pixelSize = cubemap.comp_ * Bitmap::getBytesPerComponent(cubemap.fmt_);
+	const int pixelSize = cubemap.getBytesPerPixel();
+	const size_t rowSize = size_t(faceWidth) * pixelSize;
 
 	for (int face = 0; face != 6; ++face)
 	{
 		for (int j = 0; j != faceHeight; ++j)
 		{
-			for (int i = 0; i != faceWidth; ++i)
+			// the first pixel of the row in the cross, and whether the row is mirrored
+			int x = 0;
+			int y = 0;
+			bool mirrored = false;
+
+			switch (face)
 			{
-				int x = 0;
-				int y = 0;
+				// GL_TEXTURE_CUBE_MAP_POSITIVE_X
+			case 0:
+				x = 0;
+				y = faceHeight + j;
+				break;
 
-				switch (face)
-				{
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_X
-				case 0:
-					x = i;
-					y = faceHeight + j;
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_X
-				case 1:
-					x = 2 * faceWidth + i;
-					y = 1 * faceHeight + j;
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_Y
-				case 2:
-					x = 2 * faceWidth - (i + 1);
-					y = 1 * faceHeight - (j + 1);
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
-				case 3:
-					x = 2 * faceWidth - (i + 1);
-					y = 3 * faceHeight - (j + 1);
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_Z
-				case 4:
-					x = 2 * faceWidth - (i + 1);
-					y = b.h_ - (j + 1);
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-				case 5:
-					x = faceWidth + i;
-					y = faceHeight + j;
-					break;
-				}
+				// GL_TEXTURE_CUBE_MAP_NEGATIVE_X
+			case 1:
+				x = 2 * faceWidth;
+				y = 1 * faceHeight + j;
+				break;
 
-				memcpy(dst, src + (y * b.w_ + x) * pixelSize, pixelSize);
+				// GL_TEXTURE_CUBE_MAP_POSITIVE_Y
+			case 2:
+				x = 2 * faceWidth - 1;
+				y = 1 * faceHeight - (j + 1);
+				mirrored = true;
+				break;
 
-				dst += pixelSize;
+				// GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
+			case 3:
+				x = 2 * faceWidth - 1;
+				y = 3 * faceHeight - (j + 1);
+				mirrored = true;
+				break;
+
+				// GL_TEXTURE_CUBE_MAP_POSITIVE_Z
+			case 4:
+				x = 2 * faceWidth - 1;
+				y = b.h_ - (j + 1);
+				mirrored = true;
+				break;
+
+				// GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+			case 5:
+				x = faceWidth;
+				y = faceHeight + j;
+				break;
 			}
+
+			const uint8_t* srcRow = src + (size_t(y) * b.w_ + x) * pixelSize;
+
+			if (mirrored)
+			{
+				for (int i = 0; i != faceWidth; ++i)
+					memcpy(dst + size_t(i) * pixelSize, srcRow - size_t(i) * pixelSize, pixelSize);
+			}
+			else
+			{
+				memcpy(dst, srcRow, rowSize);
+			}
+
+			dst += rowSize;
 		}
 	}
 
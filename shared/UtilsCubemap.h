@@ -4,3 +4,17 @@
 
 Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b);
 Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b);
+
+/* The same cube map faces as convertVerticalCrossToCubeMapFaces(convertEquirectangularMapToVerticalCross(b)), without the cross in between */
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b);
+
+/*
+	Write the cube map faces of the equirectangular map 'b' to 'dst', converted to 'comp' components of 'fmt' (new alpha
+	components are opaque). The mip levels go one after another, every level is 6 faces of (faceSize >> level)^2 pixels.
+	This is the staging buffer layout of copyMIPBufferToImage(), so the faces can be written right into mapped memory.
+	The mip levels are box filtered from the previous level in a scratch buffer, 'dst' is never read.
+*/
+void convertEquirectangularMapToCubeMapFaces(const Bitmap& b, void* dst, int comp, eBitmapFormat fmt, int numMipLevels = 1);
+
+/* The size of 'dst' above in bytes, the face size of an equirectangular map is its width / 4 */
+size_t getCubeMapFacesSize(int faceSize, int comp, eBitmapFormat fmt, int numMipLevels = 1);
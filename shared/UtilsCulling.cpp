@@ -0,0 +1,661 @@
+#include "shared/UtilsCulling.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__AVX__)
+#	define CULLING_USE_AVX 1
+#	include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define CULLING_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
+void BoundingBoxSoA::resize(size_t numBoxes)
+{
+	size_ = numBoxes;
+
+	const size_t paddedSize = (numBoxes + 7) & ~size_t(7);
+
+	for (auto* v: { &minX_, &minY_, &minZ_, &maxX_, &maxY_, &maxZ_ })
+		v->resize(paddedSize, 0.0f);
+}
+
+void BoundingBoxSoA::set(size_t i, const BoundingBox& box)
+{
+	minX_[i] = box.min_.x;
+	minY_[i] = box.min_.y;
+	minZ_[i] = box.min_.z;
+	maxX_[i] = box.max_.x;
+	maxY_[i] = box.max_.y;
+	maxZ_[i] = box.max_.z;
+}
+
+void BoundingBoxSoA::assign(const std::vector<BoundingBox>& boxes)
+{
+	resize(boxes.size());
+
+	for (size_t i = 0; i != boxes.size(); i++)
+		set(i, boxes[i]);
+}
+
+namespace
+{
+	/* The plane coefficients and the arrays with the positive corners of all the boxes for this plane */
+	struct CullingPlane
+	{
+		vec4 plane;
+		const float* x;
+		const float* y;
+		const float* z;
+	};
+
+	/* Everything which does not depend on the range of boxes being culled */
+	struct CullingSetup
+	{
+		CullingPlane planes[6];
+		bool testCorners;
+		BoundingBox corners;
+	};
+
+	/* All the frustum corners are on one side of a box if the bounding box of the corners is */
+	BoundingBox getCornersBox(const vec4* frustumCorners)
+	{
+		vec3 points[8];
+		for (int i = 0; i != 8; i++)
+			points[i] = vec3(frustumCorners[i]);
+
+		return BoundingBox(points, 8);
+	}
+
+	CullingSetup setupCulling(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes)
+	{
+		CullingSetup setup;
+
+		for (int p = 0; p != 6; p++)
+		{
+			const vec4& n = frustumPlanes[p];
+			setup.planes[p] = CullingPlane {
+				.plane = n,
+				.x = (n.x > 0.0f ? boxes.maxX_ : boxes.minX_).data(),
+				.y = (n.y > 0.0f ? boxes.maxY_ : boxes.minY_).data(),
+				.z = (n.z > 0.0f ? boxes.maxZ_ : boxes.minZ_).data()
+			};
+		}
+
+		setup.testCorners = frustumCorners != nullptr;
+		setup.corners = frustumCorners ? getCornersBox(frustumCorners) : BoundingBox();
+
+		return setup;
+	}
+
+	/* Clear the bits of the padding boxes after 'last' and count the visible boxes in [first, last) */
+	uint32_t finalizeVisibility(size_t first, size_t last, uint64_t* visibility)
+	{
+		if (last & 63)
+			visibility[last >> 6] &= (1ull << (last & 63)) - 1;
+
+		uint32_t numVisible = 0;
+		for (size_t w = first >> 6; w != (last + 63) >> 6; w++)
+			numVisible += (uint32_t)std::popcount(visibility[w]);
+
+		return numVisible;
+	}
+
+	uint32_t cullRangeScalar(const CullingSetup& setup, const BoundingBoxSoA& boxes, size_t first, size_t last, uint64_t* visibility)
+	{
+		const CullingPlane* planes = setup.planes;
+		const BoundingBox& corners = setup.corners;
+
+		for (size_t i = first; i != last; i++)
+		{
+			bool outside = false;
+
+			// the same order of operations as in glm::dot()
+			for (int p = 0; p != 6 && !outside; p++)
+			{
+				const vec4& n = planes[p].plane;
+				outside = ((n.x * planes[p].x[i] + n.y * planes[p].y[i]) + (n.z * planes[p].z[i] + n.w)) < 0.0f;
+			}
+
+			if (!outside && setup.testCorners)
+			{
+				outside =
+					corners.min_.x > boxes.maxX_[i] || corners.max_.x < boxes.minX_[i] ||
+					corners.min_.y > boxes.maxY_[i] || corners.max_.y < boxes.minY_[i] ||
+					corners.min_.z > boxes.maxZ_[i] || corners.max_.z < boxes.minZ_[i];
+			}
+
+			if (!outside)
+				visibility[i >> 6] |= 1ull << (i & 63);
+		}
+
+		return finalizeVisibility(first, last, visibility);
+	}
+
+#if defined(CULLING_USE_AVX)
+
+	uint32_t cullRange(const CullingSetup& setup, const BoundingBoxSoA& boxes, size_t first, size_t last, uint64_t* visibility)
+	{
+		const CullingPlane* planes = setup.planes;
+
+		__m256 nx[6], ny[6], nz[6], nw[6];
+		for (int p = 0; p != 6; p++)
+		{
+			nx[p] = _mm256_set1_ps(planes[p].plane.x);
+			ny[p] = _mm256_set1_ps(planes[p].plane.y);
+			nz[p] = _mm256_set1_ps(planes[p].plane.z);
+			nw[p] = _mm256_set1_ps(planes[p].plane.w);
+		}
+
+		const BoundingBox& corners = setup.corners;
+
+		const __m256 cornersMinX = _mm256_set1_ps(corners.min_.x), cornersMaxX = _mm256_set1_ps(corners.max_.x);
+		const __m256 cornersMinY = _mm256_set1_ps(corners.min_.y), cornersMaxY = _mm256_set1_ps(corners.max_.y);
+		const __m256 cornersMinZ = _mm256_set1_ps(corners.min_.z), cornersMaxZ = _mm256_set1_ps(corners.max_.z);
+
+		const __m256 zero = _mm256_setzero_ps();
+
+		for (size_t i = first; i < last; i += 8)
+		{
+			__m256 outside = zero;
+
+			for (int p = 0; p != 6; p++)
+			{
+				const __m256 dxy = _mm256_add_ps(_mm256_mul_ps(nx[p], _mm256_loadu_ps(planes[p].x + i)), _mm256_mul_ps(ny[p], _mm256_loadu_ps(planes[p].y + i)));
+				const __m256 dzw = _mm256_add_ps(_mm256_mul_ps(nz[p], _mm256_loadu_ps(planes[p].z + i)), nw[p]);
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(dxy, dzw), zero, _CMP_LT_OQ));
+			}
+
+			if (setup.testCorners)
+			{
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(cornersMinX, _mm256_loadu_ps(&boxes.maxX_[i]), _CMP_GT_OQ));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(cornersMaxX, _mm256_loadu_ps(&boxes.minX_[i]), _CMP_LT_OQ));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(cornersMinY, _mm256_loadu_ps(&boxes.maxY_[i]), _CMP_GT_OQ));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(cornersMaxY, _mm256_loadu_ps(&boxes.minY_[i]), _CMP_LT_OQ));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(cornersMinZ, _mm256_loadu_ps(&boxes.maxZ_[i]), _CMP_GT_OQ));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(cornersMaxZ, _mm256_loadu_ps(&boxes.minZ_[i]), _CMP_LT_OQ));
+			}
+
+			const uint64_t mask = (uint64_t)(~_mm256_movemask_ps(outside) & 0xFF);
+			visibility[i >> 6] |= mask << (i & 63);
+		}
+
+		return finalizeVisibility(first, last, visibility);
+	}
+
+#elif defined(CULLING_USE_SSE)
+
+	uint32_t cullRange(const CullingSetup& setup, const BoundingBoxSoA& boxes, size_t first, size_t last, uint64_t* visibility)
+	{
+		const CullingPlane* planes = setup.planes;
+
+		__m128 nx[6], ny[6], nz[6], nw[6];
+		for (int p = 0; p != 6; p++)
+		{
+			nx[p] = _mm_set1_ps(planes[p].plane.x);
+			ny[p] = _mm_set1_ps(planes[p].plane.y);
+			nz[p] = _mm_set1_ps(planes[p].plane.z);
+			nw[p] = _mm_set1_ps(planes[p].plane.w);
+		}
+
+		const BoundingBox& corners = setup.corners;
+
+		const __m128 cornersMinX = _mm_set1_ps(corners.min_.x), cornersMaxX = _mm_set1_ps(corners.max_.x);
+		const __m128 cornersMinY = _mm_set1_ps(corners.min_.y), cornersMaxY = _mm_set1_ps(corners.max_.y);
+		const __m128 cornersMinZ = _mm_set1_ps(corners.min_.z), cornersMaxZ = _mm_set1_ps(corners.max_.z);
+
+		const __m128 zero = _mm_setzero_ps();
+
+		for (size_t i = first; i < last; i += 4)
+		{
+			__m128 outside = zero;
+
+			for (int p = 0; p != 6; p++)
+			{
+				const __m128 dxy = _mm_add_ps(_mm_mul_ps(nx[p], _mm_loadu_ps(planes[p].x + i)), _mm_mul_ps(ny[p], _mm_loadu_ps(planes[p].y + i)));
+				const __m128 dzw = _mm_add_ps(_mm_mul_ps(nz[p], _mm_loadu_ps(planes[p].z + i)), nw[p]);
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dxy, dzw), zero));
+			}
+
+			if (setup.testCorners)
+			{
+				outside = _mm_or_ps(outside, _mm_cmpgt_ps(cornersMinX, _mm_loadu_ps(&boxes.maxX_[i])));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(cornersMaxX, _mm_loadu_ps(&boxes.minX_[i])));
+				outside = _mm_or_ps(outside, _mm_cmpgt_ps(cornersMinY, _mm_loadu_ps(&boxes.maxY_[i])));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(cornersMaxY, _mm_loadu_ps(&boxes.minY_[i])));
+				outside = _mm_or_ps(outside, _mm_cmpgt_ps(cornersMinZ, _mm_loadu_ps(&boxes.maxZ_[i])));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(cornersMaxZ, _mm_loadu_ps(&boxes.minZ_[i])));
+			}
+
+			const uint64_t mask = (uint64_t)(~_mm_movemask_ps(outside) & 0xF);
+			visibility[i >> 6] |= mask << (i & 63);
+		}
+
+		return finalizeVisibility(first, last, visibility);
+	}
+
+#else
+
+	uint32_t cullRange(const CullingSetup& setup, const BoundingBoxSoA& boxes, size_t first, size_t last, uint64_t* visibility)
+	{
+		return cullRangeScalar(setup, boxes, first, last, visibility);
+	}
+
+#endif
+}
+
+uint32_t cullBoxesInFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, std::vector<uint64_t>& visibility)
+{
+	visibility.assign((boxes.size() + 63) >> 6, 0);
+
+	return cullRange(setupCulling(frustumPlanes, frustumCorners, boxes), boxes, 0, boxes.size(), visibility.data());
+}
+
+uint32_t cullBoxesInFrustumScalar(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, std::vector<uint64_t>& visibility)
+{
+	visibility.assign((boxes.size() + 63) >> 6, 0);
+
+	return cullRangeScalar(setupCulling(frustumPlanes, frustumCorners, boxes), boxes, 0, boxes.size(), visibility.data());
+}
+
+uint32_t compactVisibleCommands(const uint64_t* visibility, size_t first, size_t last, const void* commands, size_t commandSize, void* output)
+{
+	const uint8_t* src = (const uint8_t*)commands;
+	uint8_t* dst = (uint8_t*)output;
+
+	uint32_t numVisible = 0;
+
+	for (size_t w = first >> 6; w != (last + 63) >> 6; w++)
+	{
+		for (uint64_t bits = visibility[w]; bits; bits &= bits - 1)
+		{
+			const size_t i = (w << 6) + std::countr_zero(bits);
+			memcpy(dst, src + i * commandSize, commandSize);
+			dst += commandSize;
+			numVisible++;
+		}
+	}
+
+	return numVisible;
+}
+
+namespace
+{
+	/* Planes for testing a box swept along 'dir' by 'length' with the usual box test */
+	void sweepPlanes(const vec4* planes, const vec3& dir, float length, vec4* sweptPlanes)
+	{
+		for (int p = 0; p != 6; p++)
+		{
+			sweptPlanes[p] = planes[p];
+			sweptPlanes[p].w += std::max(0.0f, length * glm::dot(vec3(planes[p]), dir));
+		}
+	}
+
+	/* The planes facing inside the box, so a box overlaps 'box' if it is "inside" all of them */
+	void getBoxPlanes(const BoundingBox& box, vec4* planes)
+	{
+		planes[0] = vec4( 1.0f,  0.0f,  0.0f, -box.min_.x);
+		planes[1] = vec4(-1.0f,  0.0f,  0.0f,  box.max_.x);
+		planes[2] = vec4( 0.0f,  1.0f,  0.0f, -box.min_.y);
+		planes[3] = vec4( 0.0f, -1.0f,  0.0f,  box.max_.y);
+		planes[4] = vec4( 0.0f,  0.0f,  1.0f, -box.min_.z);
+		planes[5] = vec4( 0.0f,  0.0f, -1.0f,  box.max_.z);
+	}
+}
+
+uint32_t cullShadowCasters(const vec4* lightFrustumPlanes, const vec3& lightDir, float sweepLength, const vec4* cameraFrustumPlanes, const BoundingBox* receiversBox, const BoundingBoxSoA& boxes, std::vector<uint64_t>& visibility)
+{
+	uint32_t numVisible = cullBoxesInFrustum(lightFrustumPlanes, nullptr, boxes, visibility);
+
+	std::vector<uint64_t> mask;
+	vec4 planes[6];
+
+	auto cullSwept = [&](const vec4* receiverPlanes)
+	{
+		sweepPlanes(receiverPlanes, lightDir, sweepLength, planes);
+		cullBoxesInFrustum(planes, nullptr, boxes, mask);
+
+		numVisible = 0;
+		for (size_t w = 0; w != visibility.size(); w++)
+		{
+			visibility[w] &= mask[w];
+			numVisible += (uint32_t)std::popcount(visibility[w]);
+		}
+	};
+
+	if (cameraFrustumPlanes && numVisible)
+		cullSwept(cameraFrustumPlanes);
+
+	if (receiversBox && numVisible)
+	{
+		vec4 boxPlanes[6];
+		getBoxPlanes(*receiversBox, boxPlanes);
+		cullSwept(boxPlanes);
+	}
+
+	return numVisible;
+}
+
+BoundingSphere::BoundingSphere(const BoundingBox& localBox, const glm::mat4& model)
+{
+	const float scale = std::max({ glm::length(vec3(model[0])), glm::length(vec3(model[1])), glm::length(vec3(model[2])) });
+
+	center_ = vec3(model * vec4(localBox.getCenter(), 1.0f));
+	radius_ = 0.5f * glm::length(localBox.getSize()) * scale;
+}
+
+OrientedBoundingBox::OrientedBoundingBox(const BoundingBox& localBox, const glm::mat4& model)
+{
+	const vec3 halfSize = 0.5f * localBox.getSize();
+
+	center_ = vec3(model * vec4(localBox.getCenter(), 1.0f));
+
+	for (int i = 0; i != 3; i++)
+		axes_[i] = vec3(model[i]) * halfSize[i];
+}
+
+BoundingBox OrientedBoundingBox::getBoundingBox() const
+{
+	const vec3 extent = glm::abs(axes_[0]) + glm::abs(axes_[1]) + glm::abs(axes_[2]);
+
+	return BoundingBox(center_ - extent, center_ + extent);
+}
+
+namespace
+{
+	bool overlapsCorners(const BoundingBox& corners, const vec3& boxMin, const vec3& boxMax)
+	{
+		return
+			corners.min_.x <= boxMax.x && corners.max_.x >= boxMin.x &&
+			corners.min_.y <= boxMax.y && corners.max_.y >= boxMin.y &&
+			corners.min_.z <= boxMax.z && corners.max_.z >= boxMin.z;
+	}
+
+	/* 'isInside(i)' tests the volume 'i' against the planes and the corners box, the bits are gathered one word at a time */
+	template <typename TestFunc>
+	uint32_t cullVolumes(size_t numVolumes, std::vector<uint64_t>& visibility, TestFunc isInside)
+	{
+		visibility.assign((numVolumes + 63) >> 6, 0);
+
+		uint32_t numVisible = 0;
+
+		for (size_t w = 0; w != visibility.size(); w++)
+		{
+			const size_t first = w << 6;
+			const size_t last = std::min(first + 64, numVolumes);
+
+			uint64_t bits = 0;
+			for (size_t i = first; i != last; i++)
+				bits |= (uint64_t)isInside(i) << (i - first);
+
+			visibility[w] = bits;
+			numVisible += (uint32_t)std::popcount(bits);
+		}
+
+		return numVisible;
+	}
+}
+
+uint32_t cullSpheresInFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const std::vector<BoundingSphere>& spheres, std::vector<uint64_t>& visibility)
+{
+	// the distances are compared with the radii, so the planes have to be normalized
+	vec4 planes[6];
+	for (int p = 0; p != 6; p++)
+		planes[p] = frustumPlanes[p] / glm::length(vec3(frustumPlanes[p]));
+
+	const BoundingBox corners = frustumCorners ? getCornersBox(frustumCorners) : BoundingBox();
+
+	return cullVolumes(spheres.size(), visibility, [&](size_t i)
+		{
+			const BoundingSphere& s = spheres[i];
+
+			for (int p = 0; p != 6; p++)
+			{
+				const vec4& n = planes[p];
+				if (n.x * s.center_.x + n.y * s.center_.y + n.z * s.center_.z + n.w < -s.radius_)
+					return false;
+			}
+
+			return !frustumCorners || overlapsCorners(corners, s.center_ - vec3(s.radius_), s.center_ + vec3(s.radius_));
+		});
+}
+
+uint32_t cullOrientedBoxesInFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const std::vector<OrientedBoundingBox>& boxes, std::vector<uint64_t>& visibility)
+{
+	const BoundingBox corners = frustumCorners ? getCornersBox(frustumCorners) : BoundingBox();
+
+	return cullVolumes(boxes.size(), visibility, [&](size_t i)
+		{
+			const OrientedBoundingBox& b = boxes[i];
+
+			for (int p = 0; p != 6; p++)
+			{
+				// the planes do not need to be normalized, both sides are scaled by the length of the normal
+				const vec4& n = frustumPlanes[p];
+				const float radius =
+					fabsf(n.x * b.axes_[0].x + n.y * b.axes_[0].y + n.z * b.axes_[0].z) +
+					fabsf(n.x * b.axes_[1].x + n.y * b.axes_[1].y + n.z * b.axes_[1].z) +
+					fabsf(n.x * b.axes_[2].x + n.y * b.axes_[2].y + n.z * b.axes_[2].z);
+				if (n.x * b.center_.x + n.y * b.center_.y + n.z * b.center_.z + n.w < -radius)
+					return false;
+			}
+
+			if (!frustumCorners)
+				return true;
+
+			const BoundingBox box = b.getBoundingBox();
+
+			return overlapsCorners(corners, box.min_, box.max_);
+		});
+}
+
+uint32_t ParallelFrustumCuller::cull(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, const void* commands, size_t commandSize, void* output)
+{
+	const size_t numBoxes = boxes.size();
+
+	visibility_.assign((numBoxes + 63) >> 6, 0);
+
+	if (!numBoxes)
+		return 0;
+
+	// a few chunks per worker to balance the load, and whole visibility words per chunk so the chunks never write to the same word
+	const size_t chunkSize = std::max(kMinCullingChunkSize, ((numBoxes + 4 * executor_.num_workers() - 1) / (4 * executor_.num_workers()) + 63) & ~size_t(63));
+	const int numChunks = (int)((numBoxes + chunkSize - 1) / chunkSize);
+
+	chunkOffsets_.resize(numChunks + 1);
+
+	const CullingSetup setup = setupCulling(frustumPlanes, frustumCorners, boxes);
+
+	uint64_t* visibility = visibility_.data();
+	uint32_t* offsets = chunkOffsets_.data();
+
+	auto cullChunk = [&](int c)
+	{
+		const size_t first = c * chunkSize;
+		offsets[c + 1] = cullRange(setup, boxes, first, std::min(first + chunkSize, numBoxes), visibility);
+	};
+
+	auto compactChunk = [&](int c)
+	{
+		const size_t first = c * chunkSize;
+		compactVisibleCommands(visibility, first, std::min(first + chunkSize, numBoxes), commands, commandSize, (uint8_t*)output + offsets[c] * commandSize);
+	};
+
+	offsets[0] = 0;
+
+	// small scenes are not worth waking up the workers
+	if (numChunks == 1)
+	{
+		cullChunk(0);
+		if (output)
+			compactChunk(0);
+		return offsets[1];
+	}
+
+	tf::Taskflow taskflow;
+
+	tf::Task cullTask = taskflow.for_each_index(0, numChunks, 1, cullChunk);
+
+	tf::Task prefixSumTask = taskflow.emplace([&]()
+		{
+			for (int c = 0; c != numChunks; c++)
+				offsets[c + 1] += offsets[c];
+		}
+	);
+
+	cullTask.precede(prefixSumTask);
+
+	if (output)
+	{
+		tf::Task compactTask = taskflow.for_each_index(0, numChunks, 1, compactChunk);
+		prefixSumTask.precede(compactTask);
+	}
+
+	executor_.run(taskflow).wait();
+
+	return offsets[numChunks];
+}
+
+void FrustumCullingCache::setBoxes(const std::vector<BoundingBox>& boxes)
+{
+	boxes_ = boxes;
+
+	if (!boxes.empty())
+	{
+		const BoundingBox scene = combineBoxes(boxes);
+		sceneCenter_ = scene.getCenter();
+		sceneExtent_ = 0.5f * scene.getSize();
+	}
+
+	invalidate();
+}
+
+void FrustumCullingCache::invalidate()
+{
+	validUntil_.assign(boxes_.size(), 0.0);
+	visibility_.assign((boxes_.size() + 63) >> 6, 0);
+
+	hasPrevPlanes_ = false;
+	drift_ = 0.0;
+}
+
+uint32_t FrustumCullingCache::cull(const vec4* frustumPlanes, const vec4* frustumCorners, std::vector<uint64_t>& visibility)
+{
+	// the margins are distances, so they need normalized planes
+	vec4 planes[6];
+	for (int p = 0; p != 6; p++)
+		planes[p] = frustumPlanes[p] / glm::length(vec3(frustumPlanes[p]));
+
+	if (hasPrevPlanes_)
+	{
+		// the largest change of the distance to any plane for all the points inside the scene bounds
+		double maxDelta = 0.0;
+		for (int p = 0; p != 6; p++)
+		{
+			const vec3 dn = vec3(planes[p]) - vec3(prevPlanes_[p]);
+			const float dw = planes[p].w - prevPlanes_[p].w;
+			const double delta = std::abs(glm::dot(dn, sceneCenter_) + dw) + glm::dot(glm::abs(dn), sceneExtent_);
+			maxDelta = std::max(maxDelta, delta);
+		}
+		drift_ += maxDelta;
+	}
+	else
+	{
+		// nothing is known about the previous planes, so all the cached results are stale
+		std::fill(validUntil_.begin(), validUntil_.end(), 0.0);
+	}
+
+	for (int p = 0; p != 6; p++)
+		prevPlanes_[p] = planes[p];
+	hasPrevPlanes_ = true;
+
+	const BoundingBox corners = frustumCorners ? getCornersBox(frustumCorners) : BoundingBox();
+
+	stats_.reused_ = 0;
+	stats_.retested_ = 0;
+
+	for (size_t w = 0; w != visibility_.size(); w++)
+	{
+		const size_t first = w << 6;
+		const size_t last = std::min(first + 64, boxes_.size());
+
+		// branchless, so that the check of the cached results can be vectorized
+		uint64_t stale = 0;
+		for (size_t i = first; i != last; i++)
+			stale |= (uint64_t)(drift_ >= validUntil_[i]) << (i - first);
+
+		const uint32_t numStale = (uint32_t)std::popcount(stale);
+		stats_.retested_ += numStale;
+		stats_.reused_ += (uint32_t)(last - first) - numStale;
+
+		for (; stale; stale &= stale - 1)
+		{
+			const int b = std::countr_zero(stale);
+			const size_t i = first + b;
+			const uint64_t bit = 1ull << b;
+
+			const BoundingBox& box = boxes_[i];
+
+			float outsideMargin = 0.0f;
+			float insideMargin = std::numeric_limits<float>::max();
+			bool visible = true;
+
+			for (int p = 0; p != 6; p++)
+			{
+				const vec4& n = planes[p];
+				const float maxDist = (n.x * (n.x > 0.0f ? box.max_.x : box.min_.x) + n.y * (n.y > 0.0f ? box.max_.y : box.min_.y)) + (n.z * (n.z > 0.0f ? box.max_.z : box.min_.z) + n.w);
+				const float minDist = (n.x * (n.x > 0.0f ? box.min_.x : box.max_.x) + n.y * (n.y > 0.0f ? box.min_.y : box.max_.y)) + (n.z * (n.z > 0.0f ? box.min_.z : box.max_.z) + n.w);
+
+				if (maxDist < 0.0f)
+				{
+					visible = false;
+					outsideMargin = std::max(outsideMargin, -maxDist);
+				}
+
+				insideMargin = std::min(insideMargin, minDist);
+			}
+
+			double margin = 0.0;
+
+			if (!visible)
+			{
+				margin = outsideMargin;
+			}
+			else if (insideMargin > 0.0f)
+			{
+				// completely inside the frustum, so it cannot be rejected by the frustum corners either
+				margin = insideMargin;
+			}
+			else if (frustumCorners)
+			{
+				// a boundary box, the result is not cached
+				visible =
+					corners.min_.x <= box.max_.x && corners.max_.x >= box.min_.x &&
+					corners.min_.y <= box.max_.y && corners.max_.y >= box.min_.y &&
+					corners.min_.z <= box.max_.z && corners.max_.z >= box.min_.z;
+			}
+
+			validUntil_[i] = drift_ + margin;
+
+			if (visible)
+				visibility_[w] |= bit;
+			else
+				visibility_[w] &= ~bit;
+		}
+	}
+
+	uint32_t numVisible = 0;
+	for (uint64_t v: visibility_)
+		numVisible += (uint32_t)std::popcount(v);
+
+	stats_.totalReused_ += stats_.reused_;
+	stats_.totalRetested_ += stats_.retested_;
+
+	visibility = visibility_;
+
+	return numVisible;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <taskflow/taskflow.hpp>
+
+#include "shared/UtilsMath.h"
+
+/*
+	Batch frustum culling.
+
+	The boxes are stored as separate arrays of coordinates (SoA), so 4 (SSE) or 8 (AVX) boxes are tested against a plane
+	with a few vector instructions. For every plane the "positive" corner of all the boxes is taken from either the min or
+	the max array depending on the sign of the plane normal, which gives exactly the same result as the 8 corner tests
+	in isBoxInFrustum().
+*/
+
+struct BoundingBoxSoA
+{
+	std::vector<float> minX_, minY_, minZ_;
+	std::vector<float> maxX_, maxY_, maxZ_;
+
+	size_t size() const { return size_; }
+
+	// The arrays are padded to a multiple of 8 boxes, so the SIMD loops do not need a remainder
+	void resize(size_t numBoxes);
+	void set(size_t i, const BoundingBox& box);
+	void assign(const std::vector<BoundingBox>& boxes);
+
+private:
+	size_t size_ = 0;
+};
+
+// Bit 'i % 64' of 'visibility[i / 64]' is set if the box 'i' is (potentially) visible
+inline bool isVisible(const std::vector<uint64_t>& visibility, size_t i)
+{
+	return (visibility[i >> 6] >> (i & 63)) & 1;
+}
+
+/*
+	Test all the boxes against the 6 frustum planes and fill the visibility bitmask. Returns the number of visible boxes.
+	If 'frustumCorners' is not null, the boxes which pass the plane test are also tested against the bounding box of the
+	frustum corners (the second part of isBoxInFrustum()) which rejects the large boxes near the frustum corners.
+*/
+uint32_t cullBoxesInFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, std::vector<uint64_t>& visibility);
+
+// The same test without SIMD (used on the platforms without SSE, and for comparison)
+uint32_t cullBoxesInFrustumScalar(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, std::vector<uint64_t>& visibility);
+
+/*
+	Copy the commands of the visible boxes in [first, last) to 'output' keeping their order ('first' is a multiple of 64).
+	'commands' holds one command of 'commandSize' bytes for every box. Returns the number of copied commands.
+*/
+uint32_t compactVisibleCommands(const uint64_t* visibility, size_t first, size_t last, const void* commands, size_t commandSize, void* output);
+
+/*
+	Reference implementation of the compaction for testing the optimized (or GPU) ones: the visible commands one by one
+	in their order. Returns the draw count, i.e. the value of the count buffer for vkCmdDrawIndirectCountKHR().
+*/
+template <typename CommandT>
+uint32_t compactVisibleCommandsReference(const std::vector<uint64_t>& visibility, const std::vector<CommandT>& commands, std::vector<CommandT>& output)
+{
+	output.clear();
+	for (size_t i = 0; i != commands.size(); i++)
+		if (isVisible(visibility, i))
+			output.push_back(commands[i]);
+	return (uint32_t)output.size();
+}
+
+/*
+	Bounding volumes built from the object-space box of a mesh and its model matrix.
+
+	A world-space axis-aligned box around a rotated mesh can be much larger than the mesh itself, and it has to be
+	recalculated from all 8 corners whenever the node moves. An oriented box keeps the object-space fit and is just the
+	columns of the model matrix scaled by the half-extents. A sphere is looser, but it is the cheapest to test.
+*/
+struct BoundingSphere
+{
+	vec3 center_;
+	float radius_;
+	BoundingSphere() = default;
+	BoundingSphere(const vec3& center, float radius) : center_(center), radius_(radius) {}
+	// the radius is scaled by the largest axis scale, so non-uniform scaling is conservative
+	BoundingSphere(const BoundingBox& localBox, const glm::mat4& model);
+};
+
+struct OrientedBoundingBox
+{
+	vec3 center_;
+	vec3 axes_[3]; // half-extents along the box axes in world space
+	OrientedBoundingBox() = default;
+	OrientedBoundingBox(const BoundingBox& localBox, const glm::mat4& model);
+	// the same as localBox.getTransformed(model)
+	BoundingBox getBoundingBox() const;
+};
+
+/*
+	The same as cullBoxesInFrustum() for the other bounding volumes. An oriented box is projected onto the plane normal
+	(the sum of the absolute projections of its axes), so the test is exact for every plane, just like for an AABB.
+*/
+uint32_t cullSpheresInFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const std::vector<BoundingSphere>& spheres, std::vector<uint64_t>& visibility);
+uint32_t cullOrientedBoxesInFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, const std::vector<OrientedBoundingBox>& boxes, std::vector<uint64_t>& visibility);
+
+/*
+	Shadow caster culling for a directional light.
+
+	A caster is kept if it is inside the light frustum and its shadow can reach the camera frustum. The shadow volume is
+	the box swept along 'lightDir' by 'sweepLength'. The farthest point of the swept box in front of a plane is the
+	farthest corner of the box moved by max(0, sweepLength * dot(n, lightDir)), so sweeping is just shifting the planes,
+	and the same exact box test as in cullBoxesInFrustum() is used. 'cameraFrustumPlanes' can be null. 'receiversBox'
+	(e.g. the bounds of the visible receivers) is optional and is tested in the same way as 6 more planes.
+*/
+uint32_t cullShadowCasters(const vec4* lightFrustumPlanes, const vec3& lightDir, float sweepLength, const vec4* cameraFrustumPlanes, const BoundingBox* receiversBox, const BoundingBoxSoA& boxes, std::vector<uint64_t>& visibility);
+
+/*
+	Multithreaded culling with compaction of indirect draw commands.
+
+	The boxes are split into chunks which are culled on a pool of worker threads. Every chunk counts its visible boxes,
+	a prefix sum over the chunks gives every chunk the first slot of its commands in the output, and then all the chunks
+	copy their visible commands in parallel. The output keeps the order of the commands and contains only the visible
+	ones, so the draw count is the number of visible boxes. The output can be a persistently mapped GPU buffer.
+*/
+class ParallelFrustumCuller final
+{
+public:
+	// Chunks are a multiple of 64 boxes, so different chunks never write to the same visibility word
+	static constexpr size_t kMinCullingChunkSize = 1024;
+
+	// The chunks are culled on the worker threads of 'executor', which can be shared with other systems
+	explicit ParallelFrustumCuller(tf::Executor& executor): executor_(executor) {}
+
+	/*
+		'commands' holds one command of 'commandSize' bytes for every box. The commands of the visible boxes are copied
+		to 'output', which should have room for all of them. If 'output' is null, only the visibility mask is calculated.
+		Returns the number of visible boxes.
+	*/
+	uint32_t cull(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, const void* commands, size_t commandSize, void* output);
+
+	template <typename CommandT>
+	uint32_t cull(const vec4* frustumPlanes, const vec4* frustumCorners, const BoundingBoxSoA& boxes, const std::vector<CommandT>& commands, CommandT* output)
+	{
+		return cull(frustumPlanes, frustumCorners, boxes, commands.data(), sizeof(CommandT), output);
+	}
+
+	// Visibility bitmask of the last cull() call (see isVisible())
+	const std::vector<uint64_t>& getVisibility() const { return visibility_; }
+
+private:
+	tf::Executor& executor_;
+
+	std::vector<uint64_t> visibility_;
+	std::vector<uint32_t> chunkOffsets_;
+};
+
+/*
+	Frustum culling which reuses the results of the previous frames.
+
+	Every box is classified against the normalized frustum planes as completely outside one plane, completely inside all
+	of them, or crossing the boundary. For the first two cases the distance to the nearest plane is a margin: the result
+	cannot change until the planes move further than that. Every frame the largest possible movement of the planes over
+	the scene bounds is added to the accumulated drift, and only the boxes whose margin is exhausted are tested again.
+	The boundary boxes are retested every frame with the same test as cullBoxesInFrustum().
+*/
+class FrustumCullingCache final
+{
+public:
+	struct Stats
+	{
+		uint32_t reused_ = 0;    // last frame
+		uint32_t retested_ = 0;  // last frame
+		uint64_t totalReused_ = 0;
+		uint64_t totalRetested_ = 0;
+	};
+
+	/* Set the world-space boxes to cull, this invalidates all the cached results */
+	void setBoxes(const std::vector<BoundingBox>& boxes);
+	void invalidate();
+
+	uint32_t cull(const vec4* frustumPlanes, const vec4* frustumCorners, std::vector<uint64_t>& visibility);
+
+	const Stats& getStats() const { return stats_; }
+
+private:
+	std::vector<BoundingBox> boxes_;
+
+	// the result of a box is valid while 'drift_' is less than this
+	std::vector<double> validUntil_;
+	std::vector<uint64_t> visibility_;
+
+	vec4 prevPlanes_[6];
+	bool hasPrevPlanes_ = false;
+	double drift_ = 0.0;
+
+	vec3 sceneCenter_ = vec3(0.0f);
+	vec3 sceneExtent_ = vec3(0.0f);
+
+	Stats stats_;
+};
@@ -1039,7 +1039,8 @@ bool createTextureSampler(VkDevice device,
                           VkSampler* sampler,
                           VkFilter minFilter,
                           VkFilter maxFilter,
-                          VkSamplerAddressMode addressMode)
+                          VkSamplerAddressMode addressMode,
+                          float maxLod)
 {
 	const VkSamplerCreateInfo samplerInfo = {
 		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
@@ -1057,7 +1058,7 @@ bool createTextureSampler(VkDevice device,
 		.compareEnable = VK_FALSE,
 		.compareOp = VK_COMPARE_OP_ALWAYS,
 		.minLod = 0.0f,
-		.maxLod = 0.0f,
+		.maxLod = maxLod,
 		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
 		.unnormalizedCoordinates = VK_FALSE
 	};
@@ -2635,25 +2636,6 @@ bool createTextureImageFromData(VulkanRenderDevice& vkDev,
 	                          imageData);
 }
 
-/**
- * \brief Given [float, float, float] stored in img24, compute [float, float, float, 1.0f] and put it in img32
- * \param w texture width
- * \param h texture height
- * \param img24 source raw data in [float, float, float]
- * \param img32 destination data in [float, float, float, 1.0f]
- */
-static void float24to32(int w, int h, const float* img24, float* img32)
-{
-	const int numPixels = w * h;
-	for (int i = 0; i != numPixels; i++)
-	{
-		*img32++ = *img24++;
-		*img32++ = *img24++;
-		*img32++ = *img24++;
-		*img32++ = 1.0f;
-	}
-}
-
 bool createMIPTextureImage(VulkanRenderDevice& vkDev, const char* filename, uint32_t mipLevels, VkImage& textureImage,
                            VkDeviceMemory& textureImageMemory, uint32_t* width, uint32_t* height)
 {
@@ -2850,6 +2832,45 @@ bool createPBRVertexBuffer(VulkanRenderDevice& vkDev, const char* filename, VkBu
 	return true;
 }
 
+/*
+	Create a cube map image with 'mipLevels' levels from the equirectangular map 'in'. The faces are converted right into
+	the mapped staging buffer, in the layout of copyMIPBufferToImage()
+*/
+static bool createCubeTextureImageFromEquirectangular(VulkanRenderDevice& vkDev, const Bitmap& in, uint32_t mipLevels,
+                                                      VkImage& textureImage, VkDeviceMemory& textureImageMemory)
+{
+	const VkFormat texFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+	const uint32_t faceSize = in.w_ / 4;
+
+	createImage(vkDev.device, vkDev.physicalDevice, faceSize, faceSize, texFormat, VK_IMAGE_TILING_OPTIMAL,
+	            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	            textureImage, textureImageMemory, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, mipLevels);
+
+	const VkDeviceSize imageSize = getCubeMapFacesSize(faceSize, 4, eBitmapFormat_Float, mipLevels);
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(vkDev.device, vkDev.physicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer,
+	             stagingBufferMemory);
+
+	void* mappedData = nullptr;
+	vkMapMemory(vkDev.device, stagingBufferMemory, 0, imageSize, 0, &mappedData);
+	convertEquirectangularMapToCubeMapFaces(in, mappedData, 4, eBitmapFormat_Float, mipLevels);
+	vkUnmapMemory(vkDev.device, stagingBufferMemory);
+
+	transitionImageLayout(vkDev, textureImage, texFormat, VK_IMAGE_LAYOUT_UNDEFINED,
+	                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 6, mipLevels);
+	copyMIPBufferToImage(vkDev, stagingBuffer, textureImage, mipLevels, faceSize, faceSize, bytesPerTexFormat(texFormat), 6);
+	transitionImageLayout(vkDev, textureImage, texFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 6, mipLevels);
+
+	vkDestroyBuffer(vkDev.device, stagingBuffer, nullptr);
+	vkFreeMemory(vkDev.device, stagingBufferMemory, nullptr);
+
+	return true;
+}
+
 bool createMIPCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename, uint32_t mipLevels,
                                VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t* width,
                                uint32_t* height)
@@ -2865,63 +2886,7 @@ bool createMIPCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename,
 		return false;
 	}
 
-	uint32_t imageSize = texWidth * texHeight * 4;
-	uint32_t mipSize = imageSize * 6;
-
-	uint32_t w = texWidth, h = texHeight;
-	for (uint32_t i = 1; i < mipLevels; i++)
-	{
-		imageSize = w * h * 4;
-		w >>= 1;
-		h >>= 1;
-		mipSize += imageSize;
-	}
-
-	std::vector<float> mipData(mipSize);
-	float* src = mipData.data();
-	float* dst = mipData.data();
-
-	w = texWidth;
-	h = texHeight;
-	float24to32(w, h, img, dst);
-
-	for (uint32_t i = 1; i < mipLevels; i++)
-	{
-		imageSize = w * h * 4;
-		dst += w * h * 4;
-		stbir_resize_float_generic(
-			src, w, h, 0, dst, w / 2, h / 2, 0, 4,
-			STBIR_ALPHA_CHANNEL_NONE, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_CUBICBSPLINE, STBIR_COLORSPACE_LINEAR, nullptr);
-
-		w >>= 1;
-		h >>= 1;
-		src = dst;
-	}
-
-	src = mipData.data();
-	dst = mipData.data();
-
-	std::vector<float> mipCube(mipSize * 6);
-	float* mip = mipCube.data();
-
-	w = texWidth;
-	h = texHeight;
-	uint32_t faceSize = w / 4;
-	for (uint32_t i = 0; i < mipLevels; i++)
-	{
-		Bitmap in(w, h, 4, eBitmapFormat_Float, src);
-		Bitmap out = convertEquirectangularMapToVerticalCross(in);
-		Bitmap cube = convertVerticalCrossToCubeMapFaces(out);
-
-		imageSize = faceSize * faceSize * 4;
-
-		memcpy(mip, cube.data_.data(), 6 * imageSize * sizeof(float));
-		mip += imageSize * 6;
-
-		src += w * h * 4;
-		w >>= 1;
-		h >>= 1;
-	}
+	Bitmap in(texWidth, texHeight, 3, eBitmapFormat_Float, img);
 
 	stbi_image_free((void*)img);
 
@@ -2931,11 +2896,8 @@ bool createMIPCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename,
 		*height = texHeight;
 	}
 
-	return createMIPTextureImageFromData(vkDev,
-	                                     textureImage, textureImageMemory,
-	                                     mipCube.data(), mipLevels, faceSize, faceSize,
-	                                     VK_FORMAT_R32G32B32A32_SFLOAT,
-	                                     6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+	// the mip levels are box filtered from the cube map faces
+	return createCubeTextureImageFromEquirectangular(vkDev, in, mipLevels, textureImage, textureImageMemory);
 }
 
 bool createCubeTextureImage(VulkanRenderDevice& vkDev,
@@ -2949,10 +2911,6 @@ bool createCubeTextureImage(VulkanRenderDevice& vkDev,
 	int w, h, comp;
 	const float* img = stbi_loadf(filename, &w, &h, &comp, 3);
 
-	// convert raw pixel data from [float, float, float] to [float, float, float, 1.0f]
-	std::vector<float> img32(w * h * 4);
-	float24to32(w, h, img, img32.data());
-
 	if (!img)
 	{
 		printf("Failed to load [%s] texture\n", filename);
@@ -2961,12 +2919,10 @@ bool createCubeTextureImage(VulkanRenderDevice& vkDev,
 		return false;
 	}
 
-	stbi_image_free((void*)img);
+	// [float, float, float] pixels, the alpha of the cube map faces is set to 1.0f during the conversion
+	Bitmap in(w, h, 3, eBitmapFormat_Float, img);
 
-	// convert HDR image into cube map faces: Equi => Vertical Cross => Cube Map Faces
-	Bitmap in(w, h, 4, eBitmapFormat_Float, img32.data());
-	Bitmap out = convertEquirectangularMapToVerticalCross(in);
-	Bitmap cube = convertVerticalCrossToCubeMapFaces(out);
+	stbi_image_free((void*)img);
 
 	// TODO: Why do we need this? 
 	if (width && height)
@@ -2975,15 +2931,7 @@ bool createCubeTextureImage(VulkanRenderDevice& vkDev,
 		*height = h;
 	}
 
-	return createTextureImageFromData(vkDev,
-	                                  textureImage,
-	                                  textureImageMemory,
-	                                  cube.data_.data(),
-	                                  cube.w_,
-	                                  cube.h_,
-	                                  VK_FORMAT_R32G32B32A32_SFLOAT,
-	                                  6,
-	                                  VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+	return createCubeTextureImageFromEquirectangular(vkDev, in, 1, textureImage, textureImageMemory);
 }
 
 bool executeComputeShader(VulkanRenderDevice& vkDev,
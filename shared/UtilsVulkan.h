@@ -208,7 +208,8 @@ VkResult createSemaphore(VkDevice device, VkSemaphore* outSemaphore);
 
 bool createTextureSampler(VkDevice device, VkSampler* sampler, VkFilter minFilter = VK_FILTER_LINEAR,
                           VkFilter maxFilter = VK_FILTER_LINEAR,
-                          VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
+                          VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+                          float maxLod = 0.0f);
 
 bool createDescriptorPool(VulkanRenderDevice& vkDev, uint32_t uniformBufferCount, uint32_t storageBufferCount,
                           uint32_t samplerCount, VkDescriptorPool* descriptorPool);
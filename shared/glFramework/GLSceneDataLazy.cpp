@@ -1,7 +1,10 @@
 ﻿#include <memory>
+#include <string.h>
 
 #include "GLSceneDataLazy.h"
 #include <stb/stb_image.h>
+#include <gli/gli.hpp>
+#include <gli/load_ktx.hpp>
 
 static uint64_t getTextureHandleBindless(uint64_t idx, const std::vector<std::shared_ptr<GLTexture>>& textures)
 {
@@ -30,8 +33,22 @@ GLSceneDataLazy::GLSceneDataLazy(
 
 	taskflow_.for_each_index(0u, (uint32_t)textureFiles_.size(), 1u, [this](int idx)
 		{
+			const char* fileName = this->textureFiles_[idx].c_str();
+			const char* ext = strrchr(fileName, '.');
+			if (ext && !strcmp(ext, ".ktx"))
+			{
+				auto ktx = std::make_shared<gli::texture>(gli::load_ktx(fileName));
+				if (ktx->empty())
+				{
+					fprintf(stderr, "WARNING: could not load KTX texture `%s`\n", fileName);
+					return;
+				}
+				std::lock_guard lock(loadedFilesMutex_);
+				loadedFiles_.emplace_back(LoadedImageData { .index_ = idx, .ktx_ = ktx });
+				return;
+			}
 			int w, h;
-			const uint8_t* img = stbi_load(this->textureFiles_[idx].c_str(), &w, &h, nullptr, STBI_rgb_alpha);
+			const uint8_t* img = stbi_load(fileName, &w, &h, nullptr, STBI_rgb_alpha);
 			if (img)
 			{
 				std::lock_guard lock(loadedFilesMutex_);
@@ -58,9 +75,15 @@ bool GLSceneDataLazy::uploadLoadedTextures()
 		loadedFiles_.pop_back();
 	}
 
-	allMaterialTextures_[data.index_] = std::make_shared<GLTexture>(data.w_, data.h_, data.img_);
-
-	stbi_image_free((void*)data.img_);
+	if (data.ktx_)
+	{
+		allMaterialTextures_[data.index_] = std::make_shared<GLTexture>(*data.ktx_);
+	}
+	else
+	{
+		allMaterialTextures_[data.index_] = std::make_shared<GLTexture>(data.w_, data.h_, data.img_);
+		stbi_image_free((void*)data.img_);
+	}
 
 	updateMaterials();
 
@@ -23,6 +23,8 @@ public:
 		int w_ = 0;
 		int h_ = 0;
 		const uint8_t* img_ = nullptr;
+		// .ktx textures of the scene converter are uploaded with all their (compressed) mip levels instead of 'img_'
+		std::shared_ptr<gli::texture> ktx_;
 	};
 
 	const std::shared_ptr<GLTexture> dummyTexture_ = std::make_shared<GLTexture>(GL_TEXTURE_2D, "data/const1.bmp");
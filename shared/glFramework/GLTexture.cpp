@@ -20,6 +20,30 @@ int getNumMipMapLevels2D(int w, int h)
 	return levels;
 }
 
+/*
+	KTX files produced by the scene converter already contain the whole (possibly block-compressed) mip chain.
+	Returns the number of levels of the storage, 'hasMipmaps' is false if the levels are still to be generated.
+*/
+static int uploadKTX2D(GLuint handle, const gli::texture& gliTex, bool& hasMipmaps)
+{
+	gli::gl GL(gli::gl::PROFILE_KTX);
+	gli::gl::format const format = GL.translate(gliTex.format(), gliTex.swizzles());
+	glm::tvec3<GLsizei> extent(gliTex.extent(0));
+	const int numLevels = (int)gliTex.levels();
+	hasMipmaps = numLevels > 1;
+	const int numMipmaps = hasMipmaps ? numLevels : getNumMipMapLevels2D(extent.x, extent.y);
+	glTextureStorage2D(handle, numMipmaps, format.Internal, extent.x, extent.y);
+	for (int level = 0; level != numLevels; level++)
+	{
+		glm::tvec3<GLsizei> levelExtent(gliTex.extent(level));
+		if (gli::is_compressed(gliTex.format()))
+			glCompressedTextureSubImage2D(handle, level, 0, 0, levelExtent.x, levelExtent.y, format.Internal, (GLsizei)gliTex.size(level), gliTex.data(0, 0, level));
+		else
+			glTextureSubImage2D(handle, level, 0, 0, levelExtent.x, levelExtent.y, format.External, format.Type, gliTex.data(0, 0, level));
+	}
+	return numMipmaps;
+}
+
 GLTexture::GLTexture(GLenum type, int width, int height, GLenum internalFormat)
 	: type_(type)
 {
@@ -83,17 +107,10 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 		int w = 0;
 		int h = 0;
 		int numMipmaps = 0;
+		bool hasMipmaps = false;
 		if (isKTX)
 		{
-			gli::texture gliTex = gli::load_ktx(fileName);
-			gli::gl GL(gli::gl::PROFILE_KTX);
-			gli::gl::format const format = GL.translate(gliTex.format(), gliTex.swizzles());
-			glm::tvec3<GLsizei> extent(gliTex.extent(0));
-			w = extent.x;
-			h = extent.y;
-			numMipmaps = getNumMipMapLevels2D(w, h);
-			glTextureStorage2D(handle_, numMipmaps, format.Internal, w, h);
-			glTextureSubImage2D(handle_, 0, 0, 0, w, h, format.External, format.Type, gliTex.data(0, 0, 0));
+			numMipmaps = uploadKTX2D(handle_, gli::load_ktx(fileName), hasMipmaps);
 		}
 		else
 		{
@@ -116,7 +133,8 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 			glTextureSubImage2D(handle_, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, img);
 			stbi_image_free((void*)img);
 		}
-		glGenerateTextureMipmap(handle_);
+		if (!hasMipmaps)
+			glGenerateTextureMipmap(handle_);
 		glTextureParameteri(handle_, GL_TEXTURE_MAX_LEVEL, numMipmaps-1);
 		glTextureParameteri(handle_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTextureParameteri(handle_, GL_TEXTURE_MAX_ANISOTROPY , 16);
@@ -129,9 +147,8 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 		assert(img);
 		Bitmap in(w, h, comp, eBitmapFormat_Float, img);
 		const bool isEquirectangular = w == 2 * h;
-		Bitmap out = isEquirectangular ? convertEquirectangularMapToVerticalCross(in) : in;
 		stbi_image_free((void*)img);
-		Bitmap cubemap = convertVerticalCrossToCubeMapFaces(out);
+		Bitmap cubemap = isEquirectangular ? convertEquirectangularMapToCubeMapFaces(in) : convertVerticalCrossToCubeMapFaces(in);
 
 		const int numMipmaps = getNumMipMapLevels2D(cubemap.w_, cubemap.h_);
 
@@ -179,6 +196,23 @@ GLTexture::GLTexture(int w, int h, const void* img)
 	glMakeTextureHandleResidentARB(handleBindless_);
 }
 
+GLTexture::GLTexture(const gli::texture& ktx)
+	: type_(GL_TEXTURE_2D)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glCreateTextures(type_, 1, &handle_);
+	glTextureParameteri(handle_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	bool hasMipmaps = false;
+	const int numMipmaps = uploadKTX2D(handle_, ktx, hasMipmaps);
+	if (!hasMipmaps)
+		glGenerateTextureMipmap(handle_);
+	glTextureParameteri(handle_, GL_TEXTURE_MAX_LEVEL, numMipmaps - 1);
+	glTextureParameteri(handle_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(handle_, GL_TEXTURE_MAX_ANISOTROPY, 16);
+	handleBindless_ = glGetTextureHandleARB(handle_);
+	glMakeTextureHandleResidentARB(handleBindless_);
+}
+
 GLTexture::GLTexture(GLTexture&& other)
 : type_(other.type_)
 , handle_(other.handle_)
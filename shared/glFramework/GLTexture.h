@@ -2,6 +2,8 @@
 
 #include <glad/gl.h>
 
+namespace gli { class texture; }
+
 class GLTexture
 {
 public:
@@ -9,6 +11,8 @@ public:
 	GLTexture(GLenum type, const char* fileName, GLenum clamp);
 	GLTexture(GLenum type, int width, int height, GLenum internalFormat);
 	GLTexture(int w, int h, const void* img);
+	/* A KTX texture of the scene converter loaded with gli::load_ktx() */
+	explicit GLTexture(const gli::texture& ktx);
 	~GLTexture();
 	GLTexture(const GLTexture&) = delete;
 	GLTexture(GLTexture&&);
@@ -0,0 +1,61 @@
+#include "shared/glFramework/GLUploadRing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+	const GLbitfield kMappingFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+}
+
+GLUploadRingBackend::GLUploadRingBackend(uint32_t numFrames)
+: fences_(numFrames, nullptr)
+{
+}
+
+GLUploadRingBackend::~GLUploadRingBackend()
+{
+	for (GLsync fence : fences_)
+		if (fence)
+			glDeleteSync(fence);
+
+	if (handle_)
+	{
+		glUnmapNamedBuffer(handle_);
+		glDeleteBuffers(1, &handle_);
+	}
+}
+
+uint8_t* GLUploadRingBackend::mapMemory(size_t size)
+{
+	glCreateBuffers(1, &handle_);
+	glNamedBufferStorage(handle_, (GLsizeiptr)size, nullptr, kMappingFlags);
+
+	uint8_t* ptr = (uint8_t*)glMapNamedBufferRange(handle_, 0, (GLsizeiptr)size, kMappingFlags);
+	if (!ptr)
+	{
+		printf("Cannot map upload ring buffer (%u bytes)\n", (uint32_t)size);
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+void GLUploadRingBackend::waitForFrame(uint32_t frame)
+{
+	GLsync& fence = fences_[frame];
+	if (fence)
+	{
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+}
+
+void GLUploadRingBackend::signalFrame(uint32_t frame)
+{
+	GLsync& fence = fences_[frame];
+	if (fence)
+		glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "shared/UploadRing.h"
+
+/*
+	OpenGL backend of UploadRing: a persistently mapped coherent buffer and one fence per frame in flight.
+	The same buffer can be bound as a uniform, storage or indirect buffer at the offsets of the allocations.
+*/
+class GLUploadRingBackend final : public UploadRingBackend
+{
+public:
+	explicit GLUploadRingBackend(uint32_t numFrames);
+	~GLUploadRingBackend() override;
+
+	GLUploadRingBackend(const GLUploadRingBackend&) = delete;
+	GLUploadRingBackend& operator=(const GLUploadRingBackend&) = delete;
+
+	GLuint getHandle() const { return handle_; }
+
+	uint8_t* mapMemory(size_t size) override;
+	void waitForFrame(uint32_t frame) override;
+	void signalFrame(uint32_t frame) override;
+
+private:
+	GLuint handle_ = 0;
+	std::vector<GLsync> fences_;
+};
@@ -0,0 +1,405 @@
+#include "shared/scene/BVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+	float getSurfaceArea(const BoundingBox& box)
+	{
+		const vec3 s = box.getSize();
+		return 2.0f * (s.x * s.y + s.y * s.z + s.z * s.x);
+	}
+
+	BoundingBox getEmptyBox()
+	{
+		BoundingBox box;
+		box.min_ = vec3(std::numeric_limits<float>::max());
+		box.max_ = vec3(std::numeric_limits<float>::lowest());
+		return box;
+	}
+
+	void combineBox(BoundingBox& box, const BoundingBox& other)
+	{
+		box.min_ = glm::min(box.min_, other.min_);
+		box.max_ = glm::max(box.max_, other.max_);
+	}
+
+	bool boxesOverlap(const BoundingBox& a, const BoundingBox& b)
+	{
+		return
+			a.min_.x <= b.max_.x && a.max_.x >= b.min_.x &&
+			a.min_.y <= b.max_.y && a.max_.y >= b.min_.y &&
+			a.min_.z <= b.max_.z && a.max_.z >= b.min_.z;
+	}
+
+	bool boxContains(const BoundingBox& outer, const BoundingBox& inner)
+	{
+		return
+			outer.min_.x <= inner.min_.x && outer.max_.x >= inner.max_.x &&
+			outer.min_.y <= inner.min_.y && outer.max_.y >= inner.max_.y &&
+			outer.min_.z <= inner.min_.z && outer.max_.z >= inner.max_.z;
+	}
+
+	// the same order of operations as in glm::dot() to match cullBoxesInFrustum() exactly
+	float planeDistance(const vec4& n, float x, float y, float z)
+	{
+		return (n.x * x + n.y * y) + (n.z * z + n.w);
+	}
+
+	/* Distance to the box corner which is the furthest along the plane normal */
+	float getMaxPlaneDistance(const vec4& n, const BoundingBox& box)
+	{
+		return planeDistance(n, n.x > 0.0f ? box.max_.x : box.min_.x, n.y > 0.0f ? box.max_.y : box.min_.y, n.z > 0.0f ? box.max_.z : box.min_.z);
+	}
+
+	/* Distance to the box corner which is the furthest against the plane normal */
+	float getMinPlaneDistance(const vec4& n, const BoundingBox& box)
+	{
+		return planeDistance(n, n.x > 0.0f ? box.min_.x : box.max_.x, n.y > 0.0f ? box.min_.y : box.max_.y, n.z > 0.0f ? box.min_.z : box.max_.z);
+	}
+
+	bool intersectRayBox(const vec3& origin, const vec3& invDir, const BoundingBox& box, float maxT, float* outT)
+	{
+		const vec3 t0 = (box.min_ - origin) * invDir;
+		const vec3 t1 = (box.max_ - origin) * invDir;
+
+		const vec3 tmin = glm::min(t0, t1);
+		const vec3 tmax = glm::max(t0, t1);
+
+		const float tEnter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+		const float tExit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, maxT));
+
+		*outT = tEnter;
+
+		return tEnter <= tExit;
+	}
+}
+
+void BVH::build(const std::vector<BoundingBox>& boxes)
+{
+	boxes_ = boxes;
+
+	nodes_.clear();
+	primIndices_.resize(boxes.size());
+	std::iota(primIndices_.begin(), primIndices_.end(), 0u);
+
+	if (boxes.empty())
+		return;
+
+	std::vector<vec3> centroids(boxes.size());
+	for (size_t i = 0; i != boxes.size(); i++)
+		centroids[i] = boxes[i].getCenter();
+
+	nodes_.reserve(2 * boxes.size() - 1);
+	nodes_.push_back(BVHNode { .firstPrim_ = 0, .numPrims_ = (uint32_t)boxes.size(), .firstChild_ = 0 });
+
+	subdivide(0, centroids, 0);
+}
+
+void BVH::updateNodeBox(BVHNode& node) const
+{
+	BoundingBox box = getEmptyBox();
+
+	if (node.isLeaf())
+	{
+		for (uint32_t i = 0; i != node.numPrims_; i++)
+			combineBox(box, boxes_[primIndices_[node.firstPrim_ + i]]);
+	}
+	else
+	{
+		combineBox(box, nodes_[node.firstChild_].box_);
+		combineBox(box, nodes_[node.firstChild_ + 1].box_);
+	}
+
+	node.box_ = box;
+}
+
+void BVH::subdivide(uint32_t nodeIdx, const std::vector<vec3>& centroids, uint32_t depth)
+{
+	updateNodeBox(nodes_[nodeIdx]);
+
+	const uint32_t firstPrim = nodes_[nodeIdx].firstPrim_;
+	const uint32_t numPrims = nodes_[nodeIdx].numPrims_;
+
+	if (numPrims <= kMaxLeafSize || depth + 1 >= kMaxDepth)
+		return;
+
+	BoundingBox centroidBox = getEmptyBox();
+	for (uint32_t i = 0; i != numPrims; i++)
+		centroidBox.combinePoint(centroids[primIndices_[firstPrim + i]]);
+
+	const vec3 extent = centroidBox.getSize();
+	const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+
+	// all the centroids are at the same point, no split can separate them
+	if (extent[axis] <= 0.0f)
+		return;
+
+	const float binScale = (float)kNumBins / extent[axis];
+
+	auto getBin = [&](uint32_t prim)
+	{
+		return std::min(kNumBins - 1, (uint32_t)((centroids[prim][axis] - centroidBox.min_[axis]) * binScale));
+	};
+
+	uint32_t binCounts[kNumBins] = {};
+	BoundingBox binBoxes[kNumBins];
+	for (auto& b: binBoxes)
+		b = getEmptyBox();
+
+	for (uint32_t i = 0; i != numPrims; i++)
+	{
+		const uint32_t prim = primIndices_[firstPrim + i];
+		const uint32_t bin = getBin(prim);
+		binCounts[bin]++;
+		combineBox(binBoxes[bin], boxes_[prim]);
+	}
+
+	// sweep from the right to get the area of all the right sides, then from the left to evaluate the splits
+	float rightAreas[kNumBins] = {};
+	uint32_t rightCounts[kNumBins] = {};
+	{
+		BoundingBox box = getEmptyBox();
+		uint32_t count = 0;
+		for (uint32_t b = kNumBins - 1; b > 0; b--)
+		{
+			combineBox(box, binBoxes[b]);
+			count += binCounts[b];
+			rightAreas[b] = count ? getSurfaceArea(box) : 0.0f;
+			rightCounts[b] = count;
+		}
+	}
+
+	float bestCost = std::numeric_limits<float>::max();
+	uint32_t bestSplit = 0;
+	{
+		BoundingBox box = getEmptyBox();
+		uint32_t count = 0;
+		for (uint32_t b = 1; b != kNumBins; b++)
+		{
+			combineBox(box, binBoxes[b - 1]);
+			count += binCounts[b - 1];
+			if (!count || !rightCounts[b])
+				continue;
+			const float cost = (float)count * getSurfaceArea(box) + (float)rightCounts[b] * rightAreas[b];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+	}
+
+	if (!bestSplit)
+		return;
+
+	// a leaf is cheaper than one more traversal step, unless the leaf would be too big
+	const float leafCost = (float)numPrims * getSurfaceArea(nodes_[nodeIdx].box_);
+	if (bestCost >= leafCost && numPrims <= 4 * kMaxLeafSize)
+		return;
+
+	uint32_t* first = primIndices_.data() + firstPrim;
+	uint32_t* middle = std::partition(first, first + numPrims, [&](uint32_t prim) { return getBin(prim) < bestSplit; });
+	const uint32_t numLeft = (uint32_t)(middle - first);
+
+	const uint32_t firstChild = (uint32_t)nodes_.size();
+	nodes_.push_back(BVHNode { .firstPrim_ = firstPrim, .numPrims_ = numLeft, .firstChild_ = 0 });
+	nodes_.push_back(BVHNode { .firstPrim_ = firstPrim + numLeft, .numPrims_ = numPrims - numLeft, .firstChild_ = 0 });
+	nodes_[nodeIdx].firstChild_ = firstChild;
+
+	subdivide(firstChild, centroids, depth + 1);
+	subdivide(firstChild + 1, centroids, depth + 1);
+}
+
+void BVH::refit(const std::vector<BoundingBox>& boxes)
+{
+	if (boxes.size() != boxes_.size())
+	{
+		build(boxes);
+		return;
+	}
+
+	boxes_ = boxes;
+
+	// the children are always stored after their parents
+	for (size_t i = nodes_.size(); i-- > 0; )
+		updateNodeBox(nodes_[i]);
+}
+
+uint32_t BVH::cullFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, std::vector<uint64_t>& visibility) const
+{
+	visibility.assign((boxes_.size() + 63) >> 6, 0);
+
+	if (nodes_.empty())
+		return 0;
+
+	BoundingBox cornersBox;
+	if (frustumCorners)
+	{
+		vec3 points[8];
+		for (int i = 0; i != 8; i++)
+			points[i] = vec3(frustumCorners[i]);
+		cornersBox = BoundingBox(points, 8);
+	}
+
+	const uint32_t kAllPlanes = 0x3F;
+
+	// the planes which still have to be tested for the subtree: a box completely inside a plane does not need it for the children
+	struct StackEntry
+	{
+		uint32_t node;
+		uint32_t planeMask;
+	};
+
+	StackEntry stack[kMaxDepth + 1];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, kAllPlanes };
+
+	uint32_t numVisible = 0;
+
+	auto setVisible = [&](uint32_t prim)
+	{
+		visibility[prim >> 6] |= 1ull << (prim & 63);
+		numVisible++;
+	};
+
+	auto isOutside = [&](const BoundingBox& box, uint32_t& planeMask)
+	{
+		for (uint32_t p = 0; p != 6; p++)
+		{
+			if (!(planeMask & (1u << p)))
+				continue;
+			if (getMaxPlaneDistance(frustumPlanes[p], box) < 0.0f)
+				return true;
+			if (getMinPlaneDistance(frustumPlanes[p], box) >= 0.0f)
+				planeMask &= ~(1u << p);
+		}
+		return frustumCorners && !boxesOverlap(cornersBox, box);
+	};
+
+	while (stackSize)
+	{
+		const StackEntry e = stack[--stackSize];
+		const BVHNode& node = nodes_[e.node];
+
+		uint32_t planeMask = e.planeMask;
+
+		if (isOutside(node.box_, planeMask))
+			continue;
+
+		if (!planeMask)
+		{
+			// the whole subtree is inside the frustum
+			for (uint32_t i = 0; i != node.numPrims_; i++)
+				setVisible(primIndices_[node.firstPrim_ + i]);
+			continue;
+		}
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i != node.numPrims_; i++)
+			{
+				const uint32_t prim = primIndices_[node.firstPrim_ + i];
+				uint32_t primMask = planeMask;
+				if (!isOutside(boxes_[prim], primMask))
+					setVisible(prim);
+			}
+			continue;
+		}
+
+		stack[stackSize++] = { node.firstChild_, planeMask };
+		stack[stackSize++] = { node.firstChild_ + 1, planeMask };
+	}
+
+	return numVisible;
+}
+
+void BVH::queryBox(const BoundingBox& box, std::vector<uint32_t>& prims) const
+{
+	if (nodes_.empty())
+		return;
+
+	uint32_t stack[kMaxDepth + 1];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize)
+	{
+		const BVHNode& node = nodes_[stack[--stackSize]];
+
+		if (!boxesOverlap(box, node.box_))
+			continue;
+
+		if (boxContains(box, node.box_))
+		{
+			prims.insert(prims.end(), primIndices_.begin() + node.firstPrim_, primIndices_.begin() + node.firstPrim_ + node.numPrims_);
+			continue;
+		}
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i != node.numPrims_; i++)
+			{
+				const uint32_t prim = primIndices_[node.firstPrim_ + i];
+				if (boxesOverlap(box, boxes_[prim]))
+					prims.push_back(prim);
+			}
+			continue;
+		}
+
+		stack[stackSize++] = node.firstChild_;
+		stack[stackSize++] = node.firstChild_ + 1;
+	}
+}
+
+int BVH::raycast(const vec3& origin, const vec3& dir, float* outT) const
+{
+	if (nodes_.empty())
+		return -1;
+
+	const vec3 invDir = vec3(1.0f) / dir;
+
+	float bestT = std::numeric_limits<float>::max();
+	int bestPrim = -1;
+
+	uint32_t stack[kMaxDepth + 1];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize)
+	{
+		const BVHNode& node = nodes_[stack[--stackSize]];
+
+		float t;
+		if (!intersectRayBox(origin, invDir, node.box_, bestT, &t))
+			continue;
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i != node.numPrims_; i++)
+			{
+				const uint32_t prim = primIndices_[node.firstPrim_ + i];
+				if (intersectRayBox(origin, invDir, boxes_[prim], bestT, &t) && t < bestT)
+				{
+					bestT = t;
+					bestPrim = (int)prim;
+				}
+			}
+			continue;
+		}
+
+		// visit the nearest child first, so the other one is likely to be rejected by 'bestT'
+		const BVHNode& left = nodes_[node.firstChild_];
+		const BVHNode& right = nodes_[node.firstChild_ + 1];
+		const bool leftFirst = glm::dot(left.box_.getCenter() - right.box_.getCenter(), dir) <= 0.0f;
+
+		stack[stackSize++] = leftFirst ? node.firstChild_ + 1 : node.firstChild_;
+		stack[stackSize++] = leftFirst ? node.firstChild_ : node.firstChild_ + 1;
+	}
+
+	if (outT && bestPrim >= 0)
+		*outT = bestT;
+
+	return bestPrim;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "shared/UtilsMath.h"
+
+/*
+	Bounding volume hierarchy over the world-space boxes of scene shapes.
+
+	The tree is built top-down using the surface area heuristic evaluated over a fixed number of bins. The primitives of
+	every node occupy a contiguous range of 'primIndices_', so a subtree which is completely inside a query volume is
+	accepted as a whole without visiting its children.
+
+	When the shapes move, refit() recalculates the node boxes bottom-up without changing the tree topology. It is much
+	cheaper than build(), but the tree gets less efficient as the shapes move away from their original positions, so a
+	full rebuild is still needed after large changes.
+*/
+
+struct BVHNode
+{
+	BoundingBox box_;
+
+	// range of the primitives in BVH::getPrimIndices() (for all the nodes, not just the leaves)
+	uint32_t firstPrim_;
+	uint32_t numPrims_;
+
+	// children are always allocated in pairs at 'firstChild_' and 'firstChild_ + 1', so 0 means a leaf
+	uint32_t firstChild_;
+
+	bool isLeaf() const { return firstChild_ == 0; }
+};
+
+class BVH final
+{
+public:
+	static constexpr uint32_t kMaxLeafSize = 4;
+	static constexpr uint32_t kMaxDepth = 64;
+	static constexpr uint32_t kNumBins = 16;
+
+	void build(const std::vector<BoundingBox>& boxes);
+
+	/* Update the boxes of all the nodes for the new positions of the same primitives */
+	void refit(const std::vector<BoundingBox>& boxes);
+
+	/*
+		Set the bits of the visible primitives in 'visibility' (see isVisible() in UtilsCulling.h) and return their number.
+		The result is the same as of cullBoxesInFrustum() over all the boxes. 'frustumCorners' can be null.
+	*/
+	uint32_t cullFrustum(const vec4* frustumPlanes, const vec4* frustumCorners, std::vector<uint64_t>& visibility) const;
+
+	/* Append the indices of all the primitives overlapping 'box' to 'prims' (e.g. the shadow casters in a light volume) */
+	void queryBox(const BoundingBox& box, std::vector<uint32_t>& prims) const;
+
+	/* The primitive with the nearest box intersected by the ray, or -1. Picking should refine the result with the actual geometry */
+	int raycast(const vec3& origin, const vec3& dir, float* outT = nullptr) const;
+
+	const std::vector<BVHNode>& getNodes() const { return nodes_; }
+	const std::vector<uint32_t>& getPrimIndices() const { return primIndices_; }
+
+private:
+	void subdivide(uint32_t nodeIdx, const std::vector<vec3>& centroids, uint32_t depth);
+	void updateNodeBox(BVHNode& node) const;
+
+	std::vector<BVHNode> nodes_;
+	std::vector<uint32_t> primIndices_;
+	std::vector<BoundingBox> boxes_;
+};
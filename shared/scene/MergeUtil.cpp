@@ -1,7 +1,7 @@
 #include "shared/scene/Material.h"
 #include "shared/scene/MergeUtil.h"
 
-#include <map>
+#include <algorithm>
 
 static uint32_t shiftMeshIndices(MeshData& meshData, const std::vector<uint32_t>& meshesToMerge)
 {
@@ -32,44 +32,78 @@ static uint32_t shiftMeshIndices(MeshData& meshData, const std::vector<uint32_t>
 }
 
 // All the meshesToMerge now have the same vertexOffset and individual index values are shifted by appropriate amount
-// Here we move all the indices to appropriate places in the new index array
-static void mergeIndexArray(MeshData& md, const std::vector<uint32_t>& meshesToMerge, std::map<uint32_t, uint32_t>& oldToNew)
+// Here we move all the indices to appropriate places in the index array: the kept meshes are compacted in place
+// towards the beginning, the merged ones go to the end. Only the merged indices are copied into a temporary buffer.
+static void mergeIndexArray(MeshData& md, const std::vector<uint32_t>& meshesToMerge, const std::vector<bool>& shouldMerge, std::vector<uint32_t>& oldToNew)
 {
-	std::vector<uint32_t> newIndices(md.indexData_.size());
-	// Two offsets in the new indices array (one begins at the start, the second one after all the copied indices)
-	uint32_t copyOffset = 0,
-	         mergeOffset = shiftMeshIndices(md, meshesToMerge);
-
-	const auto mergedMeshIndex = md.meshes_.size() - meshesToMerge.size();
-	auto newIndex = 0u;
-	for (auto midx = 0u ; midx < md.meshes_.size() ; midx++)
-	{
-		const bool shouldMerge = std::binary_search( meshesToMerge.begin(), meshesToMerge.end(), midx);
+	const uint32_t numMeshes = (uint32_t)md.meshes_.size();
+	const uint32_t mergeStart = shiftMeshIndices(md, meshesToMerge);
+
+	// in-place compaction is only safe when the index blocks are laid out in the mesh order (this is what the converters produce)
+	const bool inPlace = std::is_sorted(md.meshes_.begin(), md.meshes_.end(), [](const Mesh& a, const Mesh& b) { return a.indexOffset < b.indexOffset; });
+
+	std::vector<uint32_t> mergedIndices;
+	mergedIndices.reserve(md.indexData_.size() - mergeStart);
+
+	std::vector<uint32_t> newIndices;
+	if (!inPlace)
+		newIndices.resize(md.indexData_.size());
 
-		oldToNew[midx] = shouldMerge ? mergedMeshIndex : newIndex;
-		newIndex += shouldMerge ? 0 : 1;
+	uint32_t* dst = inPlace ? md.indexData_.data() : newIndices.data();
 
+	const uint32_t mergedMeshIndex = numMeshes - (uint32_t)meshesToMerge.size();
+	uint32_t copyOffset = 0;
+	uint32_t newIndex = 0;
+
+	oldToNew.resize(numMeshes);
+
+	for (uint32_t midx = 0 ; midx < numMeshes ; midx++)
+	{
 		auto& mesh = md.meshes_[midx];
-		auto idxCount = mesh.getLODIndicesCount(0);
-		// move all indices to the new array at mergeOffset
-		const auto start = md.indexData_.begin() + mesh.indexOffset;
+		const uint32_t idxCount = mesh.getLODIndicesCount(0);
+		const uint32_t* start = md.indexData_.data() + mesh.indexOffset;
+
+		if (shouldMerge[midx])
+		{
+			oldToNew[midx] = mergedMeshIndex;
+			mergedIndices.insert(mergedIndices.end(), start, start + idxCount);
+			continue;
+		}
+
+		oldToNew[midx] = newIndex++;
+		// destination never overtakes the source here, so a forward copy is fine even when both ranges overlap
+		std::copy(start, start + idxCount, dst + copyOffset);
 		mesh.indexOffset = copyOffset;
-		const auto offsetPtr = shouldMerge ? &mergeOffset : &copyOffset;
-		std::copy(start, start + idxCount, newIndices.begin() + *offsetPtr);
-		*offsetPtr += idxCount;
+		copyOffset += idxCount;
 	}
 
-	md.indexData_ = newIndices;
+	if (!inPlace)
+		md.indexData_.swap(newIndices);
+
+	// keep the layout of the old implementation: [kept indices] [zeros] [merged indices]
+	std::fill(md.indexData_.begin() + copyOffset, md.indexData_.begin() + mergeStart, 0);
+	std::copy(mergedIndices.begin(), mergedIndices.end(), md.indexData_.begin() + mergeStart);
 
 	// all the merged indices are now in lastMesh
 	Mesh lastMesh = md.meshes_[meshesToMerge[0]];
 	lastMesh.indexOffset = copyOffset;
 	lastMesh.lodOffset[0] = copyOffset;
-	lastMesh.lodOffset[1] = mergeOffset;
+	lastMesh.lodOffset[1] = mergeStart + (uint32_t)mergedIndices.size();
 	lastMesh.lodCount = 1;
 	md.meshes_.push_back(lastMesh);
 }
 
+// Single pass removal of the merged meshes, the newly appended merged mesh stays at the end
+static void compactMeshes(std::vector<Mesh>& meshes, const std::vector<bool>& shouldMerge)
+{
+	size_t dst = 0;
+	for (size_t i = 0 ; i != meshes.size() ; i++)
+		if (i >= shouldMerge.size() || !shouldMerge[i])
+			meshes[dst++] = meshes[i];
+
+	meshes.resize(dst);
+}
+
 void mergeScene(Scene& scene, MeshData& meshData, const std::string& materialName)
 {
 	// Find material index
@@ -88,14 +122,19 @@ void mergeScene(Scene& scene, MeshData& meshData, const std::string& materialNam
 
 	// TODO: if merged mesh transforms are non-zero, then we should pre-transform individual mesh vertices in meshData using local transform
 
+	// flat lookup table instead of a binary search per mesh (meshesToMerge is not necessarily sorted)
+	std::vector<bool> shouldMerge(meshData.meshes_.size(), false);
+	for (auto i: meshesToMerge)
+		shouldMerge[i] = true;
+
 	// old-to-new mesh indices
-	std::map<uint32_t, uint32_t> oldToNew;
+	std::vector<uint32_t> oldToNew;
 
 	// now move all the meshesToMerge to the end of array
-	mergeIndexArray(meshData, meshesToMerge, oldToNew);
+	mergeIndexArray(meshData, meshesToMerge, shouldMerge, oldToNew);
 
 	// cutoff all but one of the merged meshes (insert the last saved mesh from meshesToMerge - they are all the same)
-	eraseSelected(meshData.meshes_, meshesToMerge);
+	compactMeshes(meshData.meshes_, shouldMerge);
 
 	for (auto& n: scene.meshes_)
 		n.second = oldToNew[n.second];
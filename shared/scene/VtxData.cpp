@@ -158,6 +158,8 @@ void recalculateBoundingBoxes(MeshData& m)
 	for (const auto& mesh : m.meshes_)
 	{
 		const auto numIndices = mesh.getLODIndicesCount(0);
+		// MeshConvert can skip the normals and texture coordinates, so the vertex size is not always kMaxStreams floats
+		const uint32_t vertexStride = mesh.streamElementSize[0] / sizeof(float);
 
 		glm::vec3 vmin(std::numeric_limits<float>::max());
 		glm::vec3 vmax(std::numeric_limits<float>::lowest());
@@ -165,7 +167,7 @@ void recalculateBoundingBoxes(MeshData& m)
 		for (auto i = 0; i != numIndices; i++)
 		{
 			auto vtxOffset = m.indexData_[mesh.indexOffset + i] + mesh.vertexOffset;
-			const float* vf = &m.vertexData_[vtxOffset * kMaxStreams];
+			const float* vf = &m.vertexData_[vtxOffset * vertexStride];
 			vmin = glm::min(vmin, vec3(vf[0], vf[1], vf[2]));
 			vmax = glm::max(vmax, vec3(vf[0], vf[1], vf[2]));
 		}
@@ -1,6 +1,10 @@
 #include "shared/vkFramework/MultiRenderer.h"
 
+#include <assert.h>
+
 #include <stb/stb_image.h>
+#include <gli/gli.hpp>
+#include <gli/load_ktx.hpp>
 
 uint8_t* genDefaultCheckerboardImage(int* width, int* height);
 
@@ -35,8 +39,25 @@ VKSceneData::VKSceneData(VulkanRenderContext& ctx,
 
 		taskflow_.for_each_index(0u, (uint32_t)textureFiles_.size(), 1u, [this](int idx)
 			{
+				const char* fileName = this->textureFiles_[idx].c_str();
+				const char* ext = strrchr(fileName, '.');
 				int w, h;
-				const uint8_t* img = stbi_load(this->textureFiles_[idx].c_str(), &w, &h, nullptr, STBI_rgb_alpha);
+				const uint8_t* img = nullptr;
+				if (ext && !strcmp(ext, ".ktx"))
+				{
+					auto ktx = std::make_shared<gli::texture>(gli::load_ktx(fileName));
+					if (!ktx->empty())
+					{
+						std::lock_guard lock(loadedFilesMutex_);
+						loadedFiles_.emplace_back(LoadedImageData { .index_ = idx, .ktx_ = ktx });
+						return;
+					}
+					printf("Cannot load %s KTX texture file\n", fileName);
+				}
+				else
+				{
+					img = stbi_load(fileName, &w, &h, nullptr, STBI_rgb_alpha);
+				}
 				if (!img)
 					img = genDefaultCheckerboardImage(&w, &h);
 				std::lock_guard lock(loadedFilesMutex_);
@@ -151,11 +172,13 @@ MultiRenderer::MultiRenderer(
 	const PipelineInfo pInfo = initRenderPass(PipelineInfo {}, outputs, screenRenderPass, ctx.screenRenderPass);
 
 	const uint32_t indirectDataSize = (uint32_t)sceneData_.shapes_.size() * sizeof(VkDrawIndirectCommand);
+	drawCountOffset_ = indirectDataSize;
 
 	const size_t imgCount = ctx.vkDev.swapchainImages.size();
 	uniforms_.resize(imgCount);
 	shape_.resize(imgCount);
 	indirect_.resize(imgCount);
+	numDrawCommands_.resize(imgCount);
 
 	descriptorSets_.resize(imgCount);
 
@@ -194,8 +217,8 @@ MultiRenderer::MultiRenderer(
 
 	for (size_t i = 0; i != imgCount; i++)
 	{
-		uniforms_[i] = ctx.resources.addUniformBuffer(uniformBufferSize);
-		indirect_[i] = ctx.resources.addIndirectBuffer(indirectDataSize);
+		uniforms_[i] = ctx.resources.addUniformBuffer(uniformBufferSize, true);
+		indirect_[i] = ctx.resources.addIndirectBuffer(indirectDataSize + sizeof(uint32_t), true);
 		updateIndirectBuffers(i);
 
 		shape_[i] = ctx.resources.addStorageBuffer(shapesSize);
@@ -215,39 +238,85 @@ void MultiRenderer::fillCommandBuffer(VkCommandBuffer commandBuffer, size_t curr
 {
 	beginRenderPass((rp != VK_NULL_HANDLE) ? rp : renderPass_.handle, (fb != VK_NULL_HANDLE) ? fb : framebuffer_, commandBuffer, currentImage);
 
-	/* For CountKHR (Vulkan 1.1) we may use indirect rendering with GPU-based object counter */
-	/// vkCmdDrawIndirectCountKHR(commandBuffer, indirectBuffers_[currentImage], 0, countBuffers_[currentImage], 0, shapes.size(), sizeof(VkDrawIndirectCommand));
-	/* For Vulkan 1.0 vkCmdDrawIndirect is enough */
-	vkCmdDrawIndirect(commandBuffer, indirect_[currentImage].buffer, 0, (uint32_t)sceneData_.shapes_.size(), sizeof(VkDrawIndirectCommand));
+	/* For CountKHR (Vulkan 1.1) the number of commands is read from the buffer written by the culling */
+	if (useDrawIndirectCount && vkCmdDrawIndirectCountKHR)
+		vkCmdDrawIndirectCountKHR(commandBuffer, indirect_[currentImage].buffer, 0, indirect_[currentImage].buffer, drawCountOffset_, (uint32_t)sceneData_.shapes_.size(), sizeof(VkDrawIndirectCommand));
+	else /* For Vulkan 1.0 vkCmdDrawIndirect is enough */
+		vkCmdDrawIndirect(commandBuffer, indirect_[currentImage].buffer, 0, numDrawCommands_[currentImage], sizeof(VkDrawIndirectCommand));
 
 	vkCmdEndRenderPass(commandBuffer);
 }
 
+void MultiRenderer::setDrawCount(size_t currentImage, uint32_t numCommands)
+{
+	numDrawCommands_[currentImage] = numCommands;
+	memcpy((uint8_t*)indirect_[currentImage].ptr + drawCountOffset_, &numCommands, sizeof(uint32_t));
+}
+
 void MultiRenderer::updateBuffers(size_t imageIndex)
 {
 	updateUniformBuffer((uint32_t)imageIndex, 0, sizeof(ubo_), &ubo_);
+
+	if (culler_)
+		cullIndirectBuffers(imageIndex);
 }
 
 void MultiRenderer::updateIndirectBuffers(size_t currentImage, bool* visibility)
 {
-	VkDrawIndirectCommand* data = nullptr;
-	vkMapMemory(ctx_.vkDev.device, indirect_[currentImage].memory, 0, sizeof(VkDrawIndirectCommand), 0, (void**)&data);
-
 	const uint32_t size = (uint32_t)sceneData_.shapes_.size();
 
+	drawCommands_.resize(size);
+
 	for (uint32_t i = 0; i != size; i++)
 	{
 		const uint32_t j = sceneData_.shapes_[i].meshIndex;
 
 		const uint32_t lod = sceneData_.shapes_[i].LOD;
-		data[i] = {
+		drawCommands_[i] = {
 			.vertexCount = sceneData_.meshData_.meshes_[j].getLODIndicesCount(lod),
-			.instanceCount = visibility ? (visibility[i] ? 1u : 0u) : 1u,
+			.instanceCount = 1,
 			.firstVertex = 0,
 			.firstInstance = i
 		};
 	}
-	vkUnmapMemory(ctx_.vkDev.device, indirect_[currentImage].memory);
+
+	/* Invisible shapes are skipped, the shader finds the shape by 'firstInstance' */
+	VkDrawIndirectCommand* data = (VkDrawIndirectCommand*)indirect_[currentImage].ptr;
+
+	uint32_t numVisible = 0;
+	for (uint32_t i = 0; i != size; i++)
+	{
+		if (!visibility || visibility[i])
+			data[numVisible++] = drawCommands_[i];
+	}
+
+	setDrawCount(currentImage, numVisible);
+}
+
+void MultiRenderer::setFrustumCulling(tf::Executor* executor, const BoundingBoxSoA* shapeBoxes)
+{
+	assert(!executor || (shapeBoxes && shapeBoxes->size() == sceneData_.shapes_.size()));
+
+	culler_ = executor ? std::make_unique<ParallelFrustumCuller>(*executor) : nullptr;
+	shapeBoxes_ = shapeBoxes;
+
+	// all the shapes are drawn again when the culling is disabled
+	if (!executor)
+		for (size_t i = 0; i != indirect_.size(); i++)
+			updateIndirectBuffers(i);
+}
+
+void MultiRenderer::cullIndirectBuffers(size_t currentImage)
+{
+	// the view matrix has the Y flip of setMatrices(), the same as in the shaders
+	const mat4 viewProj = ubo_.proj_ * ubo_.view_;
+
+	vec4 frustumPlanes[6];
+	vec4 frustumCorners[8];
+	getFrustumPlanes(viewProj, frustumPlanes);
+	getFrustumCorners(viewProj, frustumCorners);
+
+	setDrawCount(currentImage, culler_->cull(frustumPlanes, frustumCorners, *shapeBoxes_, drawCommands_, (VkDrawIndirectCommand*)indirect_[currentImage].ptr));
 }
 
 bool MultiRenderer::checkLoadedTextures()
@@ -265,6 +334,12 @@ bool MultiRenderer::checkLoadedTextures()
 		sceneData_.loadedFiles_.pop_back();
 	}
 
+	if (data.ktx_)
+	{
+		this->updateTexture(data.index_, ctx_.resources.loadMipmappedKTX(*data.ktx_, sceneData_.textureFiles_[data.index_].c_str()));
+		return true;
+	}
+
 	this->updateTexture(data.index_, ctx_.resources.addRGBATexture(data.w_, data.h_, const_cast<uint8_t*>(data.img_)));
 
 	stbi_image_free((void*)data.img_);
@@ -4,6 +4,7 @@
 #include "shared/scene/Scene.h"
 #include "shared/scene/Material.h"
 #include "shared/scene/VtxData.h"
+#include "shared/UtilsCulling.h"
 
 #include <taskflow/taskflow.hpp>
 
@@ -57,6 +58,8 @@ struct VKSceneData
 		int w_ = 0;
 		int h_ = 0;
 		const uint8_t* img_ = nullptr;
+		// .ktx textures of the scene converter are uploaded with all their (compressed) mip levels instead of 'img_'
+		std::shared_ptr<gli::texture> ktx_;
 	};
 
 	std::vector<std::string> textureFiles_;
@@ -86,8 +89,16 @@ struct MultiRenderer: public Renderer
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
 	void updateBuffers(size_t currentImage) override;
 
+	/* Rebuild the draw commands of all the shapes (after the shapes or LODs have changed) and write the visible ones */
 	void updateIndirectBuffers(size_t currentImage, bool* visibility = nullptr);
 
+	/*
+		Cull the shapes against the frustum of setMatrices() in every updateBuffers() on the worker threads of 'executor',
+		and draw only the visible ones. 'shapeBoxes' are the world-space boxes of sceneData.shapes_, they are not copied.
+		Null 'executor' disables the culling.
+	*/
+	void setFrustumCulling(tf::Executor* executor, const BoundingBoxSoA* shapeBoxes);
+
 	inline void setMatrices(const glm::mat4& proj, const glm::mat4& view) {
 		const glm::mat4 m1 = glm::scale(glm::mat4(1.f), glm::vec3(1.f, -1.f, 1.f));
 		ubo_.proj_ = proj;
@@ -103,10 +114,28 @@ struct MultiRenderer: public Renderer
 	// Async loading in Chapter9
 	bool checkLoadedTextures();
 
+	/*
+		Draw with vkCmdDrawIndirectCountKHR() which reads the number of commands from the indirect buffer, so the recorded
+		command buffer does not depend on the culling results. Ignored if VK_KHR_draw_indirect_count is not available.
+	*/
+	bool useDrawIndirectCount = true;
+
 private:
+	/* The count is stored after the commands, where vkCmdDrawIndirectCountKHR() reads it */
+	void setDrawCount(size_t currentImage, uint32_t numCommands);
+
+	/* Write only the draw commands of the shapes inside the frustum */
+	void cullIndirectBuffers(size_t currentImage);
+
 	VKSceneData& sceneData_;
 
 	std::vector<VulkanBuffer> indirect_;
+	std::vector<uint32_t> numDrawCommands_;
+	VkDeviceSize drawCountOffset_ = 0;
+	std::vector<VkDrawIndirectCommand> drawCommands_;
+
+	std::unique_ptr<ParallelFrustumCuller> culler_;
+	const BoundingBoxSoA* shapeBoxes_ = nullptr;
 	std::vector<VulkanBuffer> shape_;
 
 	struct UBO {
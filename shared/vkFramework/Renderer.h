@@ -14,7 +14,11 @@ struct Renderer
 	virtual void updateBuffers(size_t currentImage) {}
 
 	inline void updateUniformBuffer(uint32_t currentImage, const uint32_t offset, const uint32_t size, const void* data) {
-		uploadBufferData(ctx_.vkDev, uniforms_[currentImage].memory, offset, data, size);
+		/* persistently mapped buffers (see VulkanResources::addBuffer) are written without mapping them again */
+		if (uniforms_[currentImage].ptr)
+			memcpy((uint8_t*)uniforms_[currentImage].ptr + offset, data, size);
+		else
+			uploadBufferData(ctx_.vkDev, uniforms_[currentImage].memory, offset, data, size);
 	}
 
 	void initPipeline(const std::vector<const char*>& shaders, const PipelineInfo& pInfo, uint32_t vtxConstSize = 0, uint32_t fragConstSize = 0)
@@ -12,6 +12,7 @@
 #include <gli/load_ktx.hpp>
 
 #include <algorithm>
+#include <string.h>
 
 glslang_stage_t glslangShaderStageFromFileName(const char* fileName);
 
@@ -104,8 +105,114 @@ VulkanTexture VulkanResources::loadKTX(const char* fileName)
 	return ktx;
 }
 
+static VkFormat getVkFormatFromGLI(gli::format format)
+{
+	switch (format)
+	{
+	case gli::FORMAT_RGBA8_UNORM_PACK8:
+		return VK_FORMAT_R8G8B8A8_UNORM;
+	case gli::FORMAT_RGBA_DXT5_UNORM_BLOCK16:
+		return VK_FORMAT_BC3_UNORM_BLOCK;
+	case gli::FORMAT_RGBA_ETC2_UNORM_BLOCK16:
+		return VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK;
+	default:
+		break;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+/* Mipmapped (and possibly block-compressed) .ktx textures produced by the scene converter: all the levels go into a single staging buffer */
+VulkanTexture VulkanResources::loadMipmappedKTX(const char* fileName)
+{
+	return loadMipmappedKTX(gli::load_ktx(fileName), fileName);
+}
+
+VulkanTexture VulkanResources::loadMipmappedKTX(const gli::texture& gliTex, const char* fileName)
+{
+	const VkFormat format = gliTex.empty() ? VK_FORMAT_UNDEFINED : getVkFormatFromGLI(gliTex.format());
+
+	if (format == VK_FORMAT_UNDEFINED)
+	{
+		printf("Cannot load %s KTX texture file (unsupported format)\n", fileName);
+		exit(EXIT_FAILURE);
+	}
+
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(vkDev.physicalDevice, format, &props);
+
+	if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+	{
+		printf("Texture format of %s is not supported by this device\n", fileName);
+		exit(EXIT_FAILURE);
+	}
+
+	glm::tvec3<uint32_t> extent(gliTex.extent(0));
+	const uint32_t mipLevels = (uint32_t)gliTex.levels();
+
+	VulkanTexture tex = {
+		.width = extent.x,
+		.height = extent.y,
+		.depth = 1,
+		.format = format
+	};
+
+	createImage(vkDev.device, vkDev.physicalDevice, tex.width, tex.height, format, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		tex.image.image, tex.image.imageMemory, 0, mipLevels);
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(vkDev.device, vkDev.physicalDevice, gliTex.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+	// the mip levels of a single-layer texture are tightly packed in gli storage
+	uploadBufferData(vkDev, stagingBufferMemory, 0, gliTex.data(), gliTex.size());
+
+	std::vector<VkBufferImageCopy> regions(mipLevels);
+	const uint8_t* base = (const uint8_t*)gliTex.data(0, 0, 0);
+
+	for (uint32_t i = 0; i != mipLevels; i++)
+	{
+		glm::tvec3<uint32_t> levelExtent(gliTex.extent(i));
+
+		regions[i] = VkBufferImageCopy {
+			.bufferOffset = (VkDeviceSize)((const uint8_t*)gliTex.data(0, 0, i) - base),
+			.bufferRowLength = 0,
+			.bufferImageHeight = 0,
+			.imageSubresource = VkImageSubresourceLayers { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = i, .baseArrayLayer = 0, .layerCount = 1 },
+			.imageOffset = VkOffset3D { .x = 0, .y = 0, .z = 0 },
+			.imageExtent = VkExtent3D { .width = levelExtent.x, .height = levelExtent.y, .depth = 1 }
+		};
+	}
+
+	transitionImageLayout(vkDev, tex.image.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, mipLevels);
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDev);
+	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, tex.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+	endSingleTimeCommands(vkDev, commandBuffer);
+
+	transitionImageLayout(vkDev, tex.image.image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, mipLevels);
+
+	vkDestroyBuffer(vkDev.device, stagingBuffer, nullptr);
+	vkFreeMemory(vkDev.device, stagingBufferMemory, nullptr);
+
+	if (!createImageView(vkDev.device, tex.image.image, format, VK_IMAGE_ASPECT_COLOR_BIT, &tex.image.imageView, VK_IMAGE_VIEW_TYPE_2D, 1, mipLevels))
+	{
+		printf("Cannot create image view for 2d texture (%s)\n", fileName);
+		exit(EXIT_FAILURE);
+	}
+
+	createTextureSampler(vkDev.device, &tex.sampler, VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, (float)mipLevels);
+	allTextures.push_back(tex);
+	return tex;
+}
+
 VulkanTexture VulkanResources::loadTexture2D(const char* filename)
 {
+	const char* ext = strrchr(filename, '.');
+	if (ext && !strcmp(ext, ".ktx"))
+		return loadMipmappedKTX(filename);
+
 	VulkanTexture tex;
 	if (!createTextureImage(vkDev, filename, tex.image.image, tex.image.imageMemory, &tex.width, &tex.height))
 	{
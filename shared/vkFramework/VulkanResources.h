@@ -7,6 +7,8 @@
 #include <map>
 #include <utility>
 
+namespace gli { class texture; }
+
 /**
 	For more or less abstract descriptor set setup we need to describe individual items ("bindings").
 	These are buffers, textures (samplers, but we call them "textures" here) and arrays of textures.
@@ -154,6 +156,11 @@ struct VulkanResources
 
 	VulkanTexture loadKTX(const char* fileName);
 
+	/* Mipmapped RGBA8/BC3/ETC2 textures produced by SceneConverter (loadTexture2D() forwards .ktx files here) */
+	VulkanTexture loadMipmappedKTX(const char* fileName);
+	/* The same for a texture already loaded with gli::load_ktx() (e.g. on a worker thread), 'fileName' is for the error messages */
+	VulkanTexture loadMipmappedKTX(const gli::texture& gliTex, const char* fileName);
+
 	VulkanTexture createFontTexture(const char* fontFile);
 
 	VulkanTexture addColorTexture(int texWidth = 0, int texHeight = 0, VkFormat colorFormat = VK_FORMAT_B8G8R8A8_UNORM, VkFilter minFilter = VK_FILTER_LINEAR, VkFilter maxFilter = VK_FILTER_LINEAR, VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);